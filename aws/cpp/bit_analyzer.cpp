@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <sched.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "bit_analyzer.h"
+
+BitAnalyzer::BitAnalyzer(OnlineKS* ks, SPRT* sprt) : ks(ks), sprt(sprt), ring(ANALYZER_RING_SIZE),
+    running(false), drops(0), bits_sent(0), decided_flag(false), bits_done(0)
+{
+}
+
+void BitAnalyzer::start(int cpu)
+{
+    if (running)
+        return;
+    drops = 0;
+    bits_sent = 0;
+    bits_done.store(0);
+    running = true;
+    worker = std::thread(&BitAnalyzer::run, this, cpu);
+}
+
+void BitAnalyzer::stop()
+{
+    if (!running)
+        return;
+    push_marker(RECORD_QUIT);
+    worker.join();
+    running = false;
+}
+
+/* Markers must not be dropped, so wait for room */
+void BitAnalyzer::push_marker(int kind)
+{
+    latency_record_t record = { kind, 0, 0 };
+    while (!ring.push(record))
+        _mm_pause();
+}
+
+void BitAnalyzer::begin_bit(bool sequential)
+{
+    decided_flag.store(false, std::memory_order_relaxed);
+    push_marker(sequential ? RECORD_BIT_START_SEQUENTIAL : RECORD_BIT_START);
+}
+
+bit_result_t BitAnalyzer::end_bit()
+{
+    push_marker(RECORD_BIT_END);
+    bits_sent++;
+    while (bits_done.load(std::memory_order_acquire) < bits_sent)
+        _mm_pause();
+    return result;
+}
+
+void BitAnalyzer::run(int cpu)
+{
+    if (cpu >= 0)
+        pin_current_thread(cpu);
+
+    bool sequential = false;
+    int samples = 0;
+    uint64_t decision_tsc = 0;
+    latency_record_t record;
+    int idle_polls = 0;
+    struct timespec nap = { 0, ANALYZER_IDLE_SLEEP_NS };
+    while (true) {
+        if (!ring.pop(record)) {
+            if (++idle_polls < ANALYZER_SPIN_POLLS)
+                _mm_pause();
+            else
+                nanosleep(&nap, NULL);
+            continue;
+        }
+        idle_polls = 0;
+
+        switch (record.kind) {
+        case RECORD_SAMPLE:
+            ks->add(record.latency);
+            samples++;
+            /* Samples that arrive after the decision (sampler hasn't noticed yet) only feed KS */
+            if (sequential && decision_tsc == 0 && sprt->add(record.latency) >= 0) {
+                decision_tsc = record.tsc;
+                decided_flag.store(true, std::memory_order_relaxed);
+            }
+            break;
+
+        case RECORD_BIT_START:
+        case RECORD_BIT_START_SEQUENTIAL:
+            sequential = record.kind == RECORD_BIT_START_SEQUENTIAL;
+            ks->reset();
+            if (sequential)     sprt->reset();
+            samples = 0;
+            decision_tsc = 0;
+            break;
+
+        case RECORD_BIT_END:
+            result.ksvalue = ks->statistic();
+            result.ksmax = ks->max_distance();
+            result.sprt_decision = sequential ? sprt->get_decision() : -1;
+            result.sprt_samples = sequential ? sprt->get_samples() : 0;
+            result.decision_tsc = decision_tsc;
+            result.samples = samples;
+            bits_done.fetch_add(1, std::memory_order_release);
+            break;
+
+        case RECORD_QUIT:
+            return;
+        }
+    }
+}
+
+AnalyzerScope::AnalyzerScope(BitAnalyzer& analyzer, bool enable) : analyzer(analyzer), active(false),
+    pinned(false), sampler_cpu(-1), analysis_cpu(-1)
+{
+    std::vector<int> cpus = allowed_cpus();
+    if (!enable || cpus.size() < 2)
+        return;
+
+    /* First CPU that does not share the sampler's core */
+    std::vector<int> siblings = smt_siblings(cpus[0]);
+    for (size_t i = 1; i < cpus.size() && analysis_cpu < 0; i++)
+        if (std::find(siblings.begin(), siblings.end(), cpus[i]) == siblings.end())
+            analysis_cpu = cpus[i];
+    if (analysis_cpu < 0)
+        return;
+
+    sampler_cpu = cpus[0];
+    if (sched_getaffinity(0, sizeof(saved_affinity), &saved_affinity) == 0)
+        pinned = pin_current_thread(sampler_cpu);
+    analyzer.start(analysis_cpu);
+    active = true;
+}
+
+bool AnalyzerScope::finish()
+{
+    if (!active)
+        return false;
+    analyzer.stop();
+    if (pinned)
+        sched_setaffinity(0, sizeof(saved_affinity), &saved_affinity);
+    active = pinned = false;
+    return true;
+}
+
+std::vector<int> allowed_cpus(void)
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+    for (int i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET(i, &set))
+            cpus.push_back(i);
+    return cpus;
+}
+
+std::vector<int> smt_siblings(int cpu)
+{
+    std::vector<int> siblings;
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return siblings;
+
+    /* e.g. "0,4" or "0-1" */
+    int first, last;
+    char sep;
+    while (fscanf(file, "%d", &first) == 1) {
+        last = first;
+        sep = fgetc(file);
+        if (sep == '-') {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            sep = fgetc(file);
+        }
+        for (int c = first; c <= last; c++)
+            siblings.push_back(c);
+        if (sep != ',')
+            break;
+    }
+    fclose(file);
+    return siblings;
+}
+
+bool pin_current_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
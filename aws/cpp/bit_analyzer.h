@@ -0,0 +1,130 @@
+#ifndef BIT_ANALYZER_H
+#define BIT_ANALYZER_H
+
+#include <cstdint>
+#include <sched.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "kstest.h"
+#include "sprt.h"
+#include "spsc_ring.h"
+
+#define ANALYZER_RING_SIZE      (1 << 14)       /* Records in flight; the analyzer only falls behind if descheduled */
+#define ANALYZER_SPIN_POLLS     64              /* Empty polls of the ring before the analyzer goes to sleep        */
+#define ANALYZER_IDLE_SLEEP_NS  50000           /* and how long it sleeps (samples are ~1 ms apart at the default rate) */
+
+/* Record passed from the sampler to the analysis thread */
+typedef struct {
+    int kind;
+    int64_t latency;            /* Cycles (for samples) */
+    uint64_t tsc;               /* When the sample was taken */
+} latency_record_t;
+
+enum { RECORD_SAMPLE, RECORD_BIT_START, RECORD_BIT_START_SEQUENTIAL, RECORD_BIT_END, RECORD_QUIT };
+
+/* What the analysis thread concluded about a bit */
+typedef struct {
+    double ksvalue;
+    double ksmax;               /* Classic KS distance D */
+    int sprt_decision;          /* -1 if undecided (or not sequential) */
+    int sprt_samples;
+    uint64_t decision_tsc;      /* Timestamp of the sample that decided the SPRT */
+    int samples;
+} bit_result_t;
+
+/* Moves the per-bit statistics off the sampling thread. The sampler pushes timestamped
+ * latencies into a lock-free ring and an analysis thread (pinned to another CPU) feeds
+ * them to the KS and SPRT engines as they arrive, so sampling never stops for analysis.
+ * When the ring is empty the analysis thread sleeps in short naps rather than spinning,
+ * so it stays off the CPU between samples; the sampler never makes a syscall to wake it.
+ * The engines must be calibrated before start() and are owned by the analysis thread
+ * until stop(). All other methods are for the sampling thread only.
+ */
+class BitAnalyzer
+{
+public:
+    BitAnalyzer(OnlineKS* ks, SPRT* sprt);
+    ~BitAnalyzer()                  { stop(); }
+
+    /* Launch the analysis thread, pinned to the given CPU (or unpinned if < 0) */
+    void start(int cpu);
+    void stop();
+
+    void begin_bit(bool sequential);
+
+    inline void add(int64_t latency, uint64_t tsc) {
+        latency_record_t record = { RECORD_SAMPLE, latency, tsc };
+        if (!ring.push(record))
+            drops++;
+    }
+
+    /* Set once the SPRT of the current bit has decided; sampling can stop */
+    inline bool decided() const     { return decided_flag.load(std::memory_order_relaxed); }
+
+    /* Close the current bit and wait for the analysis thread to catch up */
+    bit_result_t end_bit();
+
+    uint64_t get_drops() const      { return drops; }
+    bool is_running() const         { return running; }
+
+private:
+    void run(int cpu);
+    void push_marker(int kind);
+
+    OnlineKS* ks;
+    SPRT* sprt;
+    SpscRing<latency_record_t> ring;
+    std::thread worker;
+    bool running;
+    uint64_t drops;
+    uint64_t bits_sent;
+
+    std::atomic<bool> decided_flag;
+    std::atomic<uint64_t> bits_done;
+    bit_result_t result;            /* Published by bits_done */
+};
+
+/* Runs a BitAnalyzer for the lifetime of a scope. If enabled and there are two allowed
+ * CPUs that are not SMT siblings (hyperthreads of one core, which would share the core the
+ * sampler times on), pins the calling thread to one and starts the analyzer on the other.
+ * Leaving the scope, normally or by an exception, stops and joins the analysis thread and
+ * restores the calling thread's affinity. Otherwise statistics stay on the sampling thread.
+ */
+class AnalyzerScope
+{
+public:
+    AnalyzerScope(BitAnalyzer& analyzer, bool enable);
+    ~AnalyzerScope()                { finish(); }
+
+    /* Stops the analyzer and restores affinity; returns false if it was not running */
+    bool finish();
+
+    bool is_active() const          { return active; }
+    bool is_pinned() const          { return pinned; }
+    int get_sampler_cpu() const     { return sampler_cpu; }
+    int get_analysis_cpu() const    { return analysis_cpu; }
+
+private:
+    AnalyzerScope(const AnalyzerScope&);
+    AnalyzerScope& operator=(const AnalyzerScope&);
+
+    BitAnalyzer& analyzer;
+    cpu_set_t saved_affinity;
+    bool active;
+    bool pinned;
+    int sampler_cpu;
+    int analysis_cpu;
+};
+
+/* CPUs this process may run on */
+std::vector<int> allowed_cpus(void);
+
+/* CPUs sharing a core with the given one (itself included), from sysfs; empty if unknown */
+std::vector<int> smt_siblings(int cpu);
+
+/* Pin the calling thread to one CPU; returns false on failure */
+bool pin_current_thread(int cpu);
+
+#endif /* BIT_ANALYZER_H */
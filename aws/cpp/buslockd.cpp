@@ -0,0 +1,395 @@
+/* buslockd: the defender's side of the membus channel. Finds the processes (and
+ * cgroups) behind split-lock / bus-lock storms on this host, like the ones write_bit
+ * and perform_exotic_ops create, and ranks them every interval.
+ *
+ * Offenders come from one of two sources:
+ *   perf  per-CPU sampling of the bus-lock event (one sample every <period> events,
+ *         attributed to the pid that took it). Needs a PMU and root (or a permissive
+ *         perf_event_paranoid); costs next to nothing between samples. The default
+ *         event is Intel's: on other CPUs, give theirs with -r.
+ *   kmsg  the kernel's split_lock_detect warnings ("#AC: comm/pid took a split_lock
+ *         trap", "#DB: ... bus_lock trap"). Works in guests without a PMU, but the
+ *         kernel rate-limits them, so counts are lower bounds.
+ * Victims: a MembusMonitor on an ordinary (aligned) locked add, which bus locks slow
+ * down like everything else, flags when its latency distribution shifts from its
+ * baseline (the KS test read_bit uses) within a small CPU budget.
+ *
+ * To try it, run local/cpp3/run.sh (four pinned lambdas) next to it.
+ *
+ * Usage: ./buslockd [-s auto|perf|kmsg] [-i interval_ms] [-n top] [-d secs (0: until ^C)]
+ *                   [-b victim_cpu_budget (0: no victim probe)] [-r raw_event] [-p period]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "monitor.h"
+#include "perfctr.h"
+
+#define DEFAULT_INTERVAL_MS     1000
+#define DEFAULT_TOP             10
+#define DEFAULT_PERIOD          100         /* Bus-lock events per perf sample */
+#define DEFAULT_VICTIM_BUDGET   0.005
+#define RING_PAGES              16          /* Data pages per CPU ring (power of 2) */
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+   stop_requested = 1;
+}
+
+static int64_t now_mus(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/************************** OFFENDER SOURCES ******************************************************/
+
+/* Bus-lock events per pid since the last drain */
+typedef std::map<int, uint64_t> event_counts_t;
+
+class EventSource
+{
+public:
+   virtual ~EventSource() {}
+   virtual const char* name() const = 0;
+   virtual void drain(event_counts_t& counts, std::map<int, std::string>& comms) = 0;
+   virtual uint64_t get_lost() const = 0;
+};
+
+/* One sampling event per CPU, each with its own ring of PERF_RECORD_SAMPLE {pid, tid} */
+class PerfSource : public EventSource
+{
+public:
+   PerfSource() : period(DEFAULT_PERIOD), lost(0) {}
+   ~PerfSource() {
+      long page_size = sysconf(_SC_PAGESIZE);
+      for (size_t i = 0; i < fds.size(); i++) {
+         munmap(rings[i], (1 + RING_PAGES) * page_size);
+         close(fds[i]);
+      }
+   }
+
+   const char* name() const         { return "perf"; }
+   uint64_t get_lost() const        { return lost; }
+
+   bool open(uint64_t raw_event, uint64_t sample_period, std::string* error) {
+      if (raw_event == PERF_BUS_LOCK_RAW && !cpu_is_intel()) {
+         *error = "the default bus-lock event is Intel's, give this CPU's with -r";
+         return false;
+      }
+      period = sample_period;
+      long page_size = sysconf(_SC_PAGESIZE);
+      int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+      for (int cpu = 0; cpu < ncpus; cpu++) {
+         struct perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size = sizeof(attr);
+         attr.type = PERF_TYPE_RAW;
+         attr.config = raw_event;
+         attr.sample_period = period;
+         attr.sample_type = PERF_SAMPLE_TID;
+         attr.wakeup_events = 1 << 30;    /* Never wake anyone, we poll */
+
+         int fd = syscall(SYS_perf_event_open, &attr, -1, cpu, -1, 0);
+         if (fd < 0) {
+            *error = std::string("perf_event_open on cpu ") + std::to_string(cpu) + ": " + strerror(errno);
+            return false;
+         }
+         void* ring = mmap(NULL, (1 + RING_PAGES) * page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+         if (ring == MAP_FAILED) {
+            *error = std::string("mmap: ") + strerror(errno);
+            close(fd);
+            return false;
+         }
+         fds.push_back(fd);
+         rings.push_back((struct perf_event_mmap_page*) ring);
+      }
+      return !fds.empty();
+   }
+
+   /* Samples carry the pid only: comms are looked up by the caller */
+   void drain(event_counts_t& counts, std::map<int, std::string>& /* comms */) {
+      long page_size = sysconf(_SC_PAGESIZE);
+      uint64_t data_size = RING_PAGES * page_size;
+      for (size_t i = 0; i < rings.size(); i++) {
+         struct perf_event_mmap_page* page = rings[i];
+         uint8_t* data = (uint8_t*) page + page_size;
+         uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+         uint64_t tail = page->data_tail;
+
+         while (tail < head) {
+            /* Records may wrap around the end of the ring; copy them out whole */
+            struct perf_event_header header;
+            copy_from_ring(data, data_size, tail, &header, sizeof(header));
+            uint8_t record[256];
+            if (header.size > sizeof(record) || header.size < sizeof(header))
+               break;
+            copy_from_ring(data, data_size, tail, record, header.size);
+
+            if (header.type == PERF_RECORD_SAMPLE) {
+               uint32_t pid = *(uint32_t*) (record + sizeof(header));
+               counts[pid] += period;
+            }
+            else if (header.type == PERF_RECORD_LOST)
+               lost += *(uint64_t*) (record + sizeof(header) + sizeof(uint64_t));
+            tail += header.size;
+         }
+         __atomic_store_n(&page->data_tail, head, __ATOMIC_RELEASE);
+      }
+   }
+
+private:
+   static void copy_from_ring(uint8_t* data, uint64_t size, uint64_t offset, void* out, size_t len) {
+      uint64_t start = offset % size;
+      size_t first = std::min((uint64_t) len, size - start);
+      memcpy(out, data + start, first);
+      memcpy((uint8_t*) out + first, data, len - first);
+   }
+
+   uint64_t period;
+   uint64_t lost;
+   std::vector<int> fds;
+   std::vector<struct perf_event_mmap_page*> rings;
+};
+
+/* split_lock_detect warnings from the kernel log, read from where it was at open() */
+class KmsgSource : public EventSource
+{
+public:
+   KmsgSource() : fd(-1), lost(0) {}
+   ~KmsgSource()                    { if (fd >= 0) close(fd); }
+
+   const char* name() const         { return "kmsg"; }
+   uint64_t get_lost() const        { return lost; }
+
+   bool open(std::string* error) {
+      fd = ::open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
+      if (fd < 0) {
+         *error = std::string("/dev/kmsg: ") + strerror(errno);
+         return false;
+      }
+      lseek(fd, 0, SEEK_END);
+      return true;
+   }
+
+   /* One record per read(); EAGAIN once caught up, EPIPE if the kernel overwrote records */
+   void drain(event_counts_t& counts, std::map<int, std::string>& comms) {
+      char record[2048];
+      while (true) {
+         ssize_t len = read(fd, record, sizeof(record) - 1);
+         if (len < 0 && errno == EPIPE) {
+            lost++;
+            continue;
+         }
+         if (len <= 0)
+            break;
+         record[len] = 0;
+
+         /* "...;x86/split lock detection: #DB: comm/pid took a bus_lock trap at address: 0x..." */
+         if (!strstr(record, "took a split_lock trap") && !strstr(record, "took a bus_lock trap"))
+            continue;
+         char* who = strstr(record, "#AC: ");
+         if (!who)   who = strstr(record, "#DB: ");
+         char* took = strstr(record, " took a ");
+         if (!who || !took || took < who)
+            continue;
+         who += 5;
+         std::string name(who, took - who);
+         size_t slash = name.rfind('/');
+         if (slash == std::string::npos)
+            continue;
+         int pid = atoi(name.c_str() + slash + 1);
+         counts[pid]++;
+         comms[pid] = name.substr(0, slash);
+      }
+   }
+
+private:
+   int fd;
+   uint64_t lost;
+};
+
+/************************** ATTRIBUTION ******************************************************/
+
+static std::string read_first_line(const std::string& path)
+{
+   std::ifstream file(path);
+   std::string line;
+   std::getline(file, line);
+   return line;
+}
+
+/* Unified (v2) cgroup path, or the first hierarchy listed */
+static std::string cgroup_of(int pid)
+{
+   std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+   std::string line, first;
+   while (std::getline(file, line)) {
+      size_t sep = line.find(':', line.find(':') + 1);
+      if (sep == std::string::npos)
+         continue;
+      if (line.compare(0, 3, "0::") == 0)
+         return line.substr(sep + 1);
+      if (first.empty())
+         first = line.substr(sep + 1);
+   }
+   return first.empty() ? "?" : first;
+}
+
+typedef struct {
+   std::string comm;
+   std::string cgroup;
+   uint64_t total;
+} offender_t;
+
+int main(int argc, char** argv)
+{
+   std::string source_name = "auto";
+   int interval_ms = DEFAULT_INTERVAL_MS, top = DEFAULT_TOP, duration_secs = 0;
+   double victim_budget = DEFAULT_VICTIM_BUDGET;
+   uint64_t raw_event = PERF_BUS_LOCK_RAW, period = DEFAULT_PERIOD;
+   int opt;
+   while ((opt = getopt(argc, argv, "s:i:n:d:b:r:p:")) != -1) {
+      switch (opt) {
+      case 's':   source_name = optarg;                       break;
+      case 'i':   interval_ms = atoi(optarg);                 break;
+      case 'n':   top = atoi(optarg);                         break;
+      case 'd':   duration_secs = atoi(optarg);               break;
+      case 'b':   victim_budget = atof(optarg);               break;
+      case 'r':   raw_event = strtoull(optarg, NULL, 0);      break;
+      case 'p':   period = strtoull(optarg, NULL, 0);         break;
+      default:
+         printf("Usage: %s [-s auto|perf|kmsg] [-i interval_ms] [-n top] [-d secs] [-b victim_cpu_budget] [-r raw_event] [-p period]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (interval_ms <= 0 || top <= 0 || duration_secs < 0 || victim_budget < 0 || victim_budget > 1 || period == 0) {
+      printf("ERROR! Interval, top and period must be positive, duration not negative and the budget in [0, 1]\n");
+      return 1;
+   }
+
+   /* Prefer counting every bus lock; fall back to what the kernel tells us */
+   EventSource* source = NULL;
+   std::string error;
+   if (source_name == "auto" || source_name == "perf") {
+      PerfSource* perf = new PerfSource();
+      if (perf->open(raw_event, period, &error))   source = perf;
+      else {
+         delete perf;
+         printf("perf source unavailable (%s)\n", error.c_str());
+      }
+   }
+   if (!source && (source_name == "auto" || source_name == "kmsg")) {
+      KmsgSource* kmsg = new KmsgSource();
+      if (kmsg->open(&error))    source = kmsg;
+      else {
+         delete kmsg;
+         printf("kmsg source unavailable (%s)\n", error.c_str());
+      }
+   }
+   if (!source) {
+      printf("ERROR! No bus-lock event source (try running as root)\n");
+      return 1;
+   }
+   printf("Watching bus locks via %s every %d ms\n", source->name(), interval_ms);
+
+   /* Victim probe: a locked add on a line of its own, so it takes no bus locks itself */
+   tsc_calibrate();
+   uint64_t* probe = (uint64_t*) aligned_alloc(64, 64);
+   *probe = 0;
+   MembusMonitor* victim = NULL;
+   if (victim_budget > 0) {
+      monitor_config_t config = monitor_default_config();
+      config.cpu_budget = victim_budget;
+      victim = new MembusMonitor(probe, config, now_mus() ^ getpid());
+      victim->start();
+   }
+
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+
+   std::map<int, offender_t> offenders;
+   std::map<int, std::string> comms;
+   int64_t start_mus = now_mus();
+   int64_t next_mus = start_mus + interval_ms * 1000LL;
+   while (!stop_requested && (duration_secs == 0 || now_mus() - start_mus < duration_secs * 1000000LL)) {
+      int64_t wait = next_mus - now_mus();
+      if (wait > 0)    usleep(wait);
+      next_mus += interval_ms * 1000LL;
+
+      event_counts_t counts;
+      source->drain(counts, comms);
+
+      /* Rank this interval's offenders, and their cgroups */
+      std::vector< std::pair<uint64_t, int> > ranked;
+      std::map<std::string, uint64_t> by_cgroup;
+      for (event_counts_t::iterator it = counts.begin(); it != counts.end(); ++it) {
+         offender_t& offender = offenders[it->first];
+         if (offender.comm.empty()) {
+            offender.comm = comms.count(it->first) ? comms[it->first] : read_first_line("/proc/" + std::to_string(it->first) + "/comm");
+            offender.cgroup = cgroup_of(it->first);
+         }
+         offender.total += it->second;
+         ranked.push_back(std::make_pair(it->second, it->first));
+         by_cgroup[offender.cgroup] += it->second;
+      }
+      std::sort(ranked.rbegin(), ranked.rend());
+
+      bool contended = victim != NULL && victim->in_contention();
+      std::vector<monitor_event_t> events;
+      if (victim)    events = victim->take_events();
+      for (size_t i = 0; i < events.size(); i++)
+         printf("%s victim latency shift %s: D %.3lf, median x%.2lf, p-value %.3g\n",
+            events[i].onset ? "ALERT" : "CLEAR", events[i].onset ? "onset" : "offset",
+            events[i].severity, events[i].latency_ratio, events[i].pvalue);
+
+      double secs = interval_ms / 1000.0;
+      printf("[%.1lf s] %lu offenders, victim %s\n", (now_mus() - start_mus) / 1e6, ranked.size(),
+         victim == NULL ? "off" : contended ? "CONTENDED" : "ok");
+      for (size_t i = 0; i < ranked.size() && (int) i < top; i++) {
+         offender_t& offender = offenders[ranked[i].second];
+         printf("  %7d %-16s %10.0lf locks/s  %s\n", ranked[i].second, offender.comm.c_str(), ranked[i].first / secs, offender.cgroup.c_str());
+      }
+      for (std::map<std::string, uint64_t>::iterator it = by_cgroup.begin(); it != by_cgroup.end() && by_cgroup.size() > 1; ++it)
+         printf("  cgroup %-40s %10.0lf locks/s\n", it->first.c_str(), it->second / secs);
+      fflush(stdout);
+   }
+
+   /* What watching cost us */
+   if (victim)    victim->stop();
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   double cpu_secs = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+   double wall_secs = (now_mus() - start_mus) / 1e6;
+   printf("Done after %.1lf s: CPU %.3lf%%, %lu events lost", wall_secs, 100 * cpu_secs / wall_secs, source->get_lost());
+   if (victim) {
+      monitor_stats_t stats = victim->get_stats();
+      printf(", victim probe %d windows (%d contended), %.3lf%% CPU", stats.windows, stats.contended_windows, 100 * stats.cpu_used);
+   }
+   printf("\n");
+
+   delete victim;
+   delete source;
+   free(probe);
+   return 0;
+}
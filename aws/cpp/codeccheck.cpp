@@ -0,0 +1,154 @@
+/* Round-trip checks of the response encodings (samplecodec.h):
+ *   samples     encode_samples/decode_samples on random lists with negative deltas, on
+ *               empty and single-element lists and on INT64_MIN/INT64_MAX next to each other
+ *   bits        encode_bits/decode_bits on every length from 0 to a few bytes' worth
+ *   responses   find_samples/find_bits on response bodies written like the handler's, in
+ *               both encodings, plain and escaped inside the Lambda proxy envelope
+ * Also checks that truncated or garbled text is refused. Prints each mismatch and exits
+ * non-zero if there was any (run by ctest).
+ *
+ * Usage: ./codeccheck [-t trials] [-s seed]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <unistd.h>
+
+#include "samplecodec.h"
+#include "jsonwriter.h"
+
+#define DEFAULT_TRIALS          200
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, size_t n)
+{
+   if (ok)
+      return;
+   failures++;
+   printf("FAIL %s (%lu values)\n", what, n);
+}
+
+static void check_samples(const std::vector<int64_t>& values)
+{
+   std::string text = encode_samples(values.data(), values.size());
+   std::vector<int64_t> decoded;
+   check(decode_samples(text.data(), text.size(), decoded) && decoded == values, "samples round trip", values.size());
+   if (!text.empty()) {
+      std::string cut = text.substr(0, text.size() - 4);
+      check(values.empty() || !decode_samples(cut.data(), cut.size(), decoded), "truncated samples refused", values.size());
+   }
+}
+
+static void check_bits(const std::vector<bool>& bits)
+{
+   std::string text = encode_bits(bits);
+   std::vector<bool> decoded;
+   check(decode_bits(text.data(), text.size(), decoded) && decoded == bits, "bits round trip", bits.size());
+}
+
+/* A response body like the handler's, for the given encoding, and the same body as the
+ * escaped "body" string of the proxy envelope */
+static void check_response(const std::vector<int64_t>& base, const std::vector<int64_t>& bit1,
+   const std::vector<bool>& data, bool varint)
+{
+   JsonWriter body;
+   body.begin_object();
+   body.field("Id", 17);
+   body.field("Encoding", varint ? "delta-varint" : "decimal");
+   if (varint) {
+      body.field("Base Sample", encode_samples(base.data(), base.size()));
+      body.field("Bit-1 Sample", encode_samples(bit1.data(), bit1.size()));
+   }
+   else {
+      body.key("Base Sample").value_list(base.data(), base.size());
+      body.key("Bit-1 Sample").value_list(bit1.data(), bit1.size());
+   }
+   std::string bits_text;
+   for (size_t i = 0; i < data.size(); i++)
+      bits_text += data[i] ? '1' : '0';
+   body.field("Data", varint ? encode_bits(data) : bits_text);
+   body.end_object();
+
+   JsonWriter envelope;
+   envelope.begin_object();
+   envelope.field("statusCode", 200);
+   envelope.field("body", body.str());
+   envelope.end_object();
+
+   const std::string* texts[] = { &body.str(), &envelope.str() };
+   for (int t = 0; t < 2; t++) {
+      std::vector<int64_t> got;
+      std::vector<bool> got_bits;
+      check(find_samples(*texts[t], "Base Sample", got) && got == base, t ? "escaped base sample" : "base sample", base.size());
+      check(find_samples(*texts[t], "Bit-1 Sample", got) && got == bit1, t ? "escaped bit-1 sample" : "bit-1 sample", bit1.size());
+      check(find_bits(*texts[t], "Data", got_bits) && got_bits == data, t ? "escaped data" : "data", data.size());
+      check(!find_samples(*texts[t], "Bit-0 Sample", got), "missing key refused", 0);
+   }
+}
+
+int main(int argc, char** argv)
+{
+   int trials = DEFAULT_TRIALS;
+   uint64_t seed = 1;
+   int opt;
+   while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+      switch (opt) {
+      case 't':   trials = atoi(optarg);                  break;
+      case 's':   seed = strtoull(optarg, NULL, 10);      break;
+      default:
+         printf("Usage: %s [-t trials] [-s seed]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (trials <= 0) {
+      printf("ERROR! Provide a positive number of trials\n");
+      return 1;
+   }
+
+   std::mt19937_64 rng(seed);
+   std::uniform_int_distribution<int> size(0, 3000);
+   std::uniform_int_distribution<int64_t> latency(-2000, 30000);
+   std::vector<int64_t> base, bit1;
+   std::vector<bool> data;
+   for (int t = 0; t < trials; t++) {
+      base.resize(size(rng));
+      bit1.resize(size(rng));
+      data.resize(size(rng));
+      for (size_t i = 0; i < base.size(); i++)   base[i] = latency(rng);
+      for (size_t i = 0; i < bit1.size(); i++)   bit1[i] = latency(rng);
+      for (size_t i = 0; i < data.size(); i++)   data[i] = rng() & 1;
+      check_samples(base);
+      check_samples(bit1);
+      check_bits(data);
+      check_response(base, bit1, data, t % 2);
+   }
+
+   /* Edge cases: empty and single lists, 64-bit extremes (deltas that wrap) */
+   std::vector<int64_t> extremes = { 0, INT64_MAX, INT64_MIN, INT64_MAX, -1, 1, INT64_MIN, 0 };
+   check_samples(std::vector<int64_t>());
+   check_samples(std::vector<int64_t>(1, -5));
+   check_samples(extremes);
+   for (int n = 0; n <= 33; n++) {
+      std::vector<bool> bits(n);
+      for (int i = 0; i < n; i++)   bits[i] = (i * 7 + n) % 3 == 0;
+      check_bits(bits);
+   }
+   for (int varint = 0; varint < 2; varint++) {
+      check_response(std::vector<int64_t>(), std::vector<int64_t>(), std::vector<bool>(), varint);
+      check_response(extremes, std::vector<int64_t>(1, 42), std::vector<bool>(9, true), varint);
+   }
+
+   /* Garbled text */
+   std::vector<int64_t> values;
+   std::vector<bool> bits;
+   check(!decode_samples("!!!!", 4, values), "bad base64 refused", 0);
+   check(!decode_bits("/w==", 4, bits), "bit count past the data refused", 0);
+
+   printf("%d trials: %s\n", trials, failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+/* Benchmark for the exponential inter-arrival generator used to schedule membus
+ * samples: throughput of ExpGenerator against the old -logf(1 - random()/RAND_MAX)
+ * per-sample computation, and a check that its output is exponential. For the
+ * latter, the one-sample KS distance to the exponential CDF is reported along with
+ * kstest_mean() (the statistic read_bit uses) against a reference sample drawn with
+ * std::exponential_distribution.
+ *
+ * Usage: ./expbench [samples]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+
+#include "expgen.h"
+#include "kstest.h"
+
+#define DEFAULT_SAMPLES     100000
+#define THROUGHPUT_ROUNDS   10000000
+#define FIXED_POINT_SCALE   1000000.0       /* kstest_mean works on integers */
+
+using Clock = std::chrono::high_resolution_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+double next_poisson_time(double rate)
+{
+   return -logf(1.0f - ((double) random()) / (double) (RAND_MAX)) / rate;
+}
+
+/* Largest distance between the eCDF of the sample and the unit exponential CDF */
+static double ks_distance_exponential(std::vector<double> values)
+{
+   std::sort(values.begin(), values.end());
+   int n = values.size();
+   double d = 0;
+   for (int i = 0; i < n; i++) {
+      double cdf = 1 - exp(-values[i]);
+      d = std::max(d, std::max((i + 1.0) / n - cdf, cdf - i * 1.0 / n));
+   }
+   return d;
+}
+
+static double kstest_mean_vs(std::vector<double>& values, std::vector<double>& reference)
+{
+   std::vector<int64_t> a(values.size()), b(reference.size());
+   for (size_t i = 0; i < values.size(); i++)      a[i] = values[i] * FIXED_POINT_SCALE;
+   for (size_t i = 0; i < reference.size(); i++)   b[i] = reference[i] * FIXED_POINT_SCALE;
+   return kstest_mean(a.data(), a.size(), false, b.data(), b.size(), false);
+}
+
+static void report(const char* name, std::vector<double>& values, std::vector<double>& reference)
+{
+   double d = ks_distance_exponential(values);
+   /* sqrt(n)*D above 1.36 rejects "exponential" at the 5% level */
+   printf("%-28s KS D %.5lf (sqrt(n)*D %.3lf, 5%% critical 1.36), kstest_mean vs reference %.3lf\n",
+      name, d, sqrt(values.size()) * d, kstest_mean_vs(values, reference));
+}
+
+int main(int argc, char** argv)
+{
+   int n = argc > 1 ? atoi(argv[1]) : DEFAULT_SAMPLES;
+   if (n <= 0) {
+      printf("ERROR! Provide a positive number of samples\n");
+      return 1;
+   }
+
+   /* Throughput */
+   volatile double sink = 0;
+   srandom(1);
+   Clock::time_point t0 = Clock::now();
+   for (int i = 0; i < THROUGHPUT_ROUNDS; i++)
+      sink = sink + next_poisson_time(1.0);
+   Clock::time_point t1 = Clock::now();
+   ExpGenerator gen(1);
+   for (int i = 0; i < THROUGHPUT_ROUNDS; i++)
+      sink = sink + gen.next(1.0);
+   Clock::time_point t2 = Clock::now();
+   printf("random()+logf:  %.2lf ns/variate\n", duration_cast<nanoseconds>(t1 - t0).count() * 1.0 / THROUGHPUT_ROUNDS);
+   printf("ExpGenerator:   %.2lf ns/variate\n", duration_cast<nanoseconds>(t2 - t1).count() * 1.0 / THROUGHPUT_ROUNDS);
+
+   /* Distribution */
+   std::mt19937_64 mt(42);
+   std::exponential_distribution<double> exact(1.0);
+   std::vector<double> reference(n), legacy(n), batched(n);
+   for (int i = 0; i < n; i++)   reference[i] = exact(mt);
+   for (int i = 0; i < n; i++)   legacy[i] = next_poisson_time(1.0);
+   gen.set_seed(7);
+   for (int i = 0; i < n; i++)   batched[i] = gen.next(1.0);
+
+   std::vector<double> self(n);
+   for (int i = 0; i < n; i++)   self[i] = exact(mt);
+   report("std::exponential (control)", self, reference);
+   report("random()+logf", legacy, reference);
+   report("ExpGenerator", batched, reference);
+
+   /* Worst error of the polynomial log over the range the generator feeds it */
+   double max_err = 0;
+   for (uint32_t u = 1; u <= (1 << 24); u += 7) {
+      float x = u * (1.0f / 16777216.0f);
+      max_err = std::max(max_err, fabs(fast_logf(x) - log((double) x)));
+   }
+   printf("fast_logf max abs error on (0, 1]: %.3g\n", max_err);
+   return 0;
+}
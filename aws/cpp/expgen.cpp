@@ -0,0 +1,80 @@
+#include <cstring>
+
+#include "expgen.h"
+
+#define LN2     0.69314718055994530942f
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* Expand the seed with splitmix64, as recommended for seeding xoshiro */
+void ExpGenerator::set_seed(uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s[i] = z ^ (z >> 31);
+    }
+    pos = EXPGEN_BATCH;
+}
+
+/* xoshiro256+ (Blackman & Vigna); the upper bits are the good ones */
+uint64_t ExpGenerator::next_u64()
+{
+    uint64_t result = s[0] + s[3];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/* log(x) = e*ln2 + log(m) with x = m * 2^e, m in [1, 2). log(m) = 2*atanh(t) with
+ * t = (m-1)/(m+1) in [0, 1/3], where the odd series converges fast enough for floats. */
+static inline float log_inline(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float e = (float) ((int) (bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    float p = 1.0f / 9 + t2 * (1.0f / 11);
+    p = 1.0f / 7 + t2 * p;
+    p = 1.0f / 5 + t2 * p;
+    p = 1.0f / 3 + t2 * p;
+    p = 1.0f + t2 * p;
+    return e * LN2 + 2.0f * t * p;
+}
+
+float fast_logf(float x)
+{
+    return log_inline(x);
+}
+
+void ExpGenerator::refill()
+{
+    /* Two 24-bit uniforms per 64-bit draw */
+    for (int i = 0; i < EXPGEN_BATCH; i += 2) {
+        uint64_t r = next_u64();
+        uniform[i] = r >> 40;
+        uniform[i + 1] = (r >> 16) & 0xffffff;
+    }
+
+    /* Inversion: -log(u) with u in (0, 1], so the log is always finite. No branches
+     * or calls in this loop, so it gets vectorized. */
+    for (int i = 0; i < EXPGEN_BATCH; i++) {
+        float u = (uniform[i] + 1) * (1.0f / 16777216.0f);
+        buffer[i] = -log_inline(u);
+    }
+    pos = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef EXPGEN_H
+#define EXPGEN_H
+
+#include <cstdint>
+
+#define EXPGEN_BATCH    256         /* Variates generated per refill */
+
+/* Exponential inter-arrival times for Poisson sampling.
+ * Uses its own xoshiro256+ state (no shared libc random() state, so keep one per
+ * sampling thread) and generates variates in batches: a refill draws a batch of
+ * uniforms and inverts them with a branch-free polynomial log the compiler can
+ * vectorize, and next() is then just a buffer read.
+ */
+class ExpGenerator
+{
+public:
+    explicit ExpGenerator(uint64_t seed = 1)   { set_seed(seed); }
+
+    void set_seed(uint64_t seed);
+
+    /* Exponential variate with the given mean */
+    inline double next(double mean) {
+        if (pos == EXPGEN_BATCH)
+            refill();
+        return buffer[pos++] * mean;
+    }
+
+    /* Regenerate the whole batch (next() calls this when it runs out) */
+    void refill();
+
+    /* Raw 64-bit output of the underlying xoshiro256+ generator */
+    uint64_t next_u64();
+
+private:
+    uint64_t s[4];
+    int pos;
+    uint32_t uniform[EXPGEN_BATCH];
+    float buffer[EXPGEN_BATCH];     /* Unit-mean variates */
+};
+
+/* Branch-free natural log for positive, finite, normal floats (abs error about 1e-6) */
+float fast_logf(float x);
+
+#endif /* EXPGEN_H */
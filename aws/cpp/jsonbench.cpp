@@ -0,0 +1,241 @@
+/* Benchmark for JSON parsing: RSJparser (what the handler used) against JsonDoc
+ * (jsonreader.h), on
+ *   request   an invoke.py request inside the API Gateway proxy envelope, with every
+ *             field the handler reads looked up and converted, as at the start of
+ *             my_handler (RSJ unescapes the nested body twice, as the handler did)
+ *   result    a response body with the given number of samples per list and a
+ *             megabyte of logs, as the offline tools read them: a few fields and
+ *             one sample list
+ *   files     any saved responses given with -f, same lookups as result
+ *
+ * Usage: ./jsonbench [-n repetitions] [-s samples] [-f result.json]...
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <unistd.h>
+
+#include "RSJparser.tcc"
+#include "jsonreader.h"
+#include "jsonwriter.h"
+#include "util.h"
+
+#define DEFAULT_REPETITIONS     1000
+#define DEFAULT_SAMPLES         20000
+#define LOG_BYTES               (1 << 20)
+
+using Clock = std::chrono::high_resolution_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+static volatile double sink;
+
+/* Fields my_handler reads from the request, and how */
+typedef enum { F_INT, F_BOOL, F_DOUBLE, F_STRING } field_kind_t;
+static const struct {
+   const char* key;
+   field_kind_t kind;
+} request_fields[] = {
+   { "id", F_INT }, { "stime", F_INT }, { "log", F_BOOL }, { "log_budget", F_INT }, { "samples", F_BOOL },
+   { "encoding", F_STRING }, { "phases", F_INT }, { "repeat_phases", F_INT }, { "maxbits", F_INT },
+   { "bitduration", F_INT }, { "bitduration_ms", F_INT }, { "samplerate", F_INT }, { "sprt", F_BOOL },
+   { "sprt_alpha", F_DOUBLE }, { "sprt_beta", F_DOUBLE }, { "sprt_p1", F_DOUBLE }, { "sprt_quantile", F_DOUBLE },
+   { "ks_decision", F_STRING }, { "ks_alpha", F_DOUBLE }, { "ks_cutoff", F_DOUBLE }, { "pipeline", F_BOOL },
+   { "preempt_filter", F_BOOL }, { "perf", F_BOOL }, { "trace", F_BOOL }, { "trace_records", F_INT },
+   { "sleep_margin_us", F_INT }, { "return_data", F_BOOL }, { "s3bucket", F_STRING }, { "s3key", F_STRING },
+   { "guid", F_STRING }, { "channel", F_BOOL }, { "rate", F_INT }, { "threshold", F_INT },
+   { "threshold_ns", F_INT }, { "data", F_STRING }, { "datalen", F_INT }, { "mode", F_STRING },
+   { "monitor_secs", F_INT }, { "cpu_budget", F_DOUBLE }, { "window_ms", F_INT }, { "monitor_alpha", F_DOUBLE },
+};
+static const int num_request_fields = sizeof(request_fields) / sizeof(request_fields[0]);
+
+/* Request as invoke.py sends it, wrapped by API Gateway */
+static std::string make_request()
+{
+   JsonWriter body;
+   body.begin_object();
+   body.field("id", 417);
+   body.field("stime", 1697000000);
+   body.field("phases", 3);
+   body.field("log", true);
+   body.field("maxbits", 10);
+   body.field("bitduration", 1);
+   body.field("samples", true);
+   body.field("encoding", "decimal");
+   body.field("s3bucket", "membus-experiments-us-west-1");
+   body.field("s3key", "10-17-12-30/9f0c2a4e-1b7d-4c55-a1e2-6f9d1c2b3a4d");
+   body.field("guid", "9f0c2a4e-1b7d-4c55-a1e2-6f9d1c2b3a4d");
+   body.field("channel", true);
+   body.field("rate", 1000);
+   body.field("threshold", 10500);
+   body.field("repeat_phases", false);
+   body.end_object();
+
+   JsonWriter envelope;
+   envelope.begin_object();
+   envelope.field("resource", "/membus");
+   envelope.field("path", "/membus");
+   envelope.field("httpMethod", "POST");
+   envelope.key("headers").begin_object();
+   envelope.field("Content-Type", "application/json");
+   envelope.field("Host", "ockhe03c0i.execute-api.us-west-1.amazonaws.com");
+   envelope.field("User-Agent", "Python-urllib/3.8");
+   envelope.field("X-Forwarded-For", "203.0.113.7");
+   envelope.end_object();
+   envelope.key("requestContext").begin_object();
+   envelope.field("requestId", "c6af9ac6-7b61-11e6-9a41-93e8deadbeef");
+   envelope.field("stage", "latest");
+   envelope.end_object();
+   envelope.field("body", body.str());
+   envelope.field("isBase64Encoded", false);
+   envelope.end_object();
+   return envelope.str();
+}
+
+/* Response body with samples and logs, as saved to S3 */
+static std::string make_result(int samples)
+{
+   std::vector<int64_t> values(samples);
+   srand(1);
+   JsonWriter body(samples * 16 + LOG_BYTES * 2);
+   body.begin_object();
+   body.field("Id", 417);
+   body.field("Success", 1);
+   body.field("Error", "");
+   body.field("Phases", 3);
+   for (int i = 0; i < 3; i++)
+      body.key("Phase " + std::to_string(i + 1)).value(400 + i);
+   const char* lists[] = { "Base Sample", "Bit-1 Sample", "Bit-0 Sample" };
+   for (int l = 0; l < 3; l++) {
+      for (int i = 0; i < samples; i++)
+         values[i] = 3500 + rand() % 2000;
+      body.key(lists[l]).value_list(values.data(), values.size());
+   }
+   body.field("Bit-1 Pvalue", 1.2e-9);
+   body.field("Bit-0 Pvalue", 0.42);
+   body.field("Boot ID", "3f0c9d2e-6a4b-4c1e-9f7d-2b8a1c0e5d6f");
+   std::string logs;
+   while (logs.size() < LOG_BYTES)
+      logs += "[12:30:01.123456] Bit 3 of phase 2: read 1 (KS mean 4.21 >= \"cutoff\" 3.00, 1000 samples)\t";
+   body.field("Logs", logs);
+   body.end_object();
+   return body.str();
+}
+
+static double ns_since(Clock::time_point t0)
+{
+   return duration_cast<nanoseconds>(Clock::now() - t0).count();
+}
+
+static void bench_request(const std::string& payload, int reps)
+{
+   double acc = 0;
+   Clock::time_point t0 = Clock::now();
+   for (int r = 0; r < reps; r++) {
+      RSJresource body(payload);
+      if (body["body"].exists()) {
+         std::string escaped_body = body["body"].as<std::string>("");
+         body = RSJresource(util::unescape_json(escaped_body));
+      }
+      for (int f = 0; f < num_request_fields; f++) {
+         switch (request_fields[f].kind) {
+         case F_INT:      acc += body[request_fields[f].key].as<int>(0);                   break;
+         case F_BOOL:     acc += body[request_fields[f].key].as<bool>(false);              break;
+         case F_DOUBLE:   acc += body[request_fields[f].key].as<double>(0);                break;
+         case F_STRING:   acc += body[request_fields[f].key].as<std::string>("").size();   break;
+         }
+      }
+   }
+   double rsj = ns_since(t0) / reps;
+   sink = acc;
+
+   JsonDoc doc, nested;
+   std::string nested_body;
+   acc = 0;
+   t0 = Clock::now();
+   for (int r = 0; r < reps; r++) {
+      doc.parse(payload);
+      JsonValue body = doc.root();
+      if (body["body"].exists()) {
+         nested_body = body["body"].as<std::string>("");
+         nested.parse(nested_body);
+         body = nested.root();
+      }
+      for (int f = 0; f < num_request_fields; f++) {
+         switch (request_fields[f].kind) {
+         case F_INT:      acc += body[request_fields[f].key].as<int>(0);                   break;
+         case F_BOOL:     acc += body[request_fields[f].key].as<bool>(false);              break;
+         case F_DOUBLE:   acc += body[request_fields[f].key].as<double>(0);                break;
+         case F_STRING:   acc += body[request_fields[f].key].as<std::string>("").size();   break;
+         }
+      }
+   }
+   double jd = ns_since(t0) / reps;
+   sink = acc;
+   printf("request (%lu bytes, %d fields): RSJparser %.1lf us, JsonDoc %.2lf us (%.0fx)\n", payload.size(),
+      num_request_fields, rsj / 1000, jd / 1000, rsj / jd);
+}
+
+static void bench_result(const char* name, const std::string& text, int reps)
+{
+   Clock::time_point t0 = Clock::now();
+   size_t got = 0;
+   for (int r = 0; r < reps; r++) {
+      RSJresource body(text);
+      got = body["Id"].as<int>(0) + body["Success"].as<int>(0) + body["Base Sample"].as<std::string>("").size();
+   }
+   double rsj = ns_since(t0) / reps;
+   sink = got;
+
+   JsonDoc doc;
+   t0 = Clock::now();
+   for (int r = 0; r < reps; r++) {
+      doc.parse(text);
+      got = doc["Id"].as<int>(0) + doc["Success"].as<int>(0) + doc["Base Sample"].raw_length();
+   }
+   double jd = ns_since(t0) / reps;
+   sink = got;
+   printf("%s (%.1lf MB, %lu tokens): RSJparser %.2lf ms, JsonDoc %.3lf ms (%.0fx, %.0f MB/s)\n", name,
+      text.size() / 1e6, doc.get_token_count(), rsj / 1e6, jd / 1e6, rsj / jd, text.size() / (jd / 1e3));
+}
+
+int main(int argc, char** argv)
+{
+   int reps = DEFAULT_REPETITIONS, samples = DEFAULT_SAMPLES;
+   std::vector<const char*> files;
+   int opt;
+   while ((opt = getopt(argc, argv, "n:s:f:")) != -1) {
+      switch (opt) {
+      case 'n':   reps = atoi(optarg);          break;
+      case 's':   samples = atoi(optarg);       break;
+      case 'f':   files.push_back(optarg);      break;
+      default:
+         printf("Usage: %s [-n repetitions] [-s samples] [-f result.json]...\n", argv[0]);
+         return 1;
+      }
+   }
+   if (reps <= 0 || samples <= 0) {
+      printf("ERROR! Provide a positive number of repetitions and samples\n");
+      return 1;
+   }
+
+   bench_request(make_request(), reps);
+   bench_result("result", make_result(samples), reps / 100 > 0 ? reps / 100 : 1);
+   for (size_t f = 0; f < files.size(); f++) {
+      std::ifstream file(files[f]);
+      if (!file) {
+         printf("ERROR! Cannot read %s\n", files[f]);
+         continue;
+      }
+      std::stringstream ss;
+      ss << file.rdbuf();
+      bench_result(files[f], ss.str(), reps / 100 > 0 ? reps / 100 : 1);
+   }
+   return 0;
+}
@@ -0,0 +1,223 @@
+/* Checks that JsonDoc (jsonreader.h) reads requests as RSJparser did: every field
+ * my_handler reads is converted with as<int>/as<bool>/as<double>/as<std::string> by both,
+ * the way each was used in the handler, and the results compared. Requests are
+ *   envelope    invoke.py requests inside the API Gateway proxy envelope (the nested,
+ *               escaped "body"), with all, some and none of the fields set
+ *   plain       the same bodies sent directly, plus strings with escapes
+ *   edge cases  an empty nested body and numbers and flags given as strings
+ * Fields that are null read as the default in JsonDoc (RSJ read 0 for numbers, which the
+ * handler then used as a setting), so those are compared against the default instead.
+ * Prints each mismatch and exits non-zero if there was any (run by ctest).
+ *
+ * Usage: ./jsoncheck
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "RSJparser.tcc"
+#include "jsonreader.h"
+#include "jsonwriter.h"
+#include "util.h"
+
+/* Defaults that differ from what either parser would read from the requests below */
+#define INT_DEFAULT             -7
+#define DOUBLE_DEFAULT          -0.5
+#define STRING_DEFAULT          "unset"
+
+/* CAUTION: copy of jsonbench's list of the fields my_handler reads; keep them in sync */
+typedef enum { F_INT, F_BOOL, F_DOUBLE, F_STRING } field_kind_t;
+static const struct {
+   const char* key;
+   field_kind_t kind;
+} request_fields[] = {
+   { "id", F_INT }, { "stime", F_INT }, { "log", F_BOOL }, { "log_budget", F_INT }, { "samples", F_BOOL },
+   { "encoding", F_STRING }, { "phases", F_INT }, { "repeat_phases", F_INT }, { "maxbits", F_INT },
+   { "bitduration", F_INT }, { "bitduration_ms", F_INT }, { "samplerate", F_INT }, { "sprt", F_BOOL },
+   { "sprt_alpha", F_DOUBLE }, { "sprt_beta", F_DOUBLE }, { "sprt_p1", F_DOUBLE }, { "sprt_quantile", F_DOUBLE },
+   { "ks_decision", F_STRING }, { "ks_alpha", F_DOUBLE }, { "ks_cutoff", F_DOUBLE }, { "pipeline", F_BOOL },
+   { "preempt_filter", F_BOOL }, { "perf", F_BOOL }, { "trace", F_BOOL }, { "trace_records", F_INT },
+   { "sleep_margin_us", F_INT }, { "return_data", F_BOOL }, { "s3bucket", F_STRING }, { "s3key", F_STRING },
+   { "guid", F_STRING }, { "channel", F_BOOL }, { "rate", F_INT }, { "threshold", F_INT },
+   { "threshold_ns", F_INT }, { "data", F_STRING }, { "datalen", F_INT }, { "mode", F_STRING },
+   { "monitor_secs", F_INT }, { "cpu_budget", F_DOUBLE }, { "window_ms", F_INT }, { "monitor_alpha", F_DOUBLE },
+};
+static const int num_request_fields = sizeof(request_fields) / sizeof(request_fields[0]);
+
+static int checks = 0, failures = 0;
+
+static void fail(const char* request, const char* key, const std::string& expected, const std::string& got)
+{
+   failures++;
+   printf("FAIL %s: \"%s\" expected %s, got %s\n", request, key, expected.c_str(), got.c_str());
+}
+
+/* Reads every field of the request with both parsers, as my_handler did */
+static void check_request(const char* name, const std::string& payload)
+{
+   RSJresource rsj(payload);
+   if (rsj["body"].exists()) {
+      std::string escaped_body = rsj["body"].as<std::string>("");
+      rsj = RSJresource(util::unescape_json(escaped_body));
+   }
+   JsonDoc doc, nested;
+   std::string nested_body;
+   doc.parse(payload);
+   JsonValue body = doc.root();
+   if (body["body"].exists()) {
+      nested_body = body["body"].as<std::string>("");
+      nested.parse(nested_body);
+      body = nested.root();
+   }
+
+   for (int f = 0; f < num_request_fields; f++) {
+      const char* key = request_fields[f].key;
+      JsonValue value = body[key];
+      bool null = value.type() == JSON_PRIMITIVE && value.raw_length() == 4 && !memcmp(value.raw(), "null", 4);
+      checks++;
+      switch (request_fields[f].kind) {
+      case F_INT: {
+         int expected = null ? INT_DEFAULT : rsj[key].as<int>(INT_DEFAULT);
+         int got = value.as<int>(INT_DEFAULT);
+         if (got != expected)
+            fail(name, key, std::to_string(expected), std::to_string(got));
+         break;
+      }
+      case F_BOOL: {
+         bool expected = rsj[key].as<bool>(true);
+         bool got = value.as<bool>(true);
+         if (got != expected)
+            fail(name, key, expected ? "true" : "false", got ? "true" : "false");
+         break;
+      }
+      case F_DOUBLE: {
+         double expected = null ? DOUBLE_DEFAULT : rsj[key].as<double>(DOUBLE_DEFAULT);
+         double got = value.as<double>(DOUBLE_DEFAULT);
+         if (got != expected)
+            fail(name, key, std::to_string(expected), std::to_string(got));
+         break;
+      }
+      case F_STRING: {
+         std::string expected = rsj[key].as<std::string>(STRING_DEFAULT);
+         std::string got = value.as<std::string>(STRING_DEFAULT);
+         if (got != expected)
+            fail(name, key, "\"" + expected + "\"", "\"" + got + "\"");
+         break;
+      }
+      }
+   }
+}
+
+/* Request body as invoke.py sends it; with all_fields, every field the handler reads */
+static std::string make_body(bool all_fields)
+{
+   JsonWriter body;
+   body.begin_object();
+   body.field("id", 417);
+   body.field("stime", 1697000000);
+   body.field("phases", 3);
+   body.field("log", true);
+   body.field("maxbits", 10);
+   body.field("bitduration", 1);
+   body.field("samples", true);
+   body.field("encoding", "delta-varint");
+   body.field("s3bucket", "membus-experiments-us-west-1");
+   body.field("s3key", "10-17-12-30/9f0c2a4e-1b7d-4c55-a1e2-6f9d1c2b3a4d");
+   body.field("guid", "9f0c2a4e-1b7d-4c55-a1e2-6f9d1c2b3a4d");
+   body.field("channel", true);
+   body.field("rate", 1000);
+   body.field("threshold", 10500);
+   body.field("repeat_phases", false);
+   if (all_fields) {
+      body.field("log_budget", 65536);
+      body.field("bitduration_ms", 250);
+      body.field("samplerate", 0);
+      body.field("sprt", false);
+      body.field("sprt_alpha", 0.01);
+      body.field("sprt_beta", 1e-3);
+      body.field("sprt_p1", 0.75);
+      body.field("sprt_quantile", 0.9);
+      body.field("ks_decision", "cutoff");
+      body.field("ks_alpha", 2.5E-2);
+      body.field("ks_cutoff", 3.0);
+      body.field("pipeline", true);
+      body.field("preempt_filter", false);
+      body.field("perf", false);
+      body.field("trace", true);
+      body.field("trace_records", 4096);
+      body.field("sleep_margin_us", -200);
+      body.field("return_data", true);
+      body.field("threshold_ns", 350);
+      body.field("data", "1011001110001011");
+      body.field("datalen", 16);
+      body.field("mode", "sender");
+      body.field("monitor_secs", 60);
+      body.field("cpu_budget", 0.25);
+      body.field("window_ms", 100);
+      body.field("monitor_alpha", 0.001);
+   }
+   body.end_object();
+   return body.str();
+}
+
+/* The API Gateway proxy envelope around a body */
+static std::string make_envelope(const std::string& body)
+{
+   JsonWriter envelope;
+   envelope.begin_object();
+   envelope.field("resource", "/membus");
+   envelope.field("httpMethod", "POST");
+   envelope.key("headers").begin_object();
+   envelope.field("Content-Type", "application/json");
+   envelope.field("User-Agent", "Python-urllib/3.8");
+   envelope.end_object();
+   envelope.key("requestContext").begin_object();
+   envelope.field("requestId", "c6af9ac6-7b61-11e6-9a41-93e8deadbeef");
+   envelope.field("stage", "latest");
+   envelope.end_object();
+   envelope.field("body", body);
+   envelope.field("isBase64Encoded", false);
+   envelope.end_object();
+   return envelope.str();
+}
+
+int main()
+{
+   std::string full = make_body(true), some = make_body(false);
+
+   JsonWriter nulls;
+   nulls.begin_object();
+   for (int f = 0; f < num_request_fields; f++) {
+      nulls.key(request_fields[f].key);
+      nulls.null();
+   }
+   nulls.end_object();
+
+   /* Numbers and flags as strings, 0/1 flags; escapes only in the plain body, since
+    * RSJ's two rounds of unescaping garbled them inside the envelope (and it also lost
+    * an escaped quote at the end of a string) */
+   std::string quoted = "{\"id\": \"42\", \"phases\": \"-3\", \"log\": \"true\", \"samples\": 1, \"sprt\": 0, "
+      "\"pipeline\": \"True\", \"trace\": \"0\", \"ks_alpha\": \"0.05\", \"rate\": 12.0, \"mode\": \"\"}";
+   std::string escapes = "{\"s3key\": \"a\\\\b\\\"c\\\"d\", \"guid\": \"tab\\there\\nline\", \"data\": \"x/y\"}";
+
+   check_request("envelope, all fields", make_envelope(full));
+   check_request("envelope, invoke.py fields", make_envelope(some));
+   check_request("envelope, nulls", make_envelope(nulls.str()));
+   check_request("envelope, empty object", make_envelope("{}"));
+   check_request("envelope, empty body", make_envelope(""));
+   check_request("envelope, quoted values", make_envelope(quoted));
+   check_request("plain, all fields", full);
+   check_request("plain, invoke.py fields", some);
+   check_request("plain, nulls", nulls.str());
+   check_request("plain, quoted values", quoted);
+   check_request("plain, escapes", escapes);
+   check_request("no body", "{\"resource\": \"/membus\", \"httpMethod\": \"POST\"}");
+
+   printf("%d fields: %s\n", checks, failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,399 @@
+#include <cstdlib>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "jsonreader.h"
+
+/* Parser states: what the innermost open container (or the top level) expects next */
+enum {
+    EXPECT_VALUE,               /* Top level, after '[', after ':' or after ',' in an array */
+    EXPECT_KEY,                 /* After '{' or after ',' in an object */
+    EXPECT_COLON,               /* After a key */
+    EXPECT_COMMA,               /* After a value: ',' or the closing bracket */
+};
+
+/*********************** Parsing ***********************/
+
+bool JsonDoc::add_value(json_type_t type, size_t start, size_t len, bool escaped)
+{
+    if (state != EXPECT_VALUE)
+        return false;
+    if (!open.empty() && tokens[open.back()].type == JSON_ARRAY)
+        tokens[open.back()].size++;
+
+    json_token_t token;
+    token.type = type;
+    token.escaped = escaped;
+    token.start = (uint32_t) start;
+    token.length = (uint32_t) len;
+    token.next = (uint32_t) tokens.size() + 1;     /* Containers fix this up when closed */
+    token.size = 0;
+    tokens.push_back(token);
+    state = type == JSON_OBJECT ? EXPECT_KEY : type == JSON_ARRAY ? EXPECT_VALUE : EXPECT_COMMA;
+    return true;
+}
+
+bool JsonDoc::tokenize(const char* t, size_t n)
+{
+    text = t;
+    length = n;
+    error_offset = 0;
+    tokens.clear();
+    open.clear();
+    state = EXPECT_VALUE;
+    if (n >= UINT32_MAX)
+        return fail(0);
+    if (tokens.capacity() == 0)
+        tokens.reserve(64);
+
+    size_t i = 0;
+    while (i < n) {
+        char c = t[i];
+        switch (c) {
+        case ' ': case '\t': case '\n': case '\r':
+            i++;
+            break;
+
+        case '{': case '[':
+            if ((open.empty() && !tokens.empty()) || !add_value(c == '{' ? JSON_OBJECT : JSON_ARRAY, i, 0, false))
+                return fail(i);
+            open.push_back((uint32_t) tokens.size() - 1);
+            i++;
+            break;
+
+        case '}': case ']': {
+            if (open.empty())
+                return fail(i);
+            json_token_t& container = tokens[open.back()];
+            bool empty = container.size == 0;
+            if (container.type != (c == '}' ? JSON_OBJECT : JSON_ARRAY)
+                    || !(state == EXPECT_COMMA || (empty && state == (c == '}' ? EXPECT_KEY : EXPECT_VALUE))))
+                return fail(i);
+            container.length = (uint32_t) (i + 1 - container.start);
+            container.next = (uint32_t) tokens.size();
+            open.pop_back();
+            state = EXPECT_COMMA;
+            i++;
+            break;
+        }
+
+        case ':':
+            if (state != EXPECT_COLON)
+                return fail(i);
+            state = EXPECT_VALUE;
+            i++;
+            break;
+
+        case ',':
+            if (state != EXPECT_COMMA || open.empty())
+                return fail(i);
+            state = tokens[open.back()].type == JSON_OBJECT ? EXPECT_KEY : EXPECT_VALUE;
+            i++;
+            break;
+
+        case '"': {
+            size_t start = ++i;
+            bool escaped = false;
+            while (i < n && t[i] != '"') {
+                if (t[i] == '\\') {
+                    escaped = true;
+                    i++;
+                }
+                else if ((unsigned char) t[i] < 0x20)
+                    return fail(i);
+                i++;
+            }
+            if (i >= n)
+                return fail(start - 1);
+
+            if (state == EXPECT_KEY) {
+                /* Keys are tokens too, counted as the object's members */
+                state = EXPECT_VALUE;
+                if (!add_value(JSON_STRING, start, i - start, escaped))
+                    return fail(start - 1);
+                tokens[open.back()].size++;
+                state = EXPECT_COLON;
+            }
+            else if (!add_value(JSON_STRING, start, i - start, escaped))
+                return fail(start - 1);
+            i++;
+            break;
+        }
+
+        default: {
+            /* Number or literal: runs till the next delimiter */
+            size_t start = i;
+            while (i < n && !strchr(",]} \t\r\n:", t[i]))
+                i++;
+            size_t len = i - start;
+            bool literal = (len == 4 && (!memcmp(t + start, "true", 4) || !memcmp(t + start, "null", 4)))
+                || (len == 5 && !memcmp(t + start, "false", 5));
+            bool number = c == '-' || (c >= '0' && c <= '9');
+            for (size_t j = start; number && j < i; j++)
+                number = strchr("0123456789+-.eE", t[j]) != NULL;
+            if (!(literal || number) || !add_value(JSON_PRIMITIVE, start, len, false))
+                return fail(start);
+            break;
+        }
+        }
+    }
+
+    if (tokens.empty() || !open.empty())
+        return fail(n);
+    return true;
+}
+
+bool JsonDoc::parse_file(const char* path)
+{
+    unmap();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return fail(0);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return fail(0);
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return fail(0);
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    mapped = addr;
+    mapped_length = st.st_size;
+    return tokenize((const char*) addr, st.st_size);
+}
+
+void JsonDoc::unmap()
+{
+    if (mapped != NULL) {
+        munmap(mapped, mapped_length);
+        mapped = NULL;
+        mapped_length = 0;
+        tokens.clear();
+    }
+}
+
+/*********************** Access ***********************/
+
+const json_token_t& JsonValue::token() const
+{
+    return doc->tokens[index];
+}
+
+json_type_t JsonValue::type() const
+{
+    return doc ? (json_type_t) token().type : JSON_NONE;
+}
+
+size_t JsonValue::size() const
+{
+    return doc ? token().size : 0;
+}
+
+const char* JsonValue::raw() const
+{
+    return doc ? doc->text + token().start : "";
+}
+
+size_t JsonValue::raw_length() const
+{
+    return doc ? token().length : 0;
+}
+
+JsonValue JsonValue::get(const char* key, size_t len) const
+{
+    if (type() != JSON_OBJECT)
+        return JsonValue();
+    const std::vector<json_token_t>& tokens = doc->tokens;
+    uint32_t k = index + 1;
+    std::string unescaped;
+    for (uint32_t m = 0; m < token().size; m++) {
+        const json_token_t& kt = tokens[k];
+        const char* s = doc->text + kt.start;
+        if (kt.escaped) {
+            json_unescape(s, kt.length, unescaped);
+            if (unescaped.size() == len && !memcmp(unescaped.data(), key, len))
+                return JsonValue(doc, k + 1);
+        }
+        else if (kt.length == len && !memcmp(s, key, len))
+            return JsonValue(doc, k + 1);
+        k = tokens[k + 1].next;
+    }
+    return JsonValue();
+}
+
+JsonValue JsonValue::operator[](size_t i) const
+{
+    json_type_t t = type();
+    if ((t != JSON_OBJECT && t != JSON_ARRAY) || i >= token().size)
+        return JsonValue();
+    const std::vector<json_token_t>& tokens = doc->tokens;
+    uint32_t k = index + 1;
+    for (size_t m = 0; m < i; m++)
+        k = t == JSON_OBJECT ? tokens[k + 1].next : tokens[k].next;
+    return JsonValue(doc, t == JSON_OBJECT ? k + 1 : k);
+}
+
+std::string JsonValue::key_at(size_t i) const
+{
+    JsonValue value = (*this)[i];
+    if (!value.exists() || type() != JSON_OBJECT)
+        return "";
+    return JsonValue(doc, value.index - 1).as<std::string>();
+}
+
+/*********************** Conversions ***********************/
+
+/* Copies a short value (number, maybe quoted) so strtoll/strtod stop inside it; the text
+ * may be an mmap'd file with nothing after the last byte */
+static inline const char* scalar_text(const char* s, size_t len, char* buf, size_t size)
+{
+    if (len >= size)
+        len = size - 1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+template <>
+int64_t JsonValue::as<int64_t>(const int64_t& def) const
+{
+    json_type_t t = type();
+    if (t != JSON_PRIMITIVE && t != JSON_STRING)
+        return def;
+    char buf[32];
+    const char* s = scalar_text(raw(), raw_length(), buf, sizeof(buf));
+    if (t == JSON_PRIMITIVE && s[0] == 'n')
+        return def;
+    if (t == JSON_PRIMITIVE && (s[0] == 't' || s[0] == 'f'))
+        return s[0] == 't';
+    char* end;
+    long long v = strtoll(s, &end, 10);
+    if (*end == '.' || *end == 'e' || *end == 'E')
+        v = (long long) strtod(s, NULL);
+    return v;
+}
+
+template <>
+int JsonValue::as<int>(const int& def) const
+{
+    return exists() ? (int) as<int64_t>(def) : def;
+}
+
+template <>
+double JsonValue::as<double>(const double& def) const
+{
+    json_type_t t = type();
+    if (t != JSON_PRIMITIVE && t != JSON_STRING)
+        return def;
+    char buf[64];
+    const char* s = scalar_text(raw(), raw_length(), buf, sizeof(buf));
+    if (t == JSON_PRIMITIVE && s[0] == 'n')
+        return def;
+    if (t == JSON_PRIMITIVE && (s[0] == 't' || s[0] == 'f'))
+        return s[0] == 't';
+    return strtod(s, NULL);
+}
+
+template <>
+bool JsonValue::as<bool>(const bool& def) const
+{
+    json_type_t t = type();
+    if (t != JSON_PRIMITIVE && t != JSON_STRING)
+        return def;
+    const char* s = raw();
+    size_t len = raw_length();
+    if (len == 4 && (!memcmp(s, "true", 4) || !memcmp(s, "TRUE", 4) || !memcmp(s, "True", 4)))
+        return true;
+    return as<int64_t>(0) != 0;
+}
+
+template <>
+std::string JsonValue::as<std::string>(const std::string& def) const
+{
+    if (!exists())
+        return def;
+    std::string out;
+    if (token().escaped)
+        json_unescape(raw(), raw_length(), out);
+    else
+        out.assign(raw(), raw_length());
+    return out;
+}
+
+static inline void append_utf8(std::string& out, uint32_t cp)
+{
+    if (cp < 0x80)
+        out += (char) cp;
+    else if (cp < 0x800) {
+        out += (char) (0xc0 | (cp >> 6));
+        out += (char) (0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000) {
+        out += (char) (0xe0 | (cp >> 12));
+        out += (char) (0x80 | ((cp >> 6) & 0x3f));
+        out += (char) (0x80 | (cp & 0x3f));
+    }
+    else {
+        out += (char) (0xf0 | (cp >> 18));
+        out += (char) (0x80 | ((cp >> 12) & 0x3f));
+        out += (char) (0x80 | ((cp >> 6) & 0x3f));
+        out += (char) (0x80 | (cp & 0x3f));
+    }
+}
+
+static inline bool read_hex4(const char* s, size_t left, uint32_t* v)
+{
+    if (left < 4)
+        return false;
+    char buf[5] = { s[0], s[1], s[2], s[3], '\0' };
+    char* end;
+    *v = (uint32_t) strtoul(buf, &end, 16);
+    return end == buf + 4;
+}
+
+void json_unescape(const char* s, size_t length, std::string& out)
+{
+    out.clear();
+    out.reserve(length);
+    size_t i = 0;
+    while (i < length) {
+        /* Copy the run up to the next escape in one go */
+        const char* bs = (const char*) memchr(s + i, '\\', length - i);
+        size_t run = (bs ? bs - s : length) - i;
+        out.append(s + i, run);
+        i += run;
+        if (i + 1 >= length)
+            break;
+
+        char e = s[i + 1];
+        i += 2;
+        switch (e) {
+        case 'n':   out += '\n';    break;
+        case 'r':   out += '\r';    break;
+        case 't':   out += '\t';    break;
+        case 'b':   out += '\b';    break;
+        case 'f':   out += '\f';    break;
+        case 'u': {
+            uint32_t cp, low;
+            if (!read_hex4(s + i, length - i, &cp)) {
+                out += 'u';
+                break;
+            }
+            i += 4;
+            /* Surrogate pair */
+            if (cp >= 0xd800 && cp < 0xdc00 && i + 1 < length && s[i] == '\\' && s[i + 1] == 'u'
+                    && read_hex4(s + i + 2, length - i - 2, &low) && low >= 0xdc00 && low < 0xe000) {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                i += 6;
+            }
+            append_utf8(out, cp);
+            break;
+        }
+        default:    out += e;       break;      /* \" \\ \/ and anything unknown */
+        }
+    }
+}
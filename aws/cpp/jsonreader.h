@@ -0,0 +1,117 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+typedef enum {
+    JSON_NONE = 0,              /* Missing value (lookup of an absent key or index) */
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE,             /* Number, true, false or null */
+} json_type_t;
+
+/* One value of the document, in document order. A container is followed by its
+ * children (for objects: key string, value, key string, value, ...) and next skips past
+ * all of them. Offsets point into the caller's text; strings exclude their quotes. */
+typedef struct {
+    uint8_t type;
+    uint8_t escaped;            /* String contains backslash escapes */
+    uint32_t start;
+    uint32_t length;
+    uint32_t next;
+    uint32_t size;              /* Members of an object, elements of an array */
+} json_token_t;
+
+class JsonDoc;
+
+/* Lazy handle on a value in a JsonDoc: lookups walk the token array, and nothing is
+ * copied or converted until as<T>() is called. Same conventions as RSJresource: a
+ * missing value returns the default from as<T>(def), numbers may also be given as
+ * strings ("5"), and bools as true/false or any number. */
+class JsonValue
+{
+public:
+    JsonValue() : doc(NULL), index(0) { }
+    JsonValue(const JsonDoc* doc, uint32_t index) : doc(doc), index(index) { }
+
+    bool exists() const                         { return doc != NULL; }
+    json_type_t type() const;
+    size_t size() const;
+
+    JsonValue operator[](const char* key) const { return get(key, strlen(key)); }
+    JsonValue operator[](const std::string& key) const { return get(key.data(), key.size()); }
+    JsonValue operator[](size_t i) const;       /* Array element, or value of the i'th member */
+    JsonValue operator[](int i) const           { return (*this)[(size_t) i]; }
+    std::string key_at(size_t i) const;         /* Key of the i'th member of an object */
+
+    /* Text of the value as it appears in the document (strings without quotes, escapes
+     * left in), without copying */
+    const char* raw() const;
+    size_t raw_length() const;
+
+    /* Converted value, or def if missing, of the wrong type or (numbers) null */
+    template <typename T>
+    T as(const T& def = T()) const;
+
+private:
+    JsonValue get(const char* key, size_t length) const;
+    const json_token_t& token() const;
+
+    const JsonDoc* doc;
+    uint32_t index;
+};
+
+/* Single-pass tokenizer over text owned by the caller (or a file it maps). The token
+ * array is the only allocation and is kept between parses, so parsing the request of
+ * every invocation into the same JsonDoc allocates nothing once it has grown. */
+class JsonDoc
+{
+public:
+    JsonDoc() : text(NULL), length(0), mapped(NULL), mapped_length(0), error_offset(0), state(0) { }
+    ~JsonDoc()                                  { unmap(); }
+
+    /* The text must stay alive (and unmodified) while the document is used */
+    bool parse(const char* text, size_t length)   { unmap(); return tokenize(text, length); }
+    bool parse(const std::string& s)            { return parse(s.data(), s.size()); }
+    bool parse_file(const char* path);          /* mmaps the file for the document's lifetime */
+
+    JsonValue root() const                      { return tokens.empty() ? JsonValue() : JsonValue(this, 0); }
+    JsonValue operator[](const char* key) const { return root()[key]; }
+    JsonValue operator[](const std::string& key) const { return root()[key]; }
+
+    size_t get_error_offset() const             { return error_offset; }  /* Where parsing stopped, if it failed */
+    size_t get_token_count() const              { return tokens.size(); }
+
+private:
+    friend class JsonValue;
+    JsonDoc(const JsonDoc&);
+    JsonDoc& operator=(const JsonDoc&);
+    bool tokenize(const char* text, size_t length);
+    bool add_value(json_type_t type, size_t start, size_t length, bool escaped);
+    void unmap();
+    bool fail(size_t at)                        { error_offset = at; tokens.clear(); return false; }
+
+    const char* text;
+    size_t length;
+    void* mapped;
+    size_t mapped_length;
+    size_t error_offset;
+    std::vector<json_token_t> tokens;
+    std::vector<uint32_t> open;                 /* Containers not closed yet */
+    int state;                                  /* What the innermost container expects next */
+};
+
+/* Unescapes a JSON string's contents (\n, \", \uXXXX incl. surrogate pairs, ...) */
+void json_unescape(const char* s, size_t length, std::string& out);
+
+template <> int JsonValue::as<int>(const int& def) const;
+template <> int64_t JsonValue::as<int64_t>(const int64_t& def) const;
+template <> double JsonValue::as<double>(const double& def) const;
+template <> bool JsonValue::as<bool>(const bool& def) const;
+template <> std::string JsonValue::as<std::string>(const std::string& def) const;
+
+#endif /* JSONREADER_H */
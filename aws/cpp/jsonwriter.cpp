@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <cmath>
+
+#include "jsonwriter.h"
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+JsonWriter::JsonWriter(size_t reserve) : after_key(false)
+{
+    out.reserve(reserve);
+}
+
+void JsonWriter::separate()
+{
+    if (after_key) {
+        after_key = false;
+        return;
+    }
+    if (!has_items.empty()) {
+        if (has_items.back())   out += ',';
+        has_items.back() = true;
+    }
+}
+
+void JsonWriter::begin_object()
+{
+    separate();
+    out += '{';
+    has_items.push_back(false);
+}
+
+void JsonWriter::end_object()
+{
+    out += '}';
+    has_items.pop_back();
+}
+
+JsonWriter& JsonWriter::key(const char* k, size_t length)
+{
+    separate();
+    out += '"';
+    append_escaped(k, length);
+    out += "\":";
+    after_key = true;
+    return *this;
+}
+
+/* Digits are produced two at a time from the end of a small buffer */
+static inline size_t format_unsigned(uint64_t v, char* end)
+{
+    char* p = end;
+    while (v >= 100) {
+        const char* pair = digit_pairs + (v % 100) * 2;
+        v /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (v >= 10) {
+        const char* pair = digit_pairs + v * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    else
+        *--p = '0' + v;
+    return end - p;
+}
+
+void JsonWriter::append_int(int64_t v)
+{
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    uint64_t magnitude = v < 0 ? 0 - (uint64_t) v : (uint64_t) v;
+    size_t n = format_unsigned(magnitude, end);
+    if (v < 0)
+        buf[sizeof(buf) - ++n] = '-';
+    out.append(end - n, n);
+}
+
+void JsonWriter::value(uint64_t v)
+{
+    separate();
+    char buf[24];
+    size_t n = format_unsigned(v, buf + sizeof(buf));
+    out.append(buf + sizeof(buf) - n, n);
+}
+
+void JsonWriter::value(double v)
+{
+    if (!std::isfinite(v)) {
+        null();
+        return;
+    }
+    separate();
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.15g", v);
+    out.append(buf, n);
+}
+
+void JsonWriter::value(const char* s, size_t length)
+{
+    begin_string();
+    append_escaped(s, length);
+    end_string();
+}
+
+/* Copies runs of plain characters at once and escapes the rest */
+void JsonWriter::append_escaped(const char* s, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        out.append(s + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"':   out += "\\\"";  break;
+        case '\\':  out += "\\\\";  break;
+        case '\n':  out += "\\n";   break;
+        case '\r':  out += "\\r";   break;
+        case '\t':  out += "\\t";   break;
+        case '\b':  out += "\\b";   break;
+        case '\f':  out += "\\f";   break;
+        default: {
+            char u[7] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15], 0 };
+            out.append(u, 6);
+            break;
+        }
+        }
+    }
+    out.append(s + run, length - run);
+}
@@ -0,0 +1,75 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define DEFAULT_JSON_RESERVE    (64 << 10)
+
+/* Append-only JSON writer for the handler's response. Everything is written in one pass
+ * into a single reserved buffer: integers are formatted by hand (two digits at a time),
+ * strings are escaped as they are appended, and a whole JSON document can be appended as
+ * an escaped string value (the response body inside the Lambda proxy envelope) without
+ * an intermediate copy. Comma placement is tracked per nesting level; keys and values
+ * must alternate inside objects, as usual.
+ */
+class JsonWriter
+{
+public:
+    explicit JsonWriter(size_t reserve = DEFAULT_JSON_RESERVE);
+
+    void begin_object();
+    void end_object();
+
+    /* Key of the next value in the current object */
+    JsonWriter& key(const char* k)              { return key(k, strlen(k)); }
+    JsonWriter& key(const std::string& k)       { return key(k.data(), k.size()); }
+
+    void value(int64_t v)                       { separate(); append_int(v); }
+    void value(int v)                           { value((int64_t) v); }
+    void value(uint64_t v);
+    void value(unsigned int v)                  { value((uint64_t) v); }
+    void value(double v);                       /* null if not finite */
+    void value(bool v)                          { separate(); out += v ? "true" : "false"; }
+    void value(const char* s)                   { value(s, strlen(s)); }
+    void value(const std::string& s)            { value(s.data(), s.size()); }
+    void value(const char* s, size_t length);
+    void null()                                 { separate(); out += "null"; }
+
+    template<typename T>
+    void field(const char* k, T v)              { key(k); value(v); }
+
+    /* A string value of integers, each followed by a comma ("1,2,3,"), as the samples have
+     * always been sent */
+    template<typename T>
+    void value_list(const T* values, size_t n) {
+        begin_string();
+        for (size_t i = 0; i < n; i++) {
+            append_int((int64_t) values[i]);
+            out += ',';
+        }
+        end_string();
+    }
+
+    /* A string value built in pieces */
+    void begin_string()                         { separate(); out += '"'; }
+    void append_int(int64_t v);
+    void append_escaped(const char* s, size_t length);
+    void append_escaped(const std::string& s)   { append_escaped(s.data(), s.size()); }
+    void end_string()                           { out += '"'; }
+
+    const std::string& str() const              { return out; }
+    size_t size() const                         { return out.size(); }
+
+private:
+    JsonWriter& key(const char* k, size_t length);
+    void separate();
+
+    std::string out;
+    std::vector<bool> has_items;                /* Per open object: a comma goes before the next item */
+    bool after_key;
+};
+
+#endif /* JSONWRITER_H */
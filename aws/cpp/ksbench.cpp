@@ -0,0 +1,82 @@
+/* Benchmark for KS p-values: cost of the exact (lattice) and asymptotic null
+ * distributions, and of a whole per-bit decision (OnlineKS statistic + p-value)
+ * at realistic sample sizes, against the guard time read_bit has at the end of
+ * each bit. Also shows how far the asymptotic p-value is from the exact one.
+ *
+ * Usage: ./ksbench [repetitions]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "kstest.h"
+#include "ksdist.h"
+#include "latsort.h"
+
+#define DEFAULT_REPETITIONS     20
+#define BIT_BUDGET_MUS          2000        /* BIT_GUARD_MUS in main.cpp */
+
+using Clock = std::chrono::high_resolution_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+static volatile double sink;
+
+int main(int argc, char** argv)
+{
+   int reps = argc > 1 ? atoi(argv[1]) : DEFAULT_REPETITIONS;
+   if (reps <= 0) {
+      printf("ERROR! Provide a positive number of repetitions\n");
+      return 1;
+   }
+
+   printf("Null distribution (D = 0.1), %d reps:\n", reps);
+   int sizes[][2] = {{30, 30}, {100, 100}, {200, 200}, {1000, 1000}, {5000, 1000}};
+   for (int s = 0; s < 5; s++) {
+      int m = sizes[s][0], n = sizes[s][1];
+      Clock::time_point t0 = Clock::now();
+      double exact = 0;
+      for (int r = 0; r < reps; r++)    exact = ks_pvalue_exact(m, n, 0.1);
+      Clock::time_point t1 = Clock::now();
+      double asym = 0;
+      for (int r = 0; r < reps * 1000; r++)    asym = ks_pvalue_asymptotic(m, n, 0.1 + r * 1e-12);
+      Clock::time_point t2 = Clock::now();
+      printf("  m=%5d n=%5d  exact %.4g in %9.1lf us, asymptotic %.4g in %6.3lf us, ks_pvalue uses %s\n", m, n,
+         exact, duration_cast<nanoseconds>(t1 - t0).count() / 1000.0 / reps,
+         asym, duration_cast<nanoseconds>(t2 - t1).count() / 1000.0 / (reps * 1000),
+         (long) m * n <= KS_EXACT_MAX_CELLS ? "exact" : "asymptotic");
+   }
+
+   /* A bit's worth of work at the end of read_bit: baseline of 5000, window of 1000
+    * (default rate) and 10000 (max rate), latencies in a few thousand cycles */
+   printf("Per-bit decision (OnlineKS statistic + D + p-value), budget %d us:\n", BIT_BUDGET_MUS);
+   srand(1);
+   std::vector<int64_t> base(5000);
+   for (size_t i = 0; i < base.size(); i++)    base[i] = 3500 + rand() % 2000;
+   sort_latencies(base.data(), base.size());
+   OnlineKS ks;
+   ks.set_baseline(base.data(), base.size());
+   int windows[] = {1000, 10000};
+   for (int w = 0; w < 2; w++) {
+      std::vector<int64_t> times;
+      double pvalue = 0;
+      for (int r = 0; r < reps; r++) {
+         ks.reset();
+         for (int i = 0; i < windows[w]; i++)    ks.add(3700 + rand() % 2000);
+         Clock::time_point t0 = Clock::now();
+         sink = ks.statistic();
+         pvalue = ks_pvalue(ks.baseline_size(), ks.size(), ks.max_distance());
+         Clock::time_point t1 = Clock::now();
+         times.push_back(duration_cast<nanoseconds>(t1 - t0).count());
+      }
+      std::sort(times.begin(), times.end());
+      printf("  window %5d: median %.1lf us, max %.1lf us (D %.4lf, p-value %.3g)\n", windows[w],
+         times[times.size() / 2] / 1000.0, times.back() / 1000.0, ks.max_distance(), pvalue);
+   }
+   return 0;
+}
@@ -0,0 +1,121 @@
+/* Checks that the faster KS statistics agree with kstest_mean() on the raw samples:
+ *   histograms   kstest_mean() over LatencyHistograms with single-value bins (shift 0)
+ *                and nothing clamped must give exactly the same value
+ *   online       OnlineKS against the sorted baseline must give exactly the same value,
+ *                including for values outside its dense range
+ * on random sample pairs with plenty of ties, from a few dozen samples up to sizes where
+ * m*n no longer fits in an int. Also checks that histograms of different layouts are
+ * refused. Prints each mismatch and exits non-zero if there was any (run by ctest).
+ *
+ * Usage: ./kscheck [-t trials] [-s seed]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+
+#include "kstest.h"
+
+#define DEFAULT_TRIALS          200
+#define HIST_RANGE              10000       /* Histogram checks draw values in [0, HIST_RANGE) */
+#define LARGE_SIZE              60000       /* 60000^2 > 2^31 */
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, int m, int n, double expected, double got)
+{
+   if (ok)
+      return;
+   failures++;
+   printf("FAIL %s (m %d, n %d): expected %.17g, got %.17g\n", what, m, n, expected, got);
+}
+
+/* Contended-looking samples: the second one is shifted and wider */
+static void draw(std::mt19937_64& rng, std::vector<int64_t>& sample, int size, int64_t lo, int64_t hi)
+{
+   std::uniform_int_distribution<int64_t> value(lo, hi - 1);
+   sample.resize(size);
+   for (int i = 0; i < size; i++)
+      sample[i] = value(rng);
+}
+
+static void check_pair(std::vector<int64_t> s1, std::vector<int64_t> s2, bool in_hist_range)
+{
+   int m = s1.size(), n = s2.size();
+   double expected = kstest_mean(s1.data(), m, false, s2.data(), n, false);
+   check(std::isfinite(expected) && expected >= 0, "sample statistic finite", m, n, expected, expected);
+
+   if (in_hist_range) {
+      LatencyHistogram h1(0, HIST_RANGE), h2(0, HIST_RANGE);
+      h1.add(s1.data(), m);
+      h2.add(s2.data(), n);
+      double got = kstest_mean(h1, h2);
+      check(got == expected, "histograms", m, n, expected, got);
+   }
+
+   /* s1 is sorted now; it is the baseline */
+   OnlineKS ks;
+   ks.set_baseline(s1.data(), m);
+   for (int i = 0; i < n; i++)
+      ks.add(s2[i]);
+   double got = ks.statistic();
+   check(got == expected, "online", m, n, expected, got);
+}
+
+int main(int argc, char** argv)
+{
+   int trials = DEFAULT_TRIALS;
+   uint64_t seed = 1;
+   int opt;
+   while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+      switch (opt) {
+      case 't':   trials = atoi(optarg);                  break;
+      case 's':   seed = strtoull(optarg, NULL, 10);      break;
+      default:
+         printf("Usage: %s [-t trials] [-s seed]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (trials <= 0) {
+      printf("ERROR! Provide a positive number of trials\n");
+      return 1;
+   }
+
+   std::mt19937_64 rng(seed);
+   std::uniform_int_distribution<int> size(30, 5000);
+   std::vector<int64_t> s1, s2;
+   for (int t = 0; t < trials; t++) {
+      /* Narrow ranges give many ties, wide ones few */
+      int64_t range = t % 2 ? 200 : HIST_RANGE;
+      draw(rng, s1, size(rng), 0, range);
+      draw(rng, s2, size(rng), range / 4, range);
+      check_pair(s1, s2, true);
+
+      /* OnlineKS overflow list: negative deltas and descheduled samples */
+      draw(rng, s1, size(rng), -1000, 1000);
+      draw(rng, s2, size(rng), -500, OnlineKS::DENSE_LIMIT + 5000);
+      check_pair(s1, s2, false);
+   }
+
+   /* m*n past 2^31 */
+   draw(rng, s1, LARGE_SIZE, 0, HIST_RANGE);
+   draw(rng, s2, LARGE_SIZE, 0, HIST_RANGE / 2);
+   check_pair(s1, s2, true);
+   draw(rng, s2, LARGE_SIZE, 0, HIST_RANGE);
+   check_pair(s1, s2, true);
+
+   /* Different layouts are refused */
+   LatencyHistogram h1(0, HIST_RANGE), h2(0, HIST_RANGE, 1);
+   h1.add(5);
+   h2.add(5);
+   double got = kstest_mean(h1, h2);
+   check(got == -1, "layout mismatch", 1, 1, -1, got);
+
+   printf("%d trials: %s\n", trials, failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef KSDIST_H
+#define KSDIST_H
+
+/* Null distribution of the two-sample Kolmogorov-Smirnov statistic D (largest distance
+ * between the eCDFs of samples of size m and n), for turning D into a p-value.
+ * Both assume continuous data; latencies have ties, which only makes the test
+ * conservative (ties can only shrink D).
+ */
+
+/* Above this many lattice cells (m*n), ks_pvalue() switches to the asymptotic series */
+#define KS_EXACT_MAX_CELLS      40000
+
+/* P(D >= d) counting the lattice paths that stay inside the band (Hodges 1958, as in
+ * R's psmirnov). O(m*n) time, O(min(m,n)) space. */
+double ks_pvalue_exact(int m, int n, double d);
+
+/* P(D >= d) from the limiting Kolmogorov distribution with Stephens' small-sample
+ * correction. Constant time; accurate to a few percent (relative) once m and n are
+ * in the tens. */
+double ks_pvalue_asymptotic(int m, int n, double d);
+
+/* Exact for small samples, asymptotic otherwise */
+double ks_pvalue(int m, int n, double d);
+
+/* Kolmogorov survival function Q(x) = P(K > x) = 2 * sum_k (-1)^(k-1) exp(-2 k^2 x^2) */
+double kolmogorov_q(double x);
+
+#endif /* KSDIST_H */
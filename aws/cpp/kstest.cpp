@@ -10,6 +10,9 @@
 #include <fstream>
 #include <regex>
 
+#include "kstest.h"
+#include "latsort.h"
+
 using namespace std;
 using Clock = std::chrono::high_resolution_clock;
 using microseconds = std::chrono::microseconds;
@@ -19,10 +22,6 @@ using std::chrono::duration;
 using std::chrono::duration_cast;
 
 
-/* Defined in timsort.cpp (Bad practice using extern!) */
-extern void timSort(int64_t arr[], int n);
-
-
 /* Return Kolmogorov-Smirinov statistic between two samples.
  * Instead of maximum difference between eCDFs, this variant returns mean of the 
  * difference between eCDFs taken at every element in both samples.
@@ -30,13 +29,13 @@ extern void timSort(int64_t arr[], int n);
 double kstest_mean(int64_t* sample1, int size1, bool is_sorted1, 
     int64_t* sample2, int size2, bool is_sorted2) 
 {
-    /* Some big number as numerator to keep computations in integer space (limits sample size to ~ O(1000)) */
+    /* Some big number as numerator to keep computations in integer space */
     const int64_t SOME_BIG_NUMBER = 1e9;
     const int64_t NO_VAL = -1e9;
 
     /* Sort if not sorted */
-    if (!is_sorted1)    timSort(sample1, size1);
-    if (!is_sorted2)    timSort(sample2, size2);
+    if (!is_sorted1)    sort_latencies(sample1, size1);
+    if (!is_sorted2)    sort_latencies(sample2, size2);
         
     
     int m = size1;
@@ -88,12 +87,179 @@ double kstest_mean(int64_t* sample1, int size1, bool is_sorted1,
 
     /* Estimate max and mean KS statistics */
     double ks_max = max_depth * 1.0 / SOME_BIG_NUMBER;
-    double ks_shallow_mean = (shallow_sum * sqrt(m*n) * 1.0) / (SOME_BIG_NUMBER * (m+n) * sqrt(m+n));
+    double ks_shallow_mean = (shallow_sum * sqrt(1.0 * m * n)) / (SOME_BIG_NUMBER * 1.0 * (m + n) * sqrt(m + n));
 
     /* Using mean statistic for now */
     return ks_shallow_mean;
 }
 
+OnlineKS::OnlineKS() : counts(DENSE_LIMIT, 0), blocks(DENSE_LIMIT >> (BLOCK_BITS + 6), 0), base_size(0), size_(0), max_dist(0) {}
+
+void OnlineKS::set_baseline(const int64_t* sorted, int size)
+{
+    values.clear();
+    base_counts.clear();
+    for (int i = 0; i < size; i++) {
+        if (i > 0 && sorted[i] == sorted[i-1])    base_counts.back()++;
+        else {
+            values.push_back(sorted[i]);
+            base_counts.push_back(1);
+        }
+    }
+    base_size = size;
+    reset();
+}
+
+void OnlineKS::reset()
+{
+    /* Only clear the blocks that were touched */
+    for (int w = 0; w < (int) blocks.size(); w++) {
+        for (uint64_t bits = blocks[w]; bits; bits &= bits - 1) {
+            int block = (w << 6) + __builtin_ctzll(bits);
+            memset(&counts[block << BLOCK_BITS], 0, sizeof(counts[0]) << BLOCK_BITS);
+        }
+        blocks[w] = 0;
+    }
+    overflow.clear();
+    size_ = 0;
+}
+
+/* Same merge as kstest_mean(), with the window's distinct values coming out of the
+ * count blocks (and the sorted overflow list) in ascending order. Keeps the integer
+ * arithmetic and the final expression of kstest_mean() so both produce the same values. */
+double OnlineKS::statistic()
+{
+    const int64_t SOME_BIG_NUMBER = 1e9;
+    int m = base_size;
+    int n = size_;
+    max_dist = 0;
+    if (m == 0 || n == 0)   return 0;
+
+    int64_t s1_incr = SOME_BIG_NUMBER / m;
+    int64_t s2_incr = SOME_BIG_NUMBER / n;
+    int64_t s1_accum = 0, s2_accum = 0, shallow_sum = 0;
+    int i = 0, b = values.size();
+
+    /* Exact sup distance: |c1/m - c2/n| is largest where |c1*n - c2*m| is */
+    int64_t c1 = 0, c2 = 0, max_cross = 0;
+    auto track_max = [&]() {
+        int64_t cross = std::abs(c1 * n - c2 * m);
+        if (cross > max_cross)  max_cross = cross;
+    };
+
+    /* Takes the next distinct window value and all baseline values up to it */
+    auto step = [&](int64_t val, int64_t count) {
+        while (i < b && values[i] < val) {
+            c1 += base_counts[i];
+            s1_accum += base_counts[i++] * s1_incr;
+            shallow_sum += std::abs(s1_accum - s2_accum);
+            track_max();
+        }
+        bool tie = i < b && values[i] == val;
+        if (tie) {
+            c1 += base_counts[i];
+            s1_accum += base_counts[i++] * s1_incr;
+        }
+        c2 += count;
+        s2_accum += count * s2_incr;
+        shallow_sum += tie ? std::abs(2 * (s1_accum - s2_accum)) : std::abs(s1_accum - s2_accum);
+        track_max();
+    };
+
+    /* Overflow values are rare (negative deltas, descheduling); sort them in place */
+    std::sort(overflow.begin(), overflow.end());
+    int o = 0, osize = overflow.size();
+    auto overflow_until = [&](int64_t limit) {
+        while (o < osize && overflow[o] < limit) {
+            int start = o;
+            while (o < osize && overflow[o] == overflow[start])    o++;
+            step(overflow[start], o - start);
+        }
+    };
+
+    overflow_until(0);
+    for (int w = 0; w < (int) blocks.size(); w++) {
+        for (uint64_t bits = blocks[w]; bits; bits &= bits - 1) {
+            int64_t first = (int64_t) ((w << 6) + __builtin_ctzll(bits)) << BLOCK_BITS;
+            for (int64_t v = first; v < first + (1 << BLOCK_BITS); v++)
+                if (counts[v])  step(v, counts[v]);
+        }
+    }
+    overflow_until(INT64_MAX);
+
+    /* Rest of the baseline */
+    while (i < b) {
+        c1 += base_counts[i];
+        s1_accum += base_counts[i++] * s1_incr;
+        shallow_sum += std::abs(s1_accum - s2_accum);
+        track_max();
+    }
+    max_dist = max_cross * 1.0 / ((int64_t) m * n);
+
+    return (shallow_sum * sqrt(1.0 * m * n)) / (SOME_BIG_NUMBER * 1.0 * (m + n) * sqrt(m + n));
+}
+
+void LatencyHistogram::configure(int64_t origin, int bins, int shift)
+{
+    this->origin = origin;
+    this->bins = bins;
+    this->shift = shift;
+    counts.assign(bins, 0);
+    total = clamped = 0;
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill(counts.begin(), counts.end(), 0);
+    total = clamped = 0;
+}
+
+/* With A and B the running counts up to bin k, kstest_mean() adds |A*s1_incr - B*s2_incr| 
+ * once for a bin only one sample has and twice for a bin both have (a tie), and nothing for
+ * empty bins. Prefix sums are taken a chunk at a time so the weighted sum over each chunk
+ * is a straight loop the compiler can vectorize. */
+double kstest_mean(const LatencyHistogram& hist1, const LatencyHistogram& hist2)
+{
+    const int64_t SOME_BIG_NUMBER = 1e9;
+    const int CHUNK = 256;
+
+    if (!hist1.same_layout(hist2))
+        return -1;
+
+    int m = hist1.get_total();
+    int n = hist2.get_total();
+    if (m == 0 || n == 0)   return 0;
+
+    int64_t s1_incr = SOME_BIG_NUMBER / m;
+    int64_t s2_incr = SOME_BIG_NUMBER / n;
+    const uint32_t* a = hist1.data();
+    const uint32_t* b = hist2.data();
+    int bins = hist1.get_bins();
+
+    int64_t accum1 = 0, accum2 = 0, shallow_sum = 0;
+    int64_t depth[CHUNK];
+    for (int start = 0; start < bins; start += CHUNK) {
+        int len = std::min(CHUNK, bins - start);
+        for (int k = 0; k < len; k++) {
+            accum1 += a[start + k];
+            accum2 += b[start + k];
+            depth[k] = accum1 * s1_incr - accum2 * s2_incr;
+        }
+        for (int k = 0; k < len; k++) {
+            int64_t d = depth[k] < 0 ? -depth[k] : depth[k];
+            shallow_sum += (a[start + k] ? d : 0) + (b[start + k] ? d : 0);
+        }
+    }
+
+    /* Same expression as kstest_mean() so both round the same way */
+    return (shallow_sum * sqrt(1.0 * m * n)) / (SOME_BIG_NUMBER * 1.0 * (m + n) * sqrt(m + n));
+}
+
+double ks_mean_cutoff(double reference_cutoff, int reference_rate, int rate)
+{
+    return reference_cutoff * sqrt(rate * 1.0 / reference_rate);
+}
+
 /* Utility function to print an array */
 void print_array(int64_t arr[], int n) 
 { 
@@ -178,7 +344,7 @@ int kstest_main()
             if (iss >> number)
                 sample1[size1++] = number;
         }
-        timSort(sample1, size1);
+        sort_latencies(sample1, size1);
 
         size2 = 0;
         ks0 = -1;
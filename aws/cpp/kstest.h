@@ -0,0 +1,126 @@
+#ifndef KSTEST_H
+#define KSTEST_H
+
+#include <cstdint>
+#include <vector>
+
+/* Mean-variant of the two-sample Kolmogorov-Smirinov statistic (see kstest.cpp) */
+double kstest_mean(int64_t* sample1, int size1, bool is_sorted1,
+    int64_t* sample2, int size2, bool is_sorted2);
+
+/* The mean statistic is sqrt(mn/(m+n)) times the mean eCDF gap, so for the same gap it
+ * grows with the square root of the samples per bit. Scales a cutoff tuned at one
+ * sampling rate to another so it still asks for the same gap. */
+double ks_mean_cutoff(double reference_cutoff, int reference_rate, int rate);
+
+/* Online version of kstest_mean() against a fixed (sorted) baseline sample.
+ * Samples of the current window are counted as they arrive (latencies are small
+ * non-negative integers, so a dense count array works; anything outside its range
+ * goes to a small overflow list). Reading the statistic out is a merge of the
+ * distinct baseline values with the touched count blocks, so it is ready right
+ * when the sampling window closes and gives the same value as kstest_mean().
+ */
+class OnlineKS
+{
+public:
+    static const int DENSE_LIMIT = 1 << 16;       /* Values in [0, DENSE_LIMIT) are counted in place */
+    static const int BLOCK_BITS = 6;              /* 64 values per block                             */
+
+    OnlineKS();
+
+    /* Use a sorted sample as the baseline. Allocates; call outside the sampling loop. */
+    void set_baseline(const int64_t* sorted, int size);
+
+    /* Make room for this many overflow samples per window so add() never allocates */
+    void reserve(int max_window_size)       { overflow.reserve(max_window_size); }
+
+    /* Forget samples of the current window (baseline is kept) */
+    void reset();
+
+    /* Add a sample to the current window */
+    inline void add(int64_t value) {
+        if (value >= 0 && value < DENSE_LIMIT) {
+            counts[value]++;
+            blocks[value >> (BLOCK_BITS + 6)] |= 1ULL << ((value >> BLOCK_BITS) & 63);
+        }
+        else
+            overflow.push_back(value);
+        size_++;
+    }
+
+    /* Statistic between the baseline and samples added since the last reset() */
+    double statistic();
+
+    /* Classic two-sample KS statistic (largest eCDF distance) from the last statistic() call */
+    double max_distance() const     { return max_dist; }
+
+    int size() const                { return size_; }
+    int baseline_size() const       { return base_size; }
+
+private:
+    std::vector<int64_t> values;        /* Distinct baseline values (ascending)      */
+    std::vector<int32_t> base_counts;   /* Baseline occurences of each distinct value */
+    std::vector<uint32_t> counts;       /* Window counts indexed by value              */
+    std::vector<uint64_t> blocks;       /* Bitmap of count blocks touched this window  */
+    std::vector<int64_t> overflow;      /* Window values outside [0, DENSE_LIMIT)      */
+    int base_size;
+    int size_;
+    double max_dist;
+};
+
+/* Fixed-width histogram of latencies: bin k counts values in
+ * [origin + k*2^shift, origin + (k+1)*2^shift). Values outside the covered range are
+ * clamped into the first/last bin (and counted as clamped). With shift 0 every bin is
+ * a single value, so a histogram carries the same information as the sorted sample
+ * for values in range, in bins*4 bytes regardless of how many samples went in.
+ */
+class LatencyHistogram
+{
+public:
+    static const int DEFAULT_BINS = 4096;
+
+    LatencyHistogram(int64_t origin = 0, int bins = DEFAULT_BINS, int shift = 0) { configure(origin, bins, shift); }
+
+    /* Change the covered range (clears the histogram) */
+    void configure(int64_t origin, int bins, int shift);
+    void clear();
+
+    inline void add(int64_t value) {
+        int64_t k = (value - origin) >> shift;
+        if (k < 0)              { k = 0; clamped++; }
+        else if (k >= bins)     { k = bins - 1; clamped++; }
+        counts[k]++;
+        total++;
+    }
+
+    void add(const int64_t* values, int n)  { for (int i = 0; i < n; i++)  add(values[i]); }
+
+    /* Bins of both histograms cover the same values */
+    bool same_layout(const LatencyHistogram& other) const {
+        return origin == other.origin && bins == other.bins && shift == other.shift;
+    }
+
+    int64_t bin_value(int k) const          { return origin + ((int64_t) k << shift); }
+    const uint32_t* data() const            { return counts.data(); }
+    int get_bins() const                    { return bins; }
+    int get_shift() const                   { return shift; }
+    int64_t get_origin() const              { return origin; }
+    int get_total() const                   { return total; }
+    int get_clamped() const                 { return clamped; }
+
+private:
+    std::vector<uint32_t> counts;
+    int64_t origin;
+    int bins;
+    int shift;
+    int total;
+    int clamped;
+};
+
+/* kstest_mean() between two histograms of the same layout, in O(bins) with no sorting.
+ * Each bin is a distinct value (a tie if both histograms have it), so with shift 0 and
+ * nothing clamped this gives exactly kstest_mean() of the underlying samples. With wider
+ * bins, values sharing a bin count as ties. Returns -1 if the layouts differ. */
+double kstest_mean(const LatencyHistogram& hist1, const LatencyHistogram& hist2);
+
+#endif /* KSTEST_H */
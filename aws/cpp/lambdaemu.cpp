@@ -0,0 +1,465 @@
+/* lambdaemu: runs the lambda handler (main.cpp, built as "hello") locally, at scale.
+ * Stands in for the Lambda Runtime API on localhost and launches N handler processes
+ * pinned to the given cores, each pointed at its own port (so every response maps
+ * back to a core). Each round sends every handler the body invoke.py would send, with
+ * a common start time, and waits for all of them to respond. S3 writes land in
+ * <outdir>/s3/<bucket>/<key> (handler reads LOCAL_S3_DIR), or with -e go to an
+ * S3-compatible server at that endpoint (handler reads S3_ENDPOINT; credentials come
+ * from the usual AWS_ACCESS_KEY_ID/AWS_SECRET_ACCESS_KEY environment variables).
+ *
+ * Writes <outdir>/results.csv (one line per invocation, with the time each handler
+ * took to pick up and to finish its invocation), the handler's S3 objects, the raw
+ * runtime responses (<outdir>/responses/) and each handler's stdout/stderr.
+ *
+ * Usage: ./lambdaemu -b ./hello [-n handlers] [-c cores (e.g. 0-3,8)] [-o outdir] [-r rounds]
+ *                    [-d delay_secs] [-p phases] [-i idbits] [-l bitduration] [-s (samples)]
+ *                    [-x '"extra": "json fields", ...'] [-P base_port] [-t timeout_secs]
+ *                    [-e s3_endpoint (e.g. http://127.0.0.1:9000)]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_HANDLERS        4
+#define DEFAULT_BASE_PORT       9001
+#define DEFAULT_DELAY_SECS      5
+#define DEFAULT_TIMEOUT_SECS    900         /* Lambda's own maximum */
+#define RUNTIME_PATH            "/2018-06-01/runtime"
+#define FUNCTION_ARN            "arn:aws:lambda:local:000000000000:function:membus"
+
+static int64_t now_ms(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* One invocation of one handler */
+typedef struct {
+   std::string request_id;
+   std::string body;
+   int64_t queued_ms;          /* When the round started                      */
+   int64_t fetched_ms;         /* When the handler picked it up (0: not yet)  */
+   int64_t done_ms;            /* When it responded (0: not yet)              */
+   std::string status;         /* ok, error, timeout, crashed                 */
+   std::string response;
+} invocation_t;
+
+/* Runtime API connection from a handler (libcurl keeps it alive across requests) */
+typedef struct {
+   int fd;
+   std::string in;
+   bool continue_sent;         /* Answered "Expect: 100-continue" for the request in progress */
+   bool waiting;               /* Parked on /invocation/next until there's something to hand out */
+} connection_t;
+
+/* A handler process and its private runtime endpoint */
+typedef struct {
+   int core;
+   pid_t pid;
+   int listener;
+   std::vector<connection_t> connections;
+   invocation_t* pending;      /* Queued for this handler, not fetched yet */
+   invocation_t* running;
+   bool alive;
+} handler_t;
+
+static void send_all(int fd, const std::string& data)
+{
+   size_t sent = 0;
+   while (sent < data.size()) {
+      ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0 && errno != EINTR)
+         return;
+      if (n > 0)   sent += n;
+   }
+}
+
+static void reply(int fd, const char* status, const std::string& headers, const std::string& body)
+{
+   std::string response = std::string("HTTP/1.1 ") + status + "\r\nContent-Type: application/json\r\n" + headers
+      + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+   send_all(fd, response);
+}
+
+static void hand_out(connection_t& conn, invocation_t* invocation, int timeout_secs)
+{
+   std::string headers = "Lambda-Runtime-Aws-Request-Id: " + invocation->request_id + "\r\n"
+      + "Lambda-Runtime-Deadline-Ms: " + std::to_string(now_ms() + timeout_secs * 1000LL) + "\r\n"
+      + "Lambda-Runtime-Invoked-Function-Arn: " FUNCTION_ARN "\r\n"
+      + "Lambda-Runtime-Trace-Id: Root=1-00000000-" + invocation->request_id + "\r\n";
+   reply(conn.fd, "200 OK", headers, invocation->body);
+   invocation->fetched_ms = now_ms();
+   conn.waiting = false;
+}
+
+static std::string header_value(const std::string& headers, const char* name)
+{
+   std::string lower = headers;
+   for (size_t i = 0; i < lower.size(); i++)    lower[i] = tolower(lower[i]);
+   std::string key = std::string("\r\n") + name + ":";
+   size_t at = lower.find(key);
+   if (at == std::string::npos)
+      return "";
+   size_t start = at + key.size(), end = headers.find("\r\n", start);
+   while (start < end && headers[start] == ' ')   start++;
+   return headers.substr(start, end - start);
+}
+
+/* Serve whatever complete requests the connection has buffered; false to close it */
+static bool serve(handler_t& handler, connection_t& conn, int timeout_secs)
+{
+   while (true) {
+      size_t header_end = conn.in.find("\r\n\r\n");
+      if (header_end == std::string::npos)
+         return true;
+      std::string headers = conn.in.substr(0, header_end + 2);
+      size_t length = atol(header_value(headers, "content-length").c_str());
+      if (conn.in.size() < header_end + 4 + length) {
+         if (!conn.continue_sent && header_value(headers, "expect") == "100-continue") {
+            send_all(conn.fd, "HTTP/1.1 100 Continue\r\n\r\n");
+            conn.continue_sent = true;
+         }
+         return true;
+      }
+      std::string body = conn.in.substr(header_end + 4, length);
+      conn.in.erase(0, header_end + 4 + length);
+      conn.continue_sent = false;
+
+      std::istringstream request_line(headers);
+      std::string method, path;
+      request_line >> method >> path;
+
+      if (method == "GET" && path == RUNTIME_PATH "/invocation/next") {
+         if (handler.pending) {
+            handler.running = handler.pending;
+            handler.pending = NULL;
+            hand_out(conn, handler.running, timeout_secs);
+         }
+         else
+            conn.waiting = true;
+         continue;
+      }
+
+      /* .../invocation/<request id>/response or .../error, or .../init/error */
+      bool is_response = path.size() > 9 && path.compare(path.size() - 9, 9, "/response") == 0;
+      bool is_error = path.size() > 6 && path.compare(path.size() - 6, 6, "/error") == 0;
+      if (method == "POST" && (is_response || is_error)) {
+         invocation_t* invocation = handler.running;
+         if (invocation && path.find(invocation->request_id) != std::string::npos) {
+            invocation->done_ms = now_ms();
+            invocation->status = is_response ? "ok" : "error";
+            invocation->response = body;
+            handler.running = NULL;
+         }
+         else if (path == RUNTIME_PATH "/init/error")
+            fprintf(stderr, "Handler on core %d failed to initialize: %s\n", handler.core, body.c_str());
+         reply(conn.fd, "202 Accepted", "", "{\"status\":\"OK\"}");
+         continue;
+      }
+
+      reply(conn.fd, "404 Not Found", "", "{\"errorMessage\":\"unknown runtime API path\"}");
+   }
+}
+
+static int listen_on(int port)
+{
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   int one = 1;
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/* "0-3,8,10-11" */
+static std::vector<int> parse_cores(const char* spec)
+{
+   std::vector<int> cores;
+   std::stringstream ss(spec);
+   std::string range;
+   while (std::getline(ss, range, ',')) {
+      int first, last;
+      if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2)
+         for (int c = first; c <= last; c++)   cores.push_back(c);
+      else if (sscanf(range.c_str(), "%d", &first) == 1)
+         cores.push_back(first);
+   }
+   return cores;
+}
+
+static pid_t launch(const char* binary, int core, int port, const std::string& outdir, int index, const char* s3_endpoint)
+{
+   pid_t pid = fork();
+   if (pid != 0)
+      return pid;
+
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(core, &set);
+   if (sched_setaffinity(0, sizeof(set), &set) != 0)
+      fprintf(stderr, "Could not pin handler %d to core %d\n", index, core);
+
+   std::string log = outdir + "/handler-" + std::to_string(index) + ".log";
+   int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   dup2(fd, 1);
+   dup2(fd, 2);
+
+   std::string endpoint = "127.0.0.1:" + std::to_string(port);
+   std::string s3dir = outdir + "/s3";
+   setenv("AWS_LAMBDA_RUNTIME_API", endpoint.c_str(), 1);
+   if (s3_endpoint != NULL)
+      setenv("S3_ENDPOINT", s3_endpoint, 1);
+   else
+      setenv("LOCAL_S3_DIR", s3dir.c_str(), 1);
+   setenv("AWS_REGION", "local", 0);
+   setenv("AWS_LAMBDA_FUNCTION_NAME", "membus", 0);
+   execl(binary, binary, (char*) NULL);
+   fprintf(stderr, "Could not run %s: %s\n", binary, strerror(errno));
+   _exit(127);
+}
+
+/* The body invoke.py sends (see worker() there), plus any extra fields */
+static std::string make_body(int id, long stime, int phases, int idbits, int bitduration, bool samples,
+   const std::string& guid, const std::string& extra)
+{
+   std::ostringstream body;
+   body << "{\"id\": " << id << ", \"stime\": " << stime << ", \"phases\": " << phases << ", \"log\": true, "
+      << "\"maxbits\": " << idbits << ", \"bitduration\": " << bitduration << ", \"samples\": " << (samples ? "true" : "false")
+      << ", \"s3bucket\": \"local\", \"s3key\": \"" << guid << "\", \"guid\": \"" << guid << "\"";
+   if (!extra.empty())
+      body << ", " << extra;
+   body << "}";
+   return body.str();
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+   stop_requested = 1;
+}
+
+int main(int argc, char** argv)
+{
+   const char* binary = NULL;
+   const char* s3_endpoint = NULL;
+   int num_handlers = DEFAULT_HANDLERS, rounds = 1, delay_secs = DEFAULT_DELAY_SECS, base_port = DEFAULT_BASE_PORT;
+   int phases = 1, idbits = 8, bitduration = 1, timeout_secs = DEFAULT_TIMEOUT_SECS;
+   bool samples = false;
+   std::string outdir = "out/local", extra;
+   std::vector<int> cores;
+   int opt;
+   while ((opt = getopt(argc, argv, "b:n:c:o:r:d:p:i:l:sx:P:t:e:")) != -1) {
+      switch (opt) {
+      case 'b':   binary = optarg;                    break;
+      case 'n':   num_handlers = atoi(optarg);        break;
+      case 'c':   cores = parse_cores(optarg);        break;
+      case 'o':   outdir = optarg;                    break;
+      case 'r':   rounds = atoi(optarg);              break;
+      case 'd':   delay_secs = atoi(optarg);          break;
+      case 'p':   phases = atoi(optarg);              break;
+      case 'i':   idbits = atoi(optarg);              break;
+      case 'l':   bitduration = atoi(optarg);         break;
+      case 's':   samples = true;                     break;
+      case 'x':   extra = optarg;                     break;
+      case 'P':   base_port = atoi(optarg);           break;
+      case 't':   timeout_secs = atoi(optarg);        break;
+      case 'e':   s3_endpoint = optarg;               break;
+      default:
+         printf("Usage: %s -b ./hello [-n handlers] [-c cores] [-o outdir] [-r rounds] [-d delay_secs] [-p phases]"
+            " [-i idbits] [-l bitduration] [-s] [-x extra_json_fields] [-P base_port] [-t timeout_secs] [-e s3_endpoint]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (binary == NULL || num_handlers <= 0 || rounds <= 0 || delay_secs < 0 || timeout_secs <= 0 || num_handlers >= (1 << idbits)) {
+      printf("ERROR! Provide the handler binary (-b), positive counts, and fewer handlers than ids (2^idbits - 1)\n");
+      return 1;
+   }
+   if (cores.empty())
+      for (int c = 0; c < num_handlers; c++)   cores.push_back(c);
+
+   mkdir(outdir.c_str(), 0755);
+   mkdir((outdir + "/s3").c_str(), 0755);
+   mkdir((outdir + "/responses").c_str(), 0755);
+   signal(SIGINT, on_signal);
+   signal(SIGTERM, on_signal);
+   signal(SIGPIPE, SIG_IGN);
+
+   /* Endpoints first so no handler finds its runtime missing */
+   std::vector<handler_t> handlers(num_handlers);
+   for (int i = 0; i < num_handlers; i++) {
+      handler_t& handler = handlers[i];
+      handler.core = cores[i % cores.size()];
+      handler.listener = listen_on(base_port + i);
+      handler.pending = handler.running = NULL;
+      if (handler.listener < 0) {
+         printf("ERROR! Cannot listen on port %d: %s\n", base_port + i, strerror(errno));
+         return 1;
+      }
+   }
+   for (int i = 0; i < num_handlers; i++) {
+      handlers[i].pid = launch(binary, handlers[i].core, base_port + i, outdir, i, s3_endpoint);
+      handlers[i].alive = handlers[i].pid > 0;
+   }
+   printf("Launched %d handlers on cores", num_handlers);
+   for (int i = 0; i < num_handlers; i++)    printf(" %d", handlers[i].core);
+   printf("\n");
+
+   std::vector< std::vector<invocation_t> > invocations(rounds, std::vector<invocation_t>(num_handlers));
+   std::string run_tag = std::to_string(now_ms() / 1000);
+   for (int round = 0; round < rounds && !stop_requested; round++) {
+      /* Everyone starts the protocol together, as with invoke.py's sync point */
+      long stime = now_ms() / 1000 + delay_secs;
+      for (int i = 0; i < num_handlers; i++) {
+         invocation_t& invocation = invocations[round][i];
+         std::string guid = run_tag + "-" + std::to_string(round) + "-" + std::to_string(i + 1);
+         invocation.request_id = guid;
+         invocation.body = make_body(i + 1, stime, phases, idbits, bitduration, samples, guid, extra);
+         invocation.queued_ms = now_ms();
+         invocation.fetched_ms = invocation.done_ms = 0;
+         invocation.status = handlers[i].alive ? "timeout" : "crashed";
+         if (!handlers[i].alive)
+            continue;
+         handlers[i].pending = &invocation;
+
+         /* A handler already parked on /next gets it right away */
+         for (size_t c = 0; c < handlers[i].connections.size(); c++) {
+            if (handlers[i].connections[c].waiting) {
+               handlers[i].running = handlers[i].pending;
+               handlers[i].pending = NULL;
+               hand_out(handlers[i].connections[c], handlers[i].running, timeout_secs);
+               break;
+            }
+         }
+      }
+
+      int64_t deadline_ms = now_ms() + (delay_secs + timeout_secs) * 1000LL;
+      while (!stop_requested && now_ms() < deadline_ms) {
+         /* Done when nobody has work left */
+         bool busy = false;
+         for (int i = 0; i < num_handlers; i++)
+            busy |= handlers[i].alive && (handlers[i].pending || handlers[i].running);
+         if (!busy)
+            break;
+
+         std::vector<struct pollfd> fds;
+         std::vector< std::pair<int, int> > owners;      /* (handler, connection or -1 for the listener) */
+         for (int i = 0; i < num_handlers; i++) {
+            struct pollfd listener = { handlers[i].listener, POLLIN, 0 };
+            fds.push_back(listener);
+            owners.push_back(std::make_pair(i, -1));
+            for (size_t c = 0; c < handlers[i].connections.size(); c++) {
+               struct pollfd conn = { handlers[i].connections[c].fd, POLLIN, 0 };
+               fds.push_back(conn);
+               owners.push_back(std::make_pair(i, (int) c));
+            }
+         }
+         poll(fds.data(), fds.size(), 100);
+
+         std::vector< std::pair<int, int> > closed;
+         for (size_t f = 0; f < fds.size(); f++) {
+            if (!fds[f].revents)
+               continue;
+            handler_t& handler = handlers[owners[f].first];
+            if (owners[f].second < 0) {
+               connection_t conn;
+               conn.fd = accept(handler.listener, NULL, NULL);
+               conn.continue_sent = conn.waiting = false;
+               int one = 1;
+               setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+               if (conn.fd >= 0)    handler.connections.push_back(conn);
+               continue;
+            }
+            connection_t& conn = handler.connections[owners[f].second];
+            char buf[65536];
+            ssize_t n = recv(conn.fd, buf, sizeof(buf), 0);
+            if (n > 0)
+               conn.in.append(buf, n);
+            if (n <= 0 || !serve(handler, conn, timeout_secs))
+               closed.push_back(owners[f]);
+         }
+         for (size_t c = closed.size(); c-- > 0; ) {
+            handler_t& handler = handlers[closed[c].first];
+            close(handler.connections[closed[c].second].fd);
+            handler.connections.erase(handler.connections.begin() + closed[c].second);
+         }
+
+         /* A handler that died takes its invocation with it */
+         int status;
+         pid_t pid;
+         while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < num_handlers; i++) {
+               if (handlers[i].pid != pid)
+                  continue;
+               handlers[i].alive = false;
+               if (handlers[i].running)    handlers[i].running->status = "crashed";
+               if (handlers[i].pending)    handlers[i].pending->status = "crashed";
+               handlers[i].running = handlers[i].pending = NULL;
+               printf("Handler %d (core %d) exited, see %s/handler-%d.log\n", i, handlers[i].core, outdir.c_str(), i);
+            }
+         }
+      }
+      for (int i = 0; i < num_handlers; i++)
+         handlers[i].pending = handlers[i].running = NULL;
+
+      int ok = 0;
+      for (int i = 0; i < num_handlers; i++)    ok += invocations[round][i].status == "ok";
+      printf("Round %d: %d of %d handlers responded\n", round + 1, ok, num_handlers);
+   }
+
+   for (int i = 0; i < num_handlers; i++) {
+      if (handlers[i].alive)    kill(handlers[i].pid, SIGTERM);
+   }
+   for (int i = 0; i < num_handlers; i++) {
+      if (handlers[i].pid > 0)  waitpid(handlers[i].pid, NULL, 0);
+   }
+
+   /* Pick-up time is invocation overhead (process start and runtime init on the first round);
+    * run time includes the delay till the common start time */
+   std::ofstream csv((outdir + "/results.csv").c_str());
+   csv << "round,id,core,pid,request_id,status,pickup_ms,run_ms,result_file\n";
+   for (int round = 0; round < rounds; round++) {
+      for (int i = 0; i < num_handlers; i++) {
+         invocation_t& invocation = invocations[round][i];
+         int64_t pickup = invocation.fetched_ms ? invocation.fetched_ms - invocation.queued_ms : -1;
+         int64_t run = invocation.done_ms ? invocation.done_ms - invocation.fetched_ms : -1;
+         std::string result = outdir + "/s3/local/" + invocation.request_id;
+         csv << round + 1 << "," << i + 1 << "," << handlers[i].core << "," << handlers[i].pid << "," << invocation.request_id << ","
+            << invocation.status << "," << pickup << "," << run << "," << (access(result.c_str(), F_OK) == 0 ? result : "") << "\n";
+         if (!invocation.response.empty()) {
+            std::ofstream response((outdir + "/responses/" + invocation.request_id).c_str());
+            response << invocation.response;
+         }
+      }
+   }
+   printf("Results in %s/results.csv\n", outdir.c_str());
+   return 0;
+}
@@ -0,0 +1,80 @@
+#include <cstring>
+
+#include "latsort.h"
+
+#define RADIX_BITS      8
+#define RADIX_BUCKETS   (1 << RADIX_BITS)
+
+void LatencySorter::sort(int64_t arr[], int n)
+{
+    if (n < SMALL_SORT) {
+        timSort(arr, n);
+        return;
+    }
+
+    int64_t min = arr[0], max = arr[0];
+    for (int i = 1; i < n; i++) {
+        if (arr[i] < min)   min = arr[i];
+        if (arr[i] > max)   max = arr[i];
+    }
+    uint64_t range = (uint64_t) max - (uint64_t) min;
+    if (range == 0)
+        return;
+
+    /* Counting sort costs O(n + range), radix O(n * bytes of range): count when the range
+     * is not much wider than the array (the usual case for a bit's worth of samples) */
+    if (range < (uint64_t) COUNTING_MAX_RANGE && range <= 4 * (uint64_t) n)
+        counting_sort(arr, n, min, range);
+    else
+        radix_sort(arr, n, min, range);
+}
+
+void LatencySorter::counting_sort(int64_t arr[], int n, int64_t min, uint64_t range)
+{
+    counts.assign(range + 1, 0);
+    for (int i = 0; i < n; i++)
+        counts[arr[i] - min]++;
+
+    int k = 0;
+    for (uint64_t v = 0; v <= range; v++)
+        for (uint32_t c = counts[v]; c > 0; c--)
+            arr[k++] = min + v;
+}
+
+void LatencySorter::radix_sort(int64_t arr[], int n, int64_t min, uint64_t range)
+{
+    reserve(n);
+    int64_t* src = arr;
+    int64_t* dst = scratch.data();
+    uint32_t bucket[RADIX_BUCKETS];
+
+    for (int shift = 0; shift < 64 && (range >> shift) != 0; shift += RADIX_BITS) {
+        memset(bucket, 0, sizeof(bucket));
+        for (int i = 0; i < n; i++)
+            bucket[(((uint64_t) src[i] - min) >> shift) & (RADIX_BUCKETS - 1)]++;
+
+        uint32_t offset = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            uint32_t c = bucket[b];
+            bucket[b] = offset;
+            offset += c;
+        }
+
+        for (int i = 0; i < n; i++)
+            dst[bucket[(((uint64_t) src[i] - min) >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+
+        int64_t* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    /* Odd number of passes leaves the result in scratch */
+    if (src != arr)
+        memcpy(arr, src, n * sizeof(int64_t));
+}
+
+void sort_latencies(int64_t arr[], int n)
+{
+    static thread_local LatencySorter sorter;
+    sorter.sort(arr, n);
+}
@@ -0,0 +1,37 @@
+#ifndef LATSORT_H
+#define LATSORT_H
+
+#include <cstdint>
+#include <vector>
+
+/* Defined in timsort.cpp; general-purpose fallback */
+void timSort(int64_t arr[], int n);
+
+/* Sorts latency samples, which are (mostly) small non-negative integers in a narrow
+ * range. Scans the array once for its range, then counting-sorts it if the range is
+ * dense enough, else LSD-radix-sorts it one byte at a time on (value - min), skipping
+ * the bytes the range doesn't need. Counts and the scratch buffer are kept between
+ * calls, so after the first sort of a given size no allocation happens.
+ */
+class LatencySorter
+{
+public:
+    static const int COUNTING_MAX_RANGE = 1 << 16;    /* Largest range counting sort is used for   */
+    static const int SMALL_SORT = 64;                 /* Below this, insertion sort (via timSort)   */
+
+    void reserve(int n)         { if ((int) scratch.size() < n)  scratch.resize(n); }
+
+    void sort(int64_t arr[], int n);
+
+private:
+    void counting_sort(int64_t arr[], int n, int64_t min, uint64_t range);
+    void radix_sort(int64_t arr[], int n, int64_t min, uint64_t range);
+
+    std::vector<int64_t> scratch;
+    std::vector<uint32_t> counts;
+};
+
+/* Sorts with a per-thread LatencySorter */
+void sort_latencies(int64_t arr[], int n);
+
+#endif /* LATSORT_H */
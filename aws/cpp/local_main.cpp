@@ -31,6 +31,7 @@
 
 
 #include "util.h"
+#include "tsc.h"
 #include "RSJparser.tcc"
 
 char const TAG[] = "MEMBUS";
@@ -45,9 +46,6 @@ char const TAG[] = "MEMBUS";
 #define MAX_BIT_DURATION_SECS    5
 #define MUS_IN_ONE_SEC           1000000
 #define MAX_PHASES               15
-#define PVALUE_THRESHOLD         0.0
-// #define PVALUE_THRESHOLD      0.0005
-// #define PVALUE_THRESHOLD      0.0000001
 #define DEFAULT_KS_MEAN_CUTOFF   3.0            /* KS Statistic more than this would indicate enough contention to infer 1-bit   */
 
 using Clock = std::chrono::high_resolution_clock;
@@ -89,25 +87,6 @@ typedef struct {
    int ids[MAX_PHASES];
 } result_t;
 
-/* Rdtsc blocks for time measurements */
-unsigned cycles_low, cycles_high, cycles_low1, cycles_high1;
-
-static __inline__ unsigned long long rdtsc(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high), "=r" (cycles_low)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
-static __inline__ unsigned long long rdtsc1(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high1), "=r" (cycles_low1)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
 double next_poisson_time(double rate)
 {
    return -logf(1.0f - ((double) random()) / (double) (RAND_MAX)) / rate;
@@ -268,18 +247,13 @@ int read_bit(uint64_t* addr, microseconds release_time_mus, int bit_duration_sec
    /* Release a bit early to avoid overruns (and allow for post-processing) */
    release_time_mus -= ten_ms;
 
-   int64_t start, end, mean, count = 0;
+   LatencySampler sampler;
+   int64_t mean, count = 0;
    // printf("%ld, %ld,\n", next.count(), release_time_mus.count());      /** COMMENT OUT IN REAL RUNS **/
    for (i = 0; i < num_samples && within_time(release_time_mus); i++)
    {   
       // Get a sample
-      rdtsc();
-      __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
-      rdtsc1();
-
-      start = ( ((int64_t)cycles_high << 32) | cycles_low );
-      end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-      samples[i] = (end - start);
+      samples[i] = sampler.sample_atomic(addr);
       count++;
          
       next += microseconds((int)next_poisson_time(sampling_rate_mus));
@@ -382,12 +356,8 @@ uint64_t* get_cache_line_straddled_address()
    // printf("Membus latencies with sliding address:\n");
    // for (int j = -8; j < 16; j++) {
    //    uint64_t* cacheline = (uint64_t*)((uint8_t*)(arr+i-1) + j);
-   //    rdtsc();
-   //    __atomic_fetch_add(cacheline, 1, __ATOMIC_SEQ_CST);
-   //    rdtsc1();
-   //    uint64_t start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   //    uint64_t end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   //    printf("%d,%lu\n", j, (end - start));
+   //    LatencySampler sampler;
+   //    printf("%d,%lu\n", j, sampler.sample_atomic(cacheline));
    // }
 
    return (uint64_t*)addr;
@@ -557,15 +527,13 @@ std::string get_ipaddr(void) {
 /* Performs a CPU-bound operation and gets time taken for the operation. (A measure of how much CPU the process is getting...) */
 uint64_t get_cpu_cycles_for_task(){
    int TIMES = 1e6;
-   uint64_t x = 0, start, end;
-   rdtsc();
+   uint64_t x = 0;
+   LatencySampler sampler;
+   sampler.start();
    for(int i = 0; i < TIMES; i++)  x += i;
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   lprintf("Summing %d times to %lu took %lu cycles\n", TIMES, x, (end-start));
-   return (end - start);
+   uint64_t cycles = sampler.stop();
+   lprintf("Summing %d times to %lu took %lu cycles\n", TIMES, x, cycles);
+   return cycles;
 }
 
 
@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "logarena.h"
+
+LogArena::LogArena(size_t capacity) : capacity(capacity), used(0), count(0), dropped(0)
+{
+    arena = new uint8_t[capacity];
+    memset(arena, 0, capacity);     /* Fault it in now, not while recording */
+}
+
+/* Append one conversion, formatted by snprintf itself so the output is exactly what
+ * sprintf would have made of it */
+template<typename T>
+static void append(std::string& out, const char* spec, T value)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), spec, value);
+    if (n < 0)
+        return;
+    if (n < (int) sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string big(n + 1, '\0');
+    snprintf(&big[0], n + 1, spec, value);
+    out.append(big.data(), n);
+}
+
+std::string LogArena::format_record(const char* fmt, const uint8_t* args, const uint8_t* end)
+{
+    std::string out;
+    const uint8_t* p = args;
+
+    /* Next argument (or a zero one if the record ran out) */
+    auto next = [&](const char** text, uint32_t* length) -> const arg_t* {
+        static const arg_t none = { ARG_INT, 0, { 0 } };
+        if (p + sizeof(arg_t) > end)
+            return &none;
+        const arg_t* a = (const arg_t*) p;
+        p += sizeof(arg_t);
+        if (a->type == ARG_STRING) {
+            *text = (const char*) p;
+            *length = a->length;
+            p += (a->length + 7) & ~(uint32_t) 7;
+        }
+        return a;
+    };
+
+    for (const char* f = fmt; *f; ) {
+        if (*f != '%') {
+            const char* lit = f;
+            while (*f && *f != '%')     f++;
+            out.append(lit, f - lit);
+            continue;
+        }
+        if (f[1] == '%') {
+            out += '%';
+            f += 2;
+            continue;
+        }
+
+        /* Conversion spec: %[flags][width][.precision][length]conversion; '*' widths and
+         * precisions take an argument and are written into the spec as numbers */
+        std::string spec = "%";
+        const char* s = f + 1;
+        while (*s && strchr("-+ #0'", *s))   spec += *s++;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*s != '.')  break;
+                spec += *s++;
+            }
+            if (*s == '*') {
+                const char* text = NULL;
+                uint32_t length = 0;
+                spec += std::to_string((int) next(&text, &length)->value.i);
+                s++;
+            }
+            while (*s >= '0' && *s <= '9')   spec += *s++;
+        }
+        std::string len;
+        while (*s && strchr("hlLqjzt", *s))  len += *s++;
+        char conv = *s;
+        if (conv == 0)
+            break;
+        f = s + 1;
+        if (conv == 'n')
+            continue;
+        spec += len;
+        spec += conv;
+
+        const char* text = NULL;
+        uint32_t length = 0;
+        const arg_t* a = next(&text, &length);
+        const char* cspec = spec.c_str();
+        switch (conv) {
+        case 'd': case 'i':
+            if (len == "l" || len == "q")         append(out, cspec, (long) a->value.i);
+            else if (len == "ll")                 append(out, cspec, (long long) a->value.i);
+            else if (len == "z" || len == "t")    append(out, cspec, (ssize_t) a->value.i);
+            else if (len == "j")                  append(out, cspec, (intmax_t) a->value.i);
+            else                                  append(out, cspec, (int) a->value.i);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            if (len == "l" || len == "q")         append(out, cspec, (unsigned long) a->value.i);
+            else if (len == "ll")                 append(out, cspec, (unsigned long long) a->value.i);
+            else if (len == "z" || len == "t")    append(out, cspec, (size_t) a->value.i);
+            else if (len == "j")                  append(out, cspec, (uintmax_t) a->value.i);
+            else                                  append(out, cspec, (unsigned int) a->value.i);
+            break;
+        case 'c':
+            append(out, cspec, (int) a->value.i);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            double d = a->type == ARG_DOUBLE ? a->value.d : (double) a->value.i;
+            if (len == "L")                       append(out, cspec, (long double) d);
+            else                                  append(out, cspec, d);
+            break;
+        }
+        case 's': {
+            /* Copied text is not NUL-terminated: format it from a terminated copy */
+            if (a->type != ARG_STRING || a->value.p == NULL)
+                append(out, cspec, (const char*) (a->type == ARG_POINTER ? a->value.p : NULL));
+            else
+                append(out, cspec, std::string(text, length).c_str());
+            break;
+        }
+        case 'p':
+            append(out, cspec, a->value.p);
+            break;
+        default:
+            out += spec;
+            break;
+        }
+    }
+
+    /* sprintf into a char buffer stopped at the first NUL */
+    size_t nul = out.find('\0');
+    if (nul != std::string::npos)
+        out.resize(nul);
+    return out;
+}
+
+std::string LogArena::format(char sep, size_t budget) const
+{
+    std::string out;
+    size_t at = 0, over = 0;
+    while (at < used) {
+        const header_t* h = (const header_t*) (arena + at);
+        const uint8_t* args = arena + at + sizeof(header_t);
+        at += h->size;
+        std::string line = format_record(h->fmt, args, arena + at);
+        if (over || out.size() + line.size() + 1 > budget) {
+            over++;
+            continue;
+        }
+        out += line;
+        out += sep;
+    }
+    if (over > 0 || dropped > 0)
+        out += "[" + std::to_string(over) + " log lines over the " + std::to_string(budget) + " byte budget, "
+            + std::to_string(dropped) + " dropped with the log arena full]" + sep;
+    return out;
+}
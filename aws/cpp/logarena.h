@@ -0,0 +1,137 @@
+#ifndef LOGARENA_H
+#define LOGARENA_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#define DEFAULT_LOG_ARENA_BYTES     (4 << 20)
+#define DEFAULT_LOG_BUDGET_BYTES    (4 << 20)       /* Lambda responses are capped at 6 MB */
+
+/* printf-style log lines, recorded in binary and formatted later. A record is the format
+ * string (a literal, so its address is a good enough format id) and the raw arguments;
+ * strings are copied in since they are often c_str() of temporaries. Everything goes
+ * into one arena allocated up front, so recording never allocates; a record that does not
+ * fit is dropped and counted. format() produces the same text sprintf would have, one
+ * conversion at a time.
+ *
+ * Not thread-safe: record from one thread at a time.
+ */
+class LogArena
+{
+public:
+    explicit LogArena(size_t capacity = DEFAULT_LOG_ARENA_BYTES);
+    ~LogArena()                     { delete[] arena; }
+
+    template<typename... Args>
+    void record(const char* fmt, Args... args) {
+        size_t start = used;
+        used += sizeof(header_t);
+        if (used > capacity || !put_all(args...)) {
+            used = start;
+            dropped++;
+            return;
+        }
+        header_t* h = (header_t*) (arena + start);
+        h->fmt = fmt;
+        h->size = used - start;
+        count++;
+    }
+
+    /* Forget all records (the arena is kept) */
+    void clear()                    { used = 0; count = 0; dropped = 0; }
+
+    size_t size() const             { return count; }
+    size_t get_dropped() const      { return dropped; }
+    size_t bytes_used() const       { return used; }
+
+    /* All lines, each followed by sep, up to budget bytes. Lines past the budget (and any
+     * dropped records) are noted in a last line. */
+    std::string format(char sep, size_t budget = DEFAULT_LOG_BUDGET_BYTES) const;
+
+    /* Line of one record, exactly as sprintf(fmt, args...) */
+    static std::string format_record(const char* fmt, const uint8_t* args, const uint8_t* end);
+
+private:
+    enum { ARG_INT, ARG_DOUBLE, ARG_STRING, ARG_POINTER };
+
+    typedef struct {
+        const char* fmt;
+        size_t size;                /* Of the whole record, header included */
+    } header_t;
+
+    typedef struct {
+        uint32_t type;
+        uint32_t length;            /* Of a string (which follows, padded to 8 bytes) */
+        union {
+            int64_t i;
+            double d;
+            const void* p;
+        } value;
+    } arg_t;
+
+    bool put_all()                  { return true; }
+
+    template<typename T, typename... Rest>
+    bool put_all(T first, Rest... rest) {
+        return put(first) && put_all(rest...);
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, bool>::type put(T v) {
+        arg_t* a = next_arg(0);
+        if (a == NULL)      return false;
+        a->type = ARG_INT;
+        a->value.i = (int64_t) v;
+        return true;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, bool>::type put(T v) {
+        arg_t* a = next_arg(0);
+        if (a == NULL)      return false;
+        a->type = ARG_DOUBLE;
+        a->value.d = v;
+        return true;
+    }
+
+    bool put(const char* s) {
+        size_t length = s ? strlen(s) : 0;
+        arg_t* a = next_arg(length);
+        if (a == NULL)      return false;
+        a->type = ARG_STRING;
+        a->length = length;
+        a->value.p = s;     /* Only tells NULL apart; the text is copied after the arg */
+        if (length)         memcpy(a + 1, s, length);
+        return true;
+    }
+    bool put(char* s)       { return put((const char*) s); }
+
+    template<typename T>
+    bool put(T* p) {
+        arg_t* a = next_arg(0);
+        if (a == NULL)      return false;
+        a->type = ARG_POINTER;
+        a->value.p = p;
+        return true;
+    }
+
+    /* Room for an argument and extra bytes after it, or NULL */
+    arg_t* next_arg(size_t extra) {
+        size_t size = sizeof(arg_t) + ((extra + 7) & ~(size_t) 7);
+        if (used + size > capacity)
+            return NULL;
+        arg_t* a = (arg_t*) (arena + used);
+        used += size;
+        return a;
+    }
+
+    uint8_t* arena;
+    size_t capacity;
+    size_t used;
+    size_t count;
+    size_t dropped;
+};
+
+#endif /* LOGARENA_H */
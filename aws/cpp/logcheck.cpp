@@ -0,0 +1,71 @@
+/* Checks that LogArena formats lines byte for byte as snprintf does, on the handler's own
+ * format strings: analyze.py parses some of them with regexes (BIT_STATS_PATTERN), so a
+ * stray space or digit breaks post-experiment analysis. Each line is recorded into an
+ * arena, formatted with format() and compared with snprintf of the same arguments.
+ * Prints each mismatch and exits non-zero if there was any (run by ctest).
+ *
+ * Usage: ./logcheck
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "logarena.h"
+
+static int checks = 0, failures = 0;
+
+template<typename... Args>
+static void check(const char* fmt, Args... args)
+{
+   checks++;
+   int n = snprintf(NULL, 0, fmt, args...);
+   std::string expected(n + 1, '\0');
+   snprintf(&expected[0], n + 1, fmt, args...);
+   expected.resize(n);
+   expected += '\t';
+
+   LogArena arena(1 << 16);
+   arena.record(fmt, args...);
+   std::string got = arena.format('\t');
+   if (got == expected)
+      return;
+   failures++;
+   printf("FAIL \"%s\"\n  expected: \"%s\"\n  got:      \"%s\"\n", fmt, expected.c_str(), got.c_str());
+}
+
+int main()
+{
+   /* CAUTION: copies of lprintf format strings in main.cpp; keep them in sync */
+   const char* ks_line = "[Lambda-%3d] KS phase %d bit %d: mean %.3lf, D %.4lf, p-value %.3g (%d vs %d samples)%s\n";
+   check(ks_line, 7, 1, 3, 2.71828, 0.123456, 3.2e-5, 812, 3000, "");
+   check(ks_line, 1023, 14, 0, 0.0, 1.0, 1.0, 0, 0, ", bus_locks=12, llc_misses=0");
+   check(ks_line, -1, 0, 9, -0.0005, 0.99999, 0.0, 60000, 60000, std::string(300, 'x').c_str());
+
+   /* analyze.py's BIT_STATS_PATTERN */
+   const char* bit_stats = "[Lambda-%3d] %3d %9d %4d %5d %5d %9d %9lu %8lu %8lu %8lu %10d %10lu %9lu %2.15f\n";
+   check(bit_stats, 5, 1, 9, 1, 0, 0, 1000, 9876UL, 123UL, 20000UL, 9000UL, 3000, 9500UL, 110UL, 0.000123456789012345);
+   check(bit_stats, 912, 14, 0, 0, 1, 1, 0, 0UL, 0UL, 0UL, 0UL, 0, 0UL, 0UL, -1.0);
+   check(bit_stats, 1, 0, 1, 1, 1, 1, 2147483647, (unsigned long) UINT64_MAX, 1UL, 2UL, 3UL, -5, 4UL, 5UL, 3.0);
+
+   check("[Lambda-%3d] SPRT phase %d bit %d: read %d after %d samples, %ld mus (decided: %d)\n", 42, 2, 7, 1, 188, (long) 18765, 1);
+   check("[Lambda-%3d] Preemption phase %d bit %d: %d of %d samples late by %ld mus in all (max %ld mus), %lu switches, run delay %lu mus%s\n",
+      3, 1, 2, 4, 900, (long) 25000, (long) 20001, 2UL, 31000UL, " (bit erased)");
+   check("Starting lambda %d (GUID: %s) at %s", 17, "0f7c-aa12", "2026-10-17 12:00:00");
+   check("TSC frequency: %.1lf MHz (%s, invariant: %d)\n", 2899.999, "cpuid", 1);
+   check("Added object %s to s3 bucket %s (%lu bytes, %d parts, %d attempts, %.1lf ms)\n", "exp/17.json", "bucket", 1234567UL, 0, 1, 12.35);
+   check("Error adding object %s to s3 bucket %s: %s\n", "exp/17.trace", "bucket", "");
+   check("Analysis ring drops: %lu\n", 0UL);
+
+   /* Conversions the format strings above do not exercise (volatile: NULL only at run time) */
+   const char* volatile null_string = NULL;
+   check("%s|%-8s|%8s|%.3s|%c|%%|%5.2f%%", (const char*) null_string, "ab", "cd", "abcdef", 'z', 99.555);
+   check("%*d|%-*.*f|%x|%#o|%+d|% d|%05d", 6, -12, 9, 2, 3.14159, 0xbeefu, 8u, 5, 7, -42);
+   check("%lld %llu %zu %e %g %G", (long long) INT64_MIN, (unsigned long long) UINT64_MAX, (size_t) 0, 1e-300, 1e21, 1e-5);
+   check("no conversions at all\n");
+
+   printf("%d lines: %s\n", checks, failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
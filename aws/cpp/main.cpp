@@ -24,6 +24,7 @@
 #include <cstring>
 #include <cmath>
 #include <string>
+#include <stdexcept>
 #include <unistd.h>
 #include <iostream>
 #include <sstream>
@@ -39,13 +40,30 @@
 #include <sys/errno.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <stdio.h>
 #include <ifaddrs.h>
 
 #include "util.h"
-#include "RSJparser.tcc"
+#include "kstest.h"
+#include "sprt.h"
+#include "tsc.h"
+#include "bit_analyzer.h"
+#include "expgen.h"
+#include "latsort.h"
+#include "ksdist.h"
+#include "monitor.h"
+#include "preempt.h"
+#include "perfctr.h"
+#include "protocol.h"
+#include "trace.h"
+#include "logarena.h"
+#include "jsonreader.h"
+#include "jsonwriter.h"
+#include "samplecodec.h"
+#include "s3uploader.h"
 
 using namespace aws::lambda_runtime;
 char const TAG[] = "MEMBUS";
@@ -55,12 +73,26 @@ char const TAG[] = "MEMBUS";
  * 2. Context switching/core switching would not affect the monotonicity or steadiness of the clock on millisecond scales
  */
 
-#define SAMPLES_PER_SECOND       1000           /* Sampling rate: This is limited by 1) noise under too much sampling            */
-                                                /* and 2) post-processing computation (KS test) done for each sample at every bit*/
+#define SAMPLES_PER_SECOND       1000           /* Default sampling rate: This is limited by noise under too much sampling.       */
+                                                /* (KS test is computed online as samples arrive, so it is no longer a limit)    */
+#define MAX_SAMPLES_PER_SECOND   10000
 #define MAX_BIT_DURATION_SECS    5
+#define MIN_BIT_DURATION_MS      50             /* Sub-second bit slots must still leave time to sample after the sync guards    */
+#define BIT_GUARD_MUS            2000           /* read_bit/write_bit stop this early to avoid overrunning the bit interval      */
+#define DEFAULT_SLEEP_MARGIN_MUS 2000           /* Sync waits sleep until this close to the deadline and spin the rest (wakeups  */
+                                                /* from sleep can run hundreds of mus late in a VM)                              */
 #define MUS_PER_SEC              1000000
-#define MAX_PHASES               15
 #define DEFAULT_KS_MEAN_CUTOFF   3.0            /* KS Statistic more than this would indicate enough contention to infer 1-bit   */
+                                                /* (tuned at SAMPLES_PER_SECOND; scaled to the requested rate)                   */
+#define DEFAULT_KS_ALPHA         0.001          /* P-value decisions: tolerated rate of 0-bits read as 1                         */
+#define DEFAULT_SPRT_ALPHA       0.001          /* SPRT early decision: tolerated rate of 0-bits read as 1                       */
+#define DEFAULT_SPRT_BETA        0.001          /* SPRT early decision: tolerated rate of 1-bits read as 0                       */
+#define DEFAULT_SPRT_P1          0.8            /* SPRT: fraction of samples above baseline quantile expected under contention   */
+#define DEFAULT_SPRT_QUANTILE    0.5            /* SPRT: baseline quantile each sample is compared against                       */
+#define CPI_ROUNDS               5              /* CPU CPI estimate: fastest of this many rounds...                             */
+#define CPI_ROUND_ITERATIONS     1000000        /* ...of this many iterations each (a few ms in all)                             */
+#define MAX_MONITOR_SECS         900            /* Monitor mode runs at most this long (Lambda's own timeout)                    */
+#define DEFAULT_RESPONSE_RESERVE (1 << 20)      /* Response buffer to start with when samples or logs go in (grows if needed)    */
 
 using Clock = std::chrono::high_resolution_clock;
 using microseconds = std::chrono::microseconds;
@@ -68,31 +100,28 @@ using seconds = std::chrono::seconds;
 using std::chrono::duration;
 using std::chrono::duration_cast;
 
-/* Defined in timsort.cpp (Bad practice using extern!) */
-extern void timSort(int64_t arr[], int n);
-/* Defined in kstest.cpp */
-extern double kstest_mean(int64_t* sample1, int size1, bool is_sorted1, int64_t* sample2, int size2, bool is_sorted2);
-
 /* Save all lambdas invoked in this container. */
 std::vector<std::string> lambdas;
 
-/* Logging */
+/* Request parsing: the token arrays are kept across invocations so parsing allocates nothing */
+JsonDoc request_json, nested_json;
+std::string nested_body;
+
+/* Result uploads; holds the S3 client across warm invocations */
+S3Uploader uploader;
+
+/* Logging: lines are recorded in binary (format + args) into a preallocated arena and 
+ * only formatted when the response is built */
 bool log_ = true;
-std::vector<std::string> logs;
-char lbuffer[1000];
+LogArena logs;
+size_t log_budget = DEFAULT_LOG_BUDGET_BYTES;
 #define lprintf(...) {                    \
    if (log_) {                            \
-      sprintf(lbuffer, __VA_ARGS__);      \
-      logs.push_back(lbuffer);            \
+      logs.record(__VA_ARGS__);           \
    }                                      \
 }
 // AWS_LOGSTREAM_INFO(TAG, lbuffer);   \        /* Directs every print statement to AWS Cloudwatch, TODO: include it in log_ conditional only when debugging */
 
-typedef struct {
-   int num_phases;
-   int ids[MAX_PHASES];
-} result_t;
-
 
 /* A fast but good enough pseudo-random number generator. Good enough for what? */
 /* Courtesy of https://stackoverflow.com/questions/1640258/need-a-fast-random-generator-for-c */
@@ -111,29 +140,9 @@ uint64_t rand_xorshf96(void) {          //period 2^96-1
 }
 
 
-/* Rdtsc blocks for time measurements */
-unsigned cycles_low, cycles_high, cycles_low1, cycles_high1;
-
-static __inline__ unsigned long long rdtsc(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high), "=r" (cycles_low)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
-static __inline__ unsigned long long rdtsc1(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high1), "=r" (cycles_low1)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
-double next_poisson_time(double rate)
-{
-   return -logf(1.0f - ((double) random()) / (double) (RAND_MAX)) / rate;
-}
+/* Exponential gaps between membus samples (Poisson sampling). Generated in batches 
+ * from a per-thread state so the schedule doesn't pay for random() + logf per sample. */
+thread_local ExpGenerator poisson_gen;
 
 /* Prepare randomized seed. Get if from /dev/urandom if possible
 * Repurposed from https://stackoverflow.com/questions/2640717/c-generate-a-good-random-seed-for-psudo-random-number-generators*/
@@ -198,34 +207,22 @@ std::string hex_str_to_bin_str(const std::string& hex)
 }
 
 
-/* Check if program is not past specified time yet */
-inline bool within_time(microseconds time_pt) {
-   microseconds now = duration_cast<microseconds>(Clock::now().time_since_epoch());
-   bool within_limit = now.count() < time_pt.count();
-   // if (!within_limit) {
-   //     // Prints any bad timeoverruns
-   //     int64_t ms = (now.count() - time_pt.count()) / 1000;
-   //     if (ms > 10) lprintf("Exceeded time limit by more than 10ms: %lu milliseconds\n", ms);
-   // }
-   return within_limit;
-}
+/* Waits that sync lambdas on a shared start time sleep until this close to it (0 to always spin) */
+int64_t sleep_margin_mus = DEFAULT_SLEEP_MARGIN_MUS;
 
-/* Stalls the program until a specified point in time */
-inline int poll_wait(microseconds release_time)
+/* Stalls the program until a specified point in time. The time is converted to a TSC target 
+ * once and we spin on RDTSC, so waiting doesn't read the clock in a loop. If sleep_margin is
+ * set, sleeps until that many microseconds before the release time instead of spinning. 
+ * Returns 1 if already past the release time. */
+inline int poll_wait(microseconds release_time, int64_t sleep_margin = 0)
 {
-   // If already past the release time, return but in error
-   if (!within_time(release_time))
-      return 1;
-
-   while(true) {
-      microseconds now = duration_cast<microseconds>(Clock::now().time_since_epoch());
-      if (now.count() >= release_time.count())
-            return 0;
-   }
+   TscDeadline deadline(release_time.count());
+   return deadline.wait(sleep_margin);
 }
 
-/* Finds an address on heap that falls on consecutive cache lines */
-uint64_t* get_cache_line_straddled_address()
+/* Finds an address on heap that falls on consecutive cache lines. The array it is in is
+ * returned in buffer (NULL on failure), for the caller to free. */
+uint64_t* get_cache_line_straddled_address(uint64_t** buffer)
 {
    uint64_t *arr;
    int i, size;
@@ -261,6 +258,8 @@ uint64_t* get_cache_line_straddled_address()
 
    if (i == size) {
       lprintf("ERROR! Could not find a cacheline boundary in the array.\n");
+      free(arr);
+      *buffer = NULL;
       return NULL;
    }
    else {
@@ -271,22 +270,22 @@ uint64_t* get_cache_line_straddled_address()
    // lprintf("Membus latencies with sliding address:\n");
    // for (int j = -8; j < 16; j++) {
    //    uint64_t* cacheline = (uint64_t*)((uint8_t*)(arr+i-1) + j);
-   //    rdtsc();
-   //    __atomic_fetch_add(cacheline, 1, __ATOMIC_SEQ_CST);
-   //    rdtsc1();
-   //    uint64_t start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   //    uint64_t end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   //    lprintf("%d,%lu\n", j, (end - start));
+   //    LatencySampler sampler;
+   //    lprintf("%d,%lu\n", j, sampler.sample_atomic(cacheline));
    // }
 
+   *buffer = arr;
    return (uint64_t*)addr;
 }
 
 /************************** NEIGHBOR DISCOVERY PROTOCOL IMPLEMENTATION ******************************************************/
 
 /* Buffers to save andsamples of latencies for post-experiment analysis */
-#define MAX_SAMPLES (MAX_BIT_DURATION_SECS*SAMPLES_PER_SECOND)
+#define MAX_SAMPLES (MAX_BIT_DURATION_SECS*MAX_SAMPLES_PER_SECOND)
 bool save_samples;
+std::string encoding_name_req = "decimal";
+sample_encoding_t encoding = ENCODING_DECIMAL;
+int samples_per_second = SAMPLES_PER_SECOND;
 int64_t samples[MAX_SAMPLES];
 int64_t base_readings[MAX_SAMPLES];
 int base_readings_len = 0;
@@ -297,52 +296,173 @@ int64_t bit0_readings[MAX_SAMPLES];
 int bit0_readings_len = 0;
 double bit0_pvalue;
 
-/* Samples membus lock latencies periodically to infer contention. If calibrate is set, uses these readings as baseline. */
-int read_bit(uint64_t* addr, microseconds release_time_mus, int bit_duration_secs, 
-   bool calibrate, int id, int phase, int round, double* ksvalue)
+/* KS test against the baseline, updated as samples come in */
+OnlineKS ks_engine;
+
+/* How a bit is decided from the KS test: mean statistic against a hand-tuned cutoff, or the
+ * p-value of the classic KS distance against a target false-positive rate (no tuning needed) */
+bool use_pvalue = false;
+double ks_cutoff = DEFAULT_KS_MEAN_CUTOFF;
+double ks_alpha = DEFAULT_KS_ALPHA;
+
+/* Sequential test for deciding a bit before its interval ends (if enabled) */
+bool use_sprt = false;
+SPRT sprt;
+int sprt_decided_bits = 0, sprt_undecided_bits = 0;
+int64_t sprt_decision_mus_total = 0;
+
+/* With two or more CPUs, KS/SPRT run on an analysis thread fed by the sampler (if enabled) */
+bool use_pipeline = true;
+BitAnalyzer bit_analyzer(&ks_engine, &sprt);
+int analysis_cpu = -1;
+
+/* Marks bits read while the sampler was descheduled as erasures, if enabled */
+PreemptionDetector preempt;
+int erasures_descheduled = 0, erasures_absent = 0;
+
+/* Hardware counters read over every bit window alongside the latencies (if enabled and available).
+ * Window kinds: b(aseline), r(ead bit), w(rite bit), c(hannel bit received) */
+bool use_perf = false;
+PerfCounters perf;
+std::vector<perf_counts_t> perf_windows;
+std::string perf_window_kinds;
+
+void record_perf_window(char kind)
+{
+   perf_windows.push_back(perf.end());
+   perf_window_kinds += kind;
+}
+
+/* Binary trace of every sample and bit decision, for offline replay (see replay.cpp), if enabled */
+TraceWriter trace;
+
+/* Samples membus lock latencies periodically to infer contention. If calibrate is set, uses these readings as baseline.
+ * Sets erased if we were off CPU for too much of the bit to trust what was read. */
+int read_bit(uint64_t* addr, microseconds release_time_mus, int bit_duration_mus, 
+   bool calibrate, int id, int phase, int round, double* ksvalue, bool* erased)
 {
    int i;
-   microseconds one_ms = microseconds(1000);
-   microseconds ten_ms = microseconds(10000);
+   microseconds guard = microseconds(BIT_GUARD_MUS);
    microseconds next = duration_cast<microseconds>(Clock::now().time_since_epoch());
+   microseconds bit_start = next;
    // int num_samples = calibrate ? BASELINE_SAMPLES : SAMPLES_PER_BIT;
    // int interval_mus = calibrate ? BASELINE_INTERVAL : BIT_INTERVAL_MUS;
-   int num_samples = bit_duration_secs * SAMPLES_PER_SECOND;
-   int interval_mus = bit_duration_secs * MUS_PER_SEC;
-   double sampling_rate_mus = SAMPLES_PER_SECOND * 1.0 / MUS_PER_SEC;
-
-   /* Release a bit early to avoid overruns (and allow for post-processing) */
-   release_time_mus -= ten_ms;
+   int num_samples = (int64_t) bit_duration_mus * samples_per_second / MUS_PER_SEC;
+   double mean_gap_mus = MUS_PER_SEC * 1.0 / samples_per_second;
+   bool sequential = use_sprt && !calibrate && sprt.is_enabled();
+   bool pipelined = !calibrate && bit_analyzer.is_running();
+   LatencySampler sampler;
+   uint64_t bit_start_tsc = tsc_now();
+
+   /* Release a bit early to avoid overruns. KS statistic is updated with every 
+    * sample, so no time needs to be set aside for post-processing */
+   release_time_mus -= guard;
+   if (pipelined)                   bit_analyzer.begin_bit(sequential);
+   else {
+      if (!calibrate)   ks_engine.reset();
+      if (sequential)   sprt.reset();
+   }
 
-   int64_t start, end, mean, count = 0;
+   int64_t count = 0;
+   uint64_t due_tsc = 0;         /* When the current sample was due (none for the first) */
    // lprintf("%ld, %ld,\n", next.count(), release_time_mus.count());      /** COMMENT OUT IN REAL RUNS **/
-   for (i = 0; i < num_samples && within_time(release_time_mus); i++)
+   TscDeadline release(release_time_mus.count());
+   preempt.begin_bit();
+   if (use_perf)     perf.begin();
+   for (i = 0; i < num_samples && release.pending(); i++)
    {   
       // Get a sample
-      rdtsc();
-      __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
-      rdtsc1();
-
-      start = ( ((int64_t)cycles_high << 32) | cycles_low );
-      end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-      samples[i] = (end - start);
-      count++;
+      samples[count] = sampler.sample_atomic(addr);
+
+      /* A sample taken well after it was due means we were off CPU in between */
+      preempt.sample(sampler.get_start(), due_tsc);
+      trace.add(calibrate ? TRACE_BASE_SAMPLE : TRACE_BIT_SAMPLE, sampler.get_start(), samples[count], phase, round, 0);
+      int64_t latency = samples[count++];
+
+      /* Stop sampling as soon as the evidence is conclusive either way */
+      if (pipelined) {
+         bit_analyzer.add(latency, sampler.get_start());
+         if (sequential && bit_analyzer.decided())
+            break;
+      }
+      else {
+         if (!calibrate)   ks_engine.add(latency);
+         if (sequential && sprt.add(latency) >= 0)
+            break;
+      }
          
-      next += microseconds((int)next_poisson_time(sampling_rate_mus));
-      poll_wait(next);
+      next += microseconds((int)poisson_gen.next(mean_gap_mus));
+      TscDeadline due(next.count());
+      due_tsc = due.get_target();
+      due.wait();
    }
 
+   int64_t elapsed_mus = (duration_cast<microseconds>(Clock::now().time_since_epoch()) - bit_start).count();
+   if (use_perf)     record_perf_window(calibrate ? 'b' : 'r');
+   preempt_bit_t sched = preempt.end_bit(elapsed_mus * 1000);
+   if (sched.late > 0 || sched.descheduled)
+      lprintf("[Lambda-%3d] Preemption phase %d bit %d: %d of %d samples late by %ld mus in all (max %ld mus), %lu switches, run delay %lu mus%s\n",
+         id, phase, round, sched.late, sched.samples, sched.stalled_ns / 1000, sched.max_gap_ns / 1000, sched.switches,
+         sched.run_delay_ns / 1000, sched.descheduled ? " (bit erased)" : "");
+   if (erased)    *erased = sched.descheduled;
+
    if (calibrate) {
       memcpy(base_readings, samples, count * sizeof(samples[0]));
       base_readings_len = count;
 
       /* Sort the base sample so we don't have to do it every time */
-      timSort(base_readings, base_readings_len);
+      sort_latencies(base_readings, base_readings_len);
+      ks_engine.set_baseline(base_readings, base_readings_len);
+      ks_engine.reserve(MAX_SAMPLES);
+      if (use_sprt && !sprt.set_baseline(base_readings, base_readings_len))
+         lprintf("SPRT disabled: baseline cannot separate p0=%.3f from the expected p1\n", sprt.get_p0());
       return 0;   //not used
    }
 
-   *ksvalue = kstest_mean(base_readings, base_readings_len, true, samples, count, false);
-   if(*ksvalue >= DEFAULT_KS_MEAN_CUTOFF) {
+   int sprt_decision, sprt_samples;
+   double ksmax;
+   int window_size = count;
+   int64_t decision_mus = elapsed_mus;
+   if (pipelined) {
+      /* Analysis thread has kept up with the samples; this only waits for the last few */
+      bit_result_t result = bit_analyzer.end_bit();
+      *ksvalue = result.ksvalue;
+      ksmax = result.ksmax;
+      window_size = result.samples;        /* less than count if the ring dropped any */
+      sprt_decision = result.sprt_decision;
+      sprt_samples = result.sprt_samples;
+      if (result.decision_tsc)   decision_mus = cycles_to_ns(result.decision_tsc - bit_start_tsc) / 1000;
+   }
+   else {
+      *ksvalue = ks_engine.statistic();
+      ksmax = ks_engine.max_distance();
+      sprt_decision = sprt.get_decision();
+      sprt_samples = sprt.get_samples();
+   }
+   double pvalue = ks_pvalue(ks_engine.baseline_size(), window_size, ksmax);
+   int bit = use_pvalue ? pvalue < ks_alpha : *ksvalue >= ks_cutoff;
+   std::string counters = use_perf && perf.is_open() ? ", " + perf.format(perf_windows.back()) : "";
+   lprintf("[Lambda-%3d] KS phase %d bit %d: mean %.3lf, D %.4lf, p-value %.3g (%d vs %d samples)%s\n", 
+      id, phase, round, *ksvalue, ksmax, pvalue, window_size, ks_engine.baseline_size(), counters.c_str());
+
+   /* Sequential decision wins if it was made; else fall back to KS over the whole interval */
+   if (sequential) {
+      if (sprt_decision >= 0) {
+         bit = sprt_decision;
+         sprt_decided_bits++;
+         sprt_decision_mus_total += decision_mus;
+      }
+      else
+         sprt_undecided_bits++;
+      lprintf("[Lambda-%3d] SPRT phase %d bit %d: read %d after %d samples, %ld mus (decided: %d)\n", 
+         id, phase, round, bit, sprt_samples, decision_mus, sprt_decision >= 0);
+   }
+
+   /* Too much of the bit went to the scheduler to trust the read: it stands (the samples we
+    * did get are the best guess there is) but goes to the protocol as an erasure */
+   trace.add(TRACE_BIT_READ, tsc_now(), bit, phase, round, sched.descheduled ? TRACE_DESCHEDULED : 0);
+
+   if(bit) {
       if (save_samples && bit1_readings_len == 0){
          memcpy(bit1_readings, samples, count * sizeof(samples[0]));
          bit1_readings_len = count;
@@ -357,38 +477,38 @@ int read_bit(uint64_t* addr, microseconds release_time_mus, int bit_duration_sec
       } 
    }
 
-   return *ksvalue >= DEFAULT_KS_MEAN_CUTOFF;        /* Need to figure out the threshold that works for current platform */
+   return bit;
 }
 
 /* Causes membus locking contention until a certain time */
 void write_bit(uint64_t* addr, microseconds release_time_mus)
 {
-   int i;
-   microseconds ten_ms = microseconds(10000);
-
-   /* Checking time takes order of micro-seconds, so do it sparesely to not affect contention-causing.
-   * assuming each locking op costs few microseconds, check time every few hundred microseconds
-   * Release a bit early to avoid overruns */
-   release_time_mus -= ten_ms;
-   while (within_time(release_time_mus))
-   {   
-      /* atomic sum of cacheline boundary */
-      for (i = 0; i < 1000; i++)
-            __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
-   }
+   microseconds guard = microseconds(BIT_GUARD_MUS);
+
+   /* Checking the deadline is a single RDTSC, far cheaper than a locked op, so check it after every op 
+   * and stop right at the release time instead of up to a batch of ops later.
+   * Release a bit early to avoid overruns (same guard as read_bit so readers don't sample after we stop) */
+   release_time_mus -= guard;
+   TscDeadline release(release_time_mus.count());
+   if (use_perf)     perf.begin();
+   while (release.pending())
+      __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);       /* atomic sum of cacheline boundary */
+   if (use_perf)     record_perf_window('w');
 }
 
 /* Execute the info exchange protocol where all participating lambdas on a same machine
 * learn the id of one (max-id) lambda in each phase. Runs till all lambdas know each 
 * other or for a specified number of phases
 * If repeat_phases is true, protocol repeats the first phase i.e., in every phase all 
-* lambdas try to agree on the same max lambda id  */
-result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_phases, int max_bits_in_id, int bit_duration_secs, uint64_t* cacheline_addr, bool repeat_phases, double* time_secs)
+* lambdas try to agree on the same max lambda id  
+* Bit slots may be sub-second; all participants must be given the same bit duration. */
+result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_phases, int max_bits_in_id, int bit_duration_mus, uint64_t* cacheline_addr, bool repeat_phases, double* time_secs)
 {
    double pvalue;
 
    std::clock_t protocol_start, protocol_end;
-   microseconds bit_duration = microseconds(bit_duration_secs * MUS_PER_SEC);
+   microseconds bit_duration = microseconds(bit_duration_mus);
+   microseconds baseline_duration = std::max(bit_duration, microseconds(MUS_PER_SEC));    /* Keep the baseline large with short bits */
    microseconds five_ms = microseconds(5000);
    microseconds ten_ms = microseconds(10000);
    microseconds phase_duration = bit_duration * max_bits_in_id;
@@ -396,7 +516,7 @@ result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_ph
    result->num_phases = 0;
 
    // Sync with other lambdas a few milliseconds early
-   if (poll_wait(start_time_mus - ten_ms)){
+   if (poll_wait(start_time_mus - ten_ms, sleep_margin_mus)){
       lprintf("ERROR! Already past the intitial sync point, bad run for current lambda.\n");
       return result;
    }
@@ -405,67 +525,73 @@ result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_ph
    microseconds begin = duration_cast<microseconds>(Clock::now().time_since_epoch());
 
    /* Calibrate baseline latencies (when no contention) */
-   microseconds next_time_mus = start_time_mus + bit_duration;
-   read_bit(cacheline_addr, next_time_mus - ten_ms, bit_duration_secs, true, my_id, 0, 0, &pvalue);
+   LatencySampler sampler;
+   lprintf("TSC sampling overhead: %lu cycles\n", sampler.measure_overhead());
+   microseconds next_time_mus = start_time_mus + baseline_duration;
+   read_bit(cacheline_addr, next_time_mus - ten_ms, baseline_duration.count(), true, my_id, 0, 0, &pvalue, NULL);
+
+   /* Keep sampling on this thread (pinned to one CPU) and move per-bit statistics to another 
+    * core if we have one. Baseline must be set before the analysis thread takes over. The
+    * scope stops the thread and unpins us however we leave. */
+   AnalyzerScope pipeline(bit_analyzer, use_pipeline);
+   analysis_cpu = pipeline.get_analysis_cpu();
+   if (pipeline.is_active()) {
+      lprintf("Pipelined sampling: sampler on CPU %d (pinned: %d), analysis on CPU %d\n", pipeline.get_sampler_cpu(), 
+         pipeline.is_pinned(), analysis_cpu);
+   }
+   else if (use_pipeline) {
+      lprintf("Pipelined sampling off: no CPU outside the sampler's core\n");
+   }
 
    /* Start protocol phases */
-   bool advertised = false;
+   MembusProtocol protocol(my_id, max_phases, max_bits_in_id, repeat_phases);
    lprintf("[Lambda-%3d] Phase, Position, Bit, Sent, Read, Lat Size, Lat Mean, Lat Std, Lat Max, Lat Min, Base Size, Base Mean, Base Std, KSValue\n", my_id);
 
-   for (int phase = 0; phase < max_phases; phase++) {
-      bool advertising = !advertised;
-      int id_read = 0;
-
-      for (int bit_pos = max_bits_in_id - 1; bit_pos >= 0; bit_pos--) {
-            bool my_bit = my_id & (1 << bit_pos);
-            int bit_read;
-
-            poll_wait(next_time_mus);
-            next_time_mus += bit_duration;
-            // if (my_id % 2)   next_time_mus += five_ms;
-
-            if (advertising && my_bit) {
-               write_bit(cacheline_addr, next_time_mus - ten_ms);      // Write until 10ms before next interval
-               bit_read = 1;                                           // When writing a bit, assume that bit read is one.
-            }
-            else {
-               bit_read = read_bit(cacheline_addr, next_time_mus - ten_ms, bit_duration_secs, false, my_id, phase, bit_pos, &pvalue);
-            }
-
-            /* Stop advertising if my bit is 0 and bit read is 1 i.e., someone else has higher id than mine */
-            if (advertising && !my_bit && bit_read)
-               advertising = false;
-
-            id_read = (2 * id_read) + bit_read;     // We get bits in most to least significant order
-
-            /* CAUTION: Below print statement is used in log analysis, changing format may break post-experiment analysis scripts */
-            // lprintf("[Lambda-%3d] %3d %9d %4d %5d %5d %9d %9lu %8lu %8lu %8lu %10d %10lu %9lu %2.15f\n", 
-            //    my_id, phase, bit_pos, my_bit, advertising && my_bit, bit_read, 
-            //    last_sample.size,
-            //    advertising && my_bit ? 0 : last_sample.mean, 
-            //    advertising && my_bit ? 0 : (long) sqrt(last_sample.variance), 
-            //    advertising && my_bit ? 0 : last_sample.max, 
-            //    advertising && my_bit ? 0 : last_sample.min, 
-            //    base_sample.size, base_sample.mean, (long) sqrt(base_sample.variance), pvalue);              /** COMMENT OUT IN REAL RUNS **/
+   while (!protocol.done()) {
+      int phase = protocol.get_phase();
+      int bit_pos = protocol.get_bit_pos();
+      bool writing = protocol.writing();
+      int bit_read;
+      bool erased = false;
+
+      poll_wait(next_time_mus, sleep_margin_mus);
+      next_time_mus += bit_duration;
+      // if (my_id % 2)   next_time_mus += five_ms;
+
+      if (writing) {
+         write_bit(cacheline_addr, next_time_mus - ten_ms);      // Write until 10ms before next interval
+         bit_read = 1;                                           // When writing a bit, assume that bit read is one.
+         trace.add(TRACE_BIT_WRITTEN, tsc_now(), 1, phase, bit_pos, 0);
+      }
+      else {
+         bit_read = read_bit(cacheline_addr, next_time_mus - ten_ms, bit_duration_mus, false, my_id, phase, bit_pos, &pvalue, &erased);
       }
 
-      lprintf("[Lambda-%d] Phase %d, Id read: %d\n", my_id, phase, id_read);      /** COMMENT OUT IN REAL RUNS **/
-
-      if (id_read == 0)               // End of protocol
-            break;
-
-      result->ids[result->num_phases] = id_read;
-      result->num_phases++;
-
-      if (!repeat_phases && id_read == my_id)           // My part is done, I will just listen from now on.
-            advertised = true;
+      /* CAUTION: Below print statement is used in log analysis, changing format may break post-experiment analysis scripts */
+      // lprintf("[Lambda-%3d] %3d %9d %4d %5d %5d %9d %9lu %8lu %8lu %8lu %10d %10lu %9lu %2.15f\n", 
+      //    my_id, phase, bit_pos, protocol.my_bit(), writing, bit_read, 
+      //    last_sample.size,
+      //    writing ? 0 : last_sample.mean, 
+      //    writing ? 0 : (long) sqrt(last_sample.variance), 
+      //    writing ? 0 : last_sample.max, 
+      //    writing ? 0 : last_sample.min, 
+      //    base_sample.size, base_sample.mean, (long) sqrt(base_sample.variance), pvalue);              /** COMMENT OUT IN REAL RUNS **/
+
+      /* Advertising/withdrawal and id assembly are in MembusProtocol, shared with the simulator */
+      if (protocol.bit_done(bit_read, erased))
+         lprintf("[Lambda-%d] Phase %d, Id read: %d\n", my_id, phase, protocol.get_id_read());      /** COMMENT OUT IN REAL RUNS **/
    }
+   *result = protocol.get_result();
 
    /* Record end timestamp */
    microseconds end = duration_cast<microseconds>(Clock::now().time_since_epoch());
    *time_secs = (end - begin).count() * 1.0 / MUS_PER_SEC;
    lprintf("The protocol ran for %.2lf seconds.\n", *time_secs);
 
+   if (pipeline.finish()) {
+      lprintf("Analysis ring drops: %lu\n", bit_analyzer.get_drops());
+   }
+
    return result;
 }
 
@@ -484,6 +610,12 @@ result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_ph
 #define ATOMIC_OPS_LATENCY_WITH_LOCKING_THRESHOLD     10500
 #define ATOMIC_OPS_LATENCY_WITH_LOCKING_MAX           20000       // anything above this number is a silly outlier caused due to context switching, etc
 
+/* Converts a cycle count measured on a host with the given TSC rate to cycles on this host.
+ * The cycle counts above are used as is: the TSC rate they were tuned at was not recorded. */
+inline uint64_t scale_cycles(uint64_t cycles, double from_mhz) {
+   return tsc_mhz > 0 && from_mhz > 0 ? (uint64_t) (cycles * tsc_mhz / from_mhz) : cycles;
+}
+
 
 /* Takes a large sized buffer, performs a number of random accesses 
    and reports the time (randomized to increase the possiblity of a cache miss).
@@ -492,17 +624,14 @@ result_t* run_membus_protocol(int my_id, microseconds start_time_mus, int max_ph
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 uint64_t perform_random_access(void* buffer, size_t buf_size, int num_accesses) {         // TODO: Inline it?
-   uint64_t src = 100, rand, start, end;
-   rdtsc();
+   uint64_t src = 100, rand;
+   LatencySampler sampler;
+   sampler.start();
    for(int i = 0; i < num_accesses; i++) {
       rand = rand_xorshf96() % buf_size;
       memcpy(buffer + rand, &src, sizeof(uint64_t));
    }
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   return (end - start);
+   return sampler.stop();
 }
 #pragma GCC pop_options
 
@@ -511,51 +640,55 @@ uint64_t perform_random_access(void* buffer, size_t buf_size, int num_accesses)
    NOTE: It seems like the GCC optimization options are important to properly measure time
  */
 inline uint64_t perform_exotic_ops(uint64_t* cacheline_addr, int num_accesses) {
-   uint64_t start, end;
-   rdtsc();
+   LatencySampler sampler;
+   sampler.start();
    for (int i = 0; i < ATOMIC_OPS_BATCH_SIZE; i++)
       __atomic_fetch_add(cacheline_addr, 1, __ATOMIC_SEQ_CST);
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   return (end - start);
+   return sampler.stop();
 }
 
 /* Send a data segment; returns number of erasures detected  */
 int send_data(std::vector<bool> data, int nbits, int bit_interval_mus, microseconds start_time_mus, uint64_t* cacheline_addr, void* big_buffer, size_t big_buf_size, int threshold) {
    microseconds bit_start_mus, bit_end_mus;
    int num_erasures, erasures[nbits];
-   uint64_t start, end, access_cycles, access_count, access_avg, access_thresh, cycles;
+   uint64_t access_cycles, access_count, access_avg, access_thresh, cycles;
 
    /* Wait till the startpoint */
    microseconds one_ms = microseconds(1000);
-   if (poll_wait(start_time_mus - one_ms)){
+   if (poll_wait(start_time_mus - one_ms, sleep_margin_mus)){
       lprintf("ERROR! Already past the start point for covert channel data.\n");
       return 1;
    }
 
    num_erasures = 0;
-   lprintf("Sending bits.. bit interval=%d mus, threshold=%d\n", bit_interval_mus, threshold);
+   uint64_t outlier_cycles = ATOMIC_OPS_LATENCY_WITH_LOCKING_MAX;
+   lprintf("Sending bits.. bit interval=%d mus, threshold=%d cycles (%.0lf ns)\n", bit_interval_mus, threshold, cycles_to_ns(threshold));
    for(int bit_idx = 0; bit_idx < nbits; bit_idx++) { 
       bit_start_mus = start_time_mus + microseconds(bit_idx * bit_interval_mus);
       bit_end_mus = bit_start_mus + microseconds(bit_interval_mus);
 
-      /* Checking time takes order of micro-seconds, so do it sparesely to not affect contention-causing.
-      * assuming each locking op costs few microseconds, check time every few hundred microseconds
+      /* Deadline checks are an RDTSC each, cheap enough to do after every batch of ops.
       * Release a bit early to avoid overruns */
       microseconds ten_mus = microseconds(10);
       bit_end_mus -= ten_mus;
+      TscDeadline bit_end(bit_end_mus.count());
       access_cycles = 0;
       access_count = 0;
       bit0_readings_len = 0;     /* FIXME: I'm reusing NDP sample buffers to save channel samples as well, fix it! */
       base_readings_len = 0;
-      while (within_time(bit_end_mus))
+      preempt.begin_bit(false);     /* Bits are too short for syscalls; gaps between batches show stalls */
+      uint64_t due = 0;
+      while (bit_end.pending())
       {  
+         uint64_t now = tsc_now();
+         preempt.sample(now, due);
+         due = now;
+
          /* if 1 bit, lock the mem bus using atomic ops; else, perform regular memory accesses */
          if (data[bit_idx]){
             cycles = perform_exotic_ops(cacheline_addr, ATOMIC_OPS_BATCH_SIZE);
-            if (cycles / ATOMIC_OPS_BATCH_SIZE > ATOMIC_OPS_LATENCY_WITH_LOCKING_MAX)  continue;
+            due = now + cycles;
+            if (cycles / ATOMIC_OPS_BATCH_SIZE > outlier_cycles)  continue;
             access_cycles += cycles;
             if(bit0_readings_len < MAX_SAMPLES)    bit0_readings[bit0_readings_len++] = cycles / ATOMIC_OPS_BATCH_SIZE;
          }
@@ -569,12 +702,15 @@ int send_data(std::vector<bool> data, int nbits, int bit_interval_mus, microseco
          access_count += ATOMIC_OPS_BATCH_SIZE;
       }
 
+      preempt_bit_t sched = preempt.end_bit(bit_interval_mus * 1000LL);
+
       if (!data[bit_idx])
          continue;
 
       if (access_count == 0) {
          /* We are past the time for this bit, perhaps the sender was descheduled */
          erasures[num_erasures++] = bit_idx;
+         erasures_descheduled++;
          continue;
       }
       access_avg = access_cycles / access_count;
@@ -582,8 +718,10 @@ int send_data(std::vector<bool> data, int nbits, int bit_interval_mus, microseco
 
       // if access less then threshold, its an erasure
       if (access_avg < threshold) {
-         /* Receiver was not listening during this time */
+         /* Receiver was not listening during this time, unless we weren't running for much of it */
          erasures[num_erasures++] = bit_idx;
+         if (sched.descheduled)     erasures_descheduled++;
+         else                       erasures_absent++;
       }
    }
 
@@ -598,41 +736,51 @@ int send_data(std::vector<bool> data, int nbits, int bit_interval_mus, microseco
 int receive_data(std::vector<bool>* data, int nbits, int bit_interval_mus, microseconds start_time_mus, uint64_t* cacheline_addr, int threshold) {
    microseconds bit_start_mus, bit_end_mus;
    int num_erasures, erasures[nbits];
-   uint64_t start, end, access_cycles, access_count, access_avg, cycles;
+   uint64_t access_cycles, access_count, access_avg, cycles;
 
    /* Wait till the startpoint */
    microseconds one_ms = microseconds(1000);
-   if (poll_wait(start_time_mus - one_ms)){
+   if (poll_wait(start_time_mus - one_ms, sleep_margin_mus)){
       printf("ERROR! Already past the start point for covert channel data.\n");
       return 1;
    }
 
    num_erasures = 0;
-   lprintf("Receiving bits.. bit interval=%d mus, threshold=%d\n", bit_interval_mus, threshold);
+   lprintf("Receiving bits.. bit interval=%d mus, threshold=%d cycles (%.0lf ns)\n", bit_interval_mus, threshold, cycles_to_ns(threshold));
    for(int bit_idx = 0; bit_idx < nbits; bit_idx++) { 
       bit_start_mus = start_time_mus + microseconds(bit_idx * bit_interval_mus);
       bit_end_mus = bit_start_mus + microseconds(bit_interval_mus);
 
-      /* Checking time takes order of micro-seconds, so do it sparesely to not affect contention-causing.
-      * assuming each locking op costs few microseconds, check time every few hundred microseconds
+      /* Deadline checks are an RDTSC each, cheap enough to do after every batch of ops.
       * Release a bit early to avoid overruns */
       microseconds ten_mus = microseconds(10);
       bit_end_mus -= ten_mus;
+      TscDeadline bit_end(bit_end_mus.count());
       access_cycles = 0;
       access_count = 0;
       bit1_readings_len = 0;     /* FIXME: I'm reusing NDP sample buffers to save channel samples as well, fix it! */
-      while (within_time(bit_end_mus))
+      preempt.begin_bit(false);     /* Bits are too short for syscalls; gaps between batches show stalls */
+      if (use_perf)     perf.begin();
+      uint64_t due = 0;
+      while (bit_end.pending())
       {  
          /* receiver just performs exotic ops */
+         uint64_t now = tsc_now();
+         preempt.sample(now, due);
          cycles = perform_exotic_ops(cacheline_addr, ATOMIC_OPS_BATCH_SIZE);
+         due = now + cycles;
          access_cycles += cycles;
          if(bit1_readings_len < MAX_SAMPLES)    bit1_readings[bit1_readings_len++] = cycles / ATOMIC_OPS_BATCH_SIZE;
          access_count += ATOMIC_OPS_BATCH_SIZE;
       }
 
-      if (access_count == 0) {
-         /* We are past the time for this bit, perhaps the receiver was descheduled */
+      preempt_bit_t sched = preempt.end_bit(bit_interval_mus * 1000LL);
+      if (use_perf)     record_perf_window('c');
+
+      /* We are past the time for this bit, or spent too much of it off CPU; either way, we were descheduled */
+      if (access_count == 0 || sched.descheduled) {
          erasures[num_erasures++] = bit_idx;
+         erasures_descheduled++;
          data->push_back(false);
          continue;
       }
@@ -726,30 +874,85 @@ std::string get_ipaddr(void) {
    }
 }
 
-/* Performs a CPU-bound operation and gets time taken for the operation. (A measure of how much CPU the process is getting...)
+/* Performs a CPU-bound operation and gets the TSC cycles it takes per iteration: the 
+ * fastest of a few short rounds, so a round that got preempted does not count. How much
+ * CPU we are getting shows in the preemption stats (Run Delay, Involuntary Switches).
  * Turn off GCC optimizations for this piece of code as to avoid any funky changes to the CPU operation.
  */
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 double get_cpu_cycles_per_operation() {
-   int TIMES = 1e8;
-   uint64_t x = 0, start, end;
+   uint64_t x = 0, cycles, best = UINT64_MAX;
+   LatencySampler sampler;
    microseconds begin_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
 
-   rdtsc();
-   for(int i = 0; i < TIMES; i++)  x += i;
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
+   for (int r = 0; r < CPI_ROUNDS; r++) {
+      sampler.start();
+      for(int i = 0; i < CPI_ROUND_ITERATIONS; i++)  x += i;
+      cycles = sampler.stop();
+      if (cycles < best)   best = cycles;
+   }
        
    microseconds end_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
-   lprintf("Calculating CPU CPI took %.2lf seconds\n", (end_time - begin_time).count() * 1.0 / MUS_PER_SEC);
+   lprintf("Calculating CPU CPI took %.2lf ms\n", (end_time - begin_time).count() * 1.0 / 1000);
 
-   return (end - start) * 1.0 / TIMES;
+   return best * 1.0 / CPI_ROUND_ITERATIONS;
 }
 #pragma GCC pop_options
 
+/* Host characterization, kept across warm invocations (globals survive them) and redone
+ * when the boot id changes, i.e. the sandbox now runs on another host or VM, or when a
+ * request asks for it ("refresh_host") */
+typedef struct {
+   bool valid;
+   std::string boot_id;
+   std::string mac_addrs;
+   std::string ip_addr;
+   double cpu_cpi;
+   uint64_t* cacheline_addr;        /* Address straddling two cache lines, for the membus accesses */
+   uint64_t* probe_buffer;          /* Array it lives in */
+   double profile_ms;               /* How long characterizing the host took */
+} host_profile_t;
+host_profile_t host = { false, "", "", "", 0, NULL, NULL, 0 };
+
+std::string read_boot_id() {
+   std::ifstream ifs("/proc/sys/kernel/random/boot_id");
+   std::string boot_id;
+   std::getline(ifs, boot_id);
+   return boot_id;
+}
+
+void invalidate_host_profile() {
+   free(host.probe_buffer);
+   host.probe_buffer = NULL;
+   host.cacheline_addr = NULL;
+   host.valid = false;
+   tsc_mhz = 0;                     /* Another host may have another TSC rate */
+}
+
+/* Returns true if the cached profile was used */
+bool load_host_profile(bool refresh) {
+   std::string boot_id = read_boot_id();
+   if (host.valid && !refresh && boot_id == host.boot_id)
+      return true;
+
+   if (host.valid) {
+      lprintf("Characterizing host again (%s)\n", refresh ? "requested" : "boot id changed");
+   }
+   invalidate_host_profile();
+   microseconds begin_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
+   tsc_calibrate();
+   host.boot_id = boot_id;
+   host.mac_addrs = get_mac_addrs();
+   host.ip_addr = get_ipaddr();
+   host.cpu_cpi = get_cpu_cycles_per_operation();
+   host.cacheline_addr = get_cache_line_straddled_address(&host.probe_buffer);
+   microseconds end_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
+   host.profile_ms = (end_time - begin_time).count() / 1000.0;
+   host.valid = host.cacheline_addr != NULL;      /* Try again next time if it failed */
+   return false;
+}
+
 /* Get current date/time, format is YYYY-MM-DD.HH:mm:ss */
 const std::string current_datetime() {
    time_t     now = time(0);
@@ -760,35 +963,23 @@ const std::string current_datetime() {
    return buf;
 }
 
-/* Write a string to S3 bucket */
-bool write_to_s3(Aws::S3::S3Client const& client, std::string const& bucket, std::string const& key, std::string data) {
-   Aws::S3::Model::PutObjectRequest request;
-   request.SetBucket(bucket);
-   request.SetKey(key);
-
-   const std::shared_ptr<Aws::IOStream> input_data = Aws::MakeShared<Aws::StringStream>("");
-   *input_data << data.c_str();
-   request.SetBody(input_data);
-
-   // Write to S3 and return result
-   try {
-      Aws::S3::Model::PutObjectOutcome outcome = client.PutObject(request);
-      if (outcome.IsSuccess()) {   
-         lprintf("Added object %s to s3 bucket %s\n", key.c_str(), bucket.c_str());
-         return true;
-      }
-      else {
-         lprintf("Error adding object %s to s3 bucket %s: %s\n", key.c_str(), bucket.c_str(), 
-            outcome.GetError().GetMessage().c_str());
-         return false;
-      }
+/* Log how an upload went (once it has finished, see S3Uploader) */
+void log_upload(const upload_result_t& upload) {
+   if (upload.ok) {
+      lprintf("Added object %s to s3 bucket %s (%lu bytes, %d parts, %d attempts, %.1lf ms)\n", upload.key.c_str(), 
+         upload.bucket.c_str(), upload.bytes, upload.parts, upload.attempts, upload.ms);
    }
-   catch (std::exception e){
-      lprintf("Exception saving to S3: %s", e.what());
-      return false;
+   else {
+      lprintf("Error adding object %s to s3 bucket %s: %s\n", upload.key.c_str(), upload.bucket.c_str(), upload.error.c_str());
    }
+}
 
-   return true;
+/* Sample array in the requested encoding: "1203,1188,..." or base64 zigzag-delta varints */
+void write_samples(JsonWriter& body, const char* key, const int64_t* values, int n) {
+   if (encoding == ENCODING_DELTA_VARINT)
+      body.field(key, encode_samples(values, n));
+   else
+      body.key(key).value_list(values, n);
 }
 
 /************************** MAIN ENTRY ******************************************************/
@@ -797,15 +988,28 @@ invocation_response my_handler(invocation_request const& request, const std::sha
    const Aws::Client::ClientConfiguration& config)
 {
    std::string start_time = current_datetime();
-   int id, max_phases, max_bits, bit_duration_secs;
-   long start_time_secs;
-   bool success = true, sysinfo, return_data, setup_channel, repeat_phases;
+   /* Defaults are those of the request fields below, so a request that fails to parse leaves nothing unset */
+   int id = 0, max_phases = 1, max_bits = 8, bit_duration_secs = 1, bit_duration_ms = 0;
+   double sprt_alpha = DEFAULT_SPRT_ALPHA, sprt_beta = DEFAULT_SPRT_BETA, sprt_p1 = DEFAULT_SPRT_P1, sprt_quantile = DEFAULT_SPRT_QUANTILE;
+   long start_time_secs = 0;
+   bool success = true, sysinfo = false, return_data = false, setup_channel = false, repeat_phases = true;
    std::string error, s3bucket, s3key, guid, chdata;
    result_t* result = NULL;
    double protocol_time = 0;
-   int erasures, num_bits, sender_id, receiver_id, rate_bps, access_threshold, chdatalen;
+   int erasures = 0, num_bits = 0, sender_id = 0, receiver_id = 0;
+   int rate_bps = 1000000/CHANNEL_BIT_INTERVAL_MUS, access_threshold = ATOMIC_OPS_LATENCY_WITH_LOCKING_THRESHOLD;
+   int access_threshold_ns = 0, chdatalen = 0;
    bool channel_created = false;
    std::vector<bool> data;
+   double access_threshold_mhz = 0;
+   bool monitor_mode = false;
+   bool use_trace = false;
+   bool refresh_host = false;
+   int trace_records = DEFAULT_TRACE_RECORDS;
+   int monitor_secs = 0;
+   monitor_config_t monitor_config = monitor_default_config();
+   monitor_stats_t monitor_stats;
+   std::vector<monitor_event_t> monitor_events;
 
    AWS_LOGSTREAM_INFO(TAG, "Start");
 
@@ -816,29 +1020,59 @@ invocation_response my_handler(invocation_request const& request, const std::sha
 
    /* Parse request body for arguments */
    try {     
-      RSJresource body(request.payload);
+      if (!request_json.parse(request.payload))
+         throw std::runtime_error("malformed request");
+      JsonValue body = request_json.root();
       if (body["body"].exists()) {
          // See if body is nested in payload
-         std::string escaped_body = body["body"].as<std::string>("");
-         body = RSJresource(util::unescape_json(escaped_body));
+         nested_body = body["body"].as<std::string>("");
+         if (!nested_json.parse(nested_body))
+            throw std::runtime_error("malformed request body");
+         body = nested_json.root();
       }
       id = body["id"].as<int>(0);
       start_time_secs = body["stime"].as<int>(0);
       log_ = body["log"].as<bool>(false);                   // include logs in response  
+      log_budget = body["log_budget"].as<int>(DEFAULT_LOG_BUDGET_BYTES);      // formatted logs in the response are cut off past this many bytes
       save_samples = body["samples"].as<bool>(false);       // include a sample of latencies in response
+      encoding_name_req = body["encoding"].as<std::string>("decimal");   // "delta-varint": samples and channel data as base64 zigzag-delta varints/packed bits (see samplecodec.h)
       max_phases = body["phases"].as<int>(1);               // run 1 phase by default
       repeat_phases = body["repeat_phases"].as<int>(true);  // repeat phases by default (i.e., always run the "first iteration" of the protocol advertising the max id)
       max_bits = body["maxbits"].as<int>(8);                // Assume maximum of 8 bits in ID by default
       bit_duration_secs = body["bitduration"].as<int>(1);   // takes 1 second for communicating each bit by default. phases*maxbits*bitduration gives total time
+      bit_duration_ms = body["bitduration_ms"].as<int>(0);  // sub-second bit slots; overrides bitduration if provided (must be the same for all lambdas)
+      samples_per_second = body["samplerate"].as<int>(SAMPLES_PER_SECOND);     // membus latency samples per second while reading a bit
+      use_sprt = body["sprt"].as<bool>(false);              // decide bits early with a sequential probability ratio test
+      sprt_alpha = body["sprt_alpha"].as<double>(DEFAULT_SPRT_ALPHA);          // SPRT false-positive (0 read as 1) rate
+      sprt_beta = body["sprt_beta"].as<double>(DEFAULT_SPRT_BETA);             // SPRT false-negative (1 read as 0) rate
+      sprt_p1 = body["sprt_p1"].as<double>(DEFAULT_SPRT_P1);                   // SPRT: fraction of samples above baseline quantile under contention
+      sprt_quantile = body["sprt_quantile"].as<double>(DEFAULT_SPRT_QUANTILE); // SPRT: baseline quantile to compare samples against
+      use_pvalue = body["ks_decision"].as<std::string>("cutoff") == "pvalue";   // decide bits on KS p-value ("pvalue") or the mean statistic ("cutoff")
+      ks_alpha = body["ks_alpha"].as<double>(DEFAULT_KS_ALPHA);               // target false-positive rate for p-value decisions
+      ks_cutoff = body["ks_cutoff"].as<double>(0);         // cutoff on the mean statistic (default: DEFAULT_KS_MEAN_CUTOFF scaled to the sampling rate)
+      use_pipeline = body["pipeline"].as<bool>(true);       // run per-bit statistics on a second CPU when there is one
+      preempt.set_enabled(body["preempt_filter"].as<bool>(false));  // erase bits read while descheduled
+      use_perf = body["perf"].as<bool>(false);              // read hardware counters (where available) over every bit window
+      use_trace = body["trace"].as<bool>(false);            // record every sample and bit decision to a binary trace (stored next to the result on S3)
+      trace_records = body["trace_records"].as<int>(DEFAULT_TRACE_RECORDS);   // trace capacity; later records are counted, not kept
+      sleep_margin_mus = body["sleep_margin_us"].as<int>(DEFAULT_SLEEP_MARGIN_MUS);  // sync waits sleep till this close to the deadline (0 to always spin)
       return_data = body["return_data"].as<bool>(false);    // return data in API response. Stored to S3 by default.
+      refresh_host = body["refresh_host"].as<bool>(false);  // characterize the host again even if the boot id has not changed
       s3bucket = body["s3bucket"].as<std::string>("");      // s3 bucket
       s3key = body["s3key"].as<std::string>("");            // s3 key
       guid = body["guid"].as<std::string>("");              // globally unique id for this lambda (across experiments)
       setup_channel = body["channel"].as<bool>(false);      // setup covert channel and measure its bandwidth after identifying neighbors 
       rate_bps = body["rate"].as<int>(1000000/CHANNEL_BIT_INTERVAL_MUS);      // covert channel rate. default is 1000 bps
-      access_threshold = body["threshold"].as<int>(ATOMIC_OPS_LATENCY_WITH_LOCKING_THRESHOLD);      // threshold at which we call a received bit a 1 or 0
+      access_threshold = body["threshold"].as<int>(ATOMIC_OPS_LATENCY_WITH_LOCKING_THRESHOLD);      // threshold at which we call a received bit a 1 or 0 (in cycles)
+      access_threshold_mhz = body["threshold_mhz"].as<double>(0);  // TSC rate (MHz) "threshold" was measured at; if given, it is scaled to this host's rate
+      access_threshold_ns = body["threshold_ns"].as<int>(0);       // same threshold in nanoseconds; overrides "threshold" if provided
       chdata = body["data"].as<std::string>("");            // custom data to send on the covert channel
       chdatalen = body["datalen"].as<int>(0);               // length of custom data (IN BITS) to send on the covert channel
+      monitor_mode = body["mode"].as<std::string>("protocol") == "monitor";   // "monitor": watch for memory-bus noisy neighbors instead of running the protocol
+      monitor_secs = body["monitor_secs"].as<int>(60);      // how long to monitor
+      monitor_config.cpu_budget = body["cpu_budget"].as<double>(monitor_config.cpu_budget);   // fraction of a CPU the monitor may use
+      monitor_config.window_ms = body["window_ms"].as<int>(monitor_config.window_ms);         // monitor decision window
+      monitor_config.alpha = body["monitor_alpha"].as<double>(monitor_config.alpha);         // monitor windows are contended below this KS p-value (separate from ks_alpha)
    }
    catch(std::exception& e){
       success = false;
@@ -848,6 +1082,13 @@ invocation_response my_handler(invocation_request const& request, const std::sha
 
    lprintf("Starting lambda %d (GUID: %s) at %s", id, guid.c_str(), start_time.c_str());
    lambdas.push_back(guid);
+
+   /* TSC rate, CPI, addresses, ...: only change if we land on another host */
+   bool host_cached = load_host_profile(refresh_host);
+   lprintf("TSC frequency: %.1lf MHz (%s, invariant: %d)\n", tsc_mhz, tsc_mhz_source, tsc_is_invariant());
+
+   /* Thresholds given in ns, or in cycles at a known TSC rate, are converted to cycles on this host */
+   access_threshold = access_threshold_ns > 0 ? ns_to_cycles(access_threshold_ns) : scale_cycles(access_threshold, access_threshold_mhz);
  
    #if __cplusplus==201402L
    lprintf("C++14\n");
@@ -857,24 +1098,123 @@ invocation_response my_handler(invocation_request const& request, const std::sha
    lprintf("C++\n");
    #endif
 
-   // Test availability of s3 bucket
-   if (success && !s3bucket.empty()) { 
-      Aws::S3::S3Client client(credentialsProvider, config);
-      write_to_s3(client, s3bucket, "temp", "Some data..");
+   // Test availability of s3 bucket (on cold start only). Done before the protocol, not alongside it
+   uploader.configure(credentialsProvider, config);
+   upload_result_t bucket_check;
+   if (success && !s3bucket.empty() && uploader.check_bucket(s3bucket, &bucket_check)) { 
+      log_upload(bucket_check);
    }
 
-   if (success && id <= 0 || id >= (1<<max_bits)) {
+   if (success && !monitor_mode && (id <= 0 || id >= (1<<max_bits))) {
       success = false;
       error = "INVALID_ID";
       lprintf("Id is not provided or invalid (should be in [1, %d)\n", 1<<max_bits);
    }
 
-   if (success && (bit_duration_secs < 1  || bit_duration_secs > MAX_BIT_DURATION_SECS)) {
+   if (success && bit_duration_ms == 0 && (bit_duration_secs < 1  || bit_duration_secs > MAX_BIT_DURATION_SECS)) {
       success = false;
       error = "INVALID_BIT_DURATION";
       lprintf("Bit duration is invalid (should be in [1, %d]\n", MAX_BIT_DURATION_SECS);
    }
+
+   if (success && bit_duration_ms != 0 && (bit_duration_ms < MIN_BIT_DURATION_MS || bit_duration_ms > MAX_BIT_DURATION_SECS * 1000)) {
+      success = false;
+      error = "INVALID_BIT_DURATION";
+      lprintf("Bit duration (ms) is invalid (should be in [%d, %d]\n", MIN_BIT_DURATION_MS, MAX_BIT_DURATION_SECS * 1000);
+   }
+   int bit_duration_mus = bit_duration_ms != 0 ? bit_duration_ms * 1000 : bit_duration_secs * MUS_PER_SEC;
+
+   if (success && use_sprt && (sprt_alpha <= 0 || sprt_alpha >= 1 || sprt_beta <= 0 || sprt_beta >= 1 
+         || sprt_p1 <= 0 || sprt_p1 >= 1 || sprt_quantile < 0 || sprt_quantile >= 1)) {
+      success = false;
+      error = "INVALID_SPRT_PARAMS";
+      lprintf("SPRT error rates, p1 and quantile should all be in (0, 1)\n");
+   }
+   sprt.configure(sprt_alpha, sprt_beta, sprt_p1, sprt_quantile);
+   sprt_decided_bits = sprt_undecided_bits = 0;
+   sprt_decision_mus_total = 0;
+   analysis_cpu = -1;
      
+   if (success && (samples_per_second < 1 || samples_per_second > MAX_SAMPLES_PER_SECOND)) {
+      success = false;
+      error = "INVALID_SAMPLE_RATE";
+      lprintf("Sample rate is invalid (should be in [1, %d]\n", MAX_SAMPLES_PER_SECOND);
+   }
+
+   /* More samples per bit push the statistic up for the same contention */
+   if (success && ks_cutoff == 0)
+      ks_cutoff = ks_mean_cutoff(DEFAULT_KS_MEAN_CUTOFF, SAMPLES_PER_SECOND, samples_per_second);
+
+   if (success && (ks_alpha <= 0 || ks_alpha >= 1 || ks_cutoff <= 0)) {
+      success = false;
+      error = "INVALID_KS_PARAMS";
+      lprintf("KS alpha should be in (0, 1) and the cutoff positive\n");
+   }
+
+   if (success && sleep_margin_mus < 0) {
+      success = false;
+      error = "INVALID_SLEEP_MARGIN";
+      lprintf("Sleep margin must not be negative (0 to always spin)\n");
+   }
+   tsc_reset_wait_stats();
+   preempt.reset();
+   erasures_descheduled = erasures_absent = 0;
+
+   /* Counters stay open across invocations (they count this thread); inside Firecracker there is
+    * no PMU, so expect at most the software counters there */
+   perf_windows.clear();
+   perf_window_kinds.clear();
+   if (success && use_perf) {
+      /* One window per bit and the baseline, so the vectors don't grow between (1 ms) bits */
+      size_t windows = 1 + (size_t) std::min(std::max(max_phases, 0), MAX_PHASES) * std::min(std::max(max_bits, 0), 31);
+      if (setup_channel)
+         windows += chdatalen > 0 ? chdatalen : DEFAULT_CHANNEL_UPTIME_SECS * std::max(rate_bps, 0);
+      perf_windows.reserve(windows);
+      perf_window_kinds.reserve(windows);
+   }
+   if (use_perf && !perf.is_open()) {
+      perf.open();
+      lprintf("Perf counters: %s\n", perf.get_status().c_str());
+   }
+
+   if (success && !parse_encoding(encoding_name_req, &encoding)) {
+      success = false;
+      error = "INVALID_ENCODING";
+      lprintf("Unknown encoding %s (should be decimal or delta-varint)\n", encoding_name_req.c_str());
+   }
+
+   /* Trace lives in /tmp (the only writable place in a Lambda) and goes to S3 with the result */
+   if (success && use_trace && trace_records <= 0) {
+      success = false;
+      error = "INVALID_TRACE_PARAMS";
+      lprintf("Trace capacity must be positive\n");
+   }
+   if (success && use_trace && trace_records > MAX_TRACE_RECORDS) {
+      lprintf("Trace capacity cut to %d records (%d asked for) to fit in /tmp\n", MAX_TRACE_RECORDS, trace_records);
+      trace_records = MAX_TRACE_RECORDS;
+   }
+   if (success && use_trace) {
+      std::string trace_path = "/tmp/membus-" + std::to_string(id) + ".trace";
+      if (!trace.open(trace_path.c_str(), trace_records)) {
+         lprintf("Could not create trace %s: %s\n", trace_path.c_str(), strerror(errno));
+      }
+      else {
+         trace_header_t* header = trace.get_header();
+         header->id = id;
+         header->samples_per_second = samples_per_second;
+         header->bit_duration_mus = bit_duration_mus;
+         header->use_pvalue = use_pvalue;
+         header->tsc_mhz = tsc_mhz;
+         header->ks_cutoff = ks_cutoff;
+         header->ks_alpha = ks_alpha;
+         header->use_sprt = use_sprt;
+         header->sprt_alpha = sprt_alpha;
+         header->sprt_beta = sprt_beta;
+         header->sprt_p1 = sprt_p1;
+         header->sprt_quantile = sprt_quantile;
+      }
+   }
+
    if (setup_channel && (repeat_phases || max_phases < 2)) {
       success = false;
       error = "INVALID_CHANNEL_PARAMS";
@@ -895,8 +1235,15 @@ invocation_response my_handler(invocation_request const& request, const std::sha
       success = false;
    }
 
+   if (success && monitor_mode && (monitor_secs < 1 || monitor_secs > MAX_MONITOR_SECS
+         || monitor_config.cpu_budget <= 0 || monitor_config.cpu_budget > 1 || monitor_config.window_ms < 10)) {
+      success = false;
+      error = "INVALID_MONITOR_PARAMS";
+      lprintf("Monitor duration should be in [1, %d] secs, CPU budget in (0, 1] and windows at least 10 ms\n", MAX_MONITOR_SECS);
+   }
+
    seconds now = duration_cast<seconds>(Clock::now().time_since_epoch());
-   if (success && start_time_secs <= now.count()) {    // Unix time in secs
+   if (success && !monitor_mode && start_time_secs <= now.count()) {    // Unix time in secs
       success = false;
       error = "INVALID_STIME";
       lprintf("Start time is not provided or is in the past");
@@ -911,6 +1258,7 @@ invocation_response my_handler(invocation_request const& request, const std::sha
       * NOTE: Purely time-based seed will backfire for applications that start together */
       unsigned int seed = std::time(nullptr) ^ (getpid()<<16 ^ (id << 16));
       std::srand(seed);
+      poisson_gen.set_seed(seed);
 
       /* Check clock precision on the system is at least micro-seconds (TODO: Does this give real precision?) */
       int prec;
@@ -928,19 +1276,32 @@ invocation_response my_handler(invocation_request const& request, const std::sha
       lprintf("clock precision level: %d\n", prec);
 
       /* Get cacheline address */
-      uint64_t* addr = get_cache_line_straddled_address();
+      uint64_t* addr = host.cacheline_addr;
       if (addr == NULL){
          lprintf("Cannot find cacheline straddled address");
          error = "NO_CACHELINE_ADDR";
          success = false;
       }
 
-      if (success) {
+      /* Watch for noisy neighbors instead; the protocol needs everyone to start together, this doesn't */
+      if (success && monitor_mode) {
+         lprintf("Monitoring membus for %d secs (CPU budget %.3lf, %d ms windows)\n", monitor_secs, monitor_config.cpu_budget, monitor_config.window_ms);
+         MembusMonitor monitor(addr, monitor_config, seed);
+         monitor.run((int64_t) monitor_secs * MUS_PER_SEC);
+         monitor_events = monitor.take_events();
+         monitor_stats = monitor.get_stats();
+         for (size_t i = 0; i < monitor_events.size(); i++)
+            lprintf("[Lambda-%3d] Contention %s at %ld: D %.3lf, median ratio %.2lf, p-value %.3g\n", id,
+               monitor_events[i].onset ? "onset" : "offset", (long) monitor_events[i].time_mus,
+               monitor_events[i].severity, monitor_events[i].latency_ratio, monitor_events[i].pvalue);
+      }
+
+      if (success && !monitor_mode) {
          /* Run id exchange protocol */
          try {
             AWS_LOGSTREAM_INFO(TAG, "Running");
             microseconds start_time_mus = duration_cast<microseconds>(seconds(start_time_secs));
-            result = run_membus_protocol(id, start_time_mus, max_phases, max_bits, bit_duration_secs, addr, repeat_phases, &protocol_time);
+            result = run_membus_protocol(id, start_time_mus, max_phases, max_bits, bit_duration_mus, addr, repeat_phases, &protocol_time);
          }
          catch (std::exception e){
             lprintf("Exception in membus protocol execution: %s", e.what());
@@ -964,8 +1325,8 @@ invocation_response my_handler(invocation_request const& request, const std::sha
 
                num_bits = chdatalen == 0 ? DEFAULT_CHANNEL_UPTIME_SECS * rate_bps : chdatalen;
                base_readings_len = bit0_readings_len = bit1_readings_len = 0;       // FIXME: HACK to get some latency samples
-               int channel_start_time = start_time_secs + (max_phases * max_bits * bit_duration_secs) + 5;
-               microseconds start_time_mus = duration_cast<microseconds>(seconds(channel_start_time));
+               microseconds start_time_mus = duration_cast<microseconds>(seconds(start_time_secs + 5)) 
+                  + microseconds((int64_t) max_phases * max_bits * bit_duration_mus);
 
                if (sender){
                   /* Allocate a big buffer for regular memory accesses */
@@ -999,132 +1360,240 @@ invocation_response my_handler(invocation_request const& request, const std::sha
       }
    }
 
-   /* Prepare response body as JSON*/
-   RSJresource body("{}");
-   // body["request"] = util::escape_json(request.payload);     // Enable this for request payload debugging
-   body["Id"] = id;
-   body["Start Time"] =  start_time;
-   body["End Time"] =   current_datetime();
-   body["Request ID"] = request.request_id;
+   /* Prepare response body as JSON, in one pass into one buffer */
+   JsonWriter body(save_samples || log_ ? DEFAULT_RESPONSE_RESERVE : DEFAULT_JSON_RESERVE);
+   body.begin_object();
+   // body.field("request", request.payload);     // Enable this for request payload debugging
+   body.field("Id", id);
+   body.field("Start Time", start_time);
+   body.field("End Time", current_datetime());
+   body.field("Request ID", request.request_id);
 
    /* Save results (return all fields whether applicable or not) */
-   body["Success"] = success;
-   body["Error"] = error;
-   body["Protocol Time"] = (int)protocol_time;
-   body["Phases"] =  result != NULL ? result->num_phases : 0;
+   body.field("Success", (int) success);              /* 1/0: analysis scripts parse it as an int */
+   body.field("Encoding", encoding_name(encoding));
+   body.field("Error", error);
+   body.field("Protocol Time", (int)protocol_time);
+   body.field("Phases", result != NULL ? result->num_phases : 0);
    for (int i = 0; i < max_phases; i++) {
-      body["Phase " + std::to_string(i+1)] = (result != NULL && i < result->num_phases) ? result->ids[i] : -1;
+      body.key("Phase " + std::to_string(i+1)).value((result != NULL && i < result->num_phases) ? result->ids[i] : -1);
+   }
+   body.key("Erased Id Bits").value_list(result != NULL ? result->erasures : NULL, result != NULL ? result->num_phases : 0);   /* Per phase, mask of id bits read while descheduled */
+   body.field("Bit Duration (ms)", bit_duration_mus / 1000);
+   body.field("KS Decision", use_pvalue ? "pvalue" : "cutoff");
+   body.field("KS Threshold", use_pvalue ? ks_alpha : ks_cutoff);
+   body.field("Analysis CPU", analysis_cpu);                  /* -1 if statistics ran on the sampling thread */
+   body.field("Analysis Ring Drops", analysis_cpu >= 0 ? (int) bit_analyzer.get_drops() : 0);
+   body.field("Preempt Filter", preempt.is_enabled());
+   body.field("Late Samples", (int) preempt.get_late());
+   body.field("Descheduled Bits", preempt.get_descheduled_bits());
+   body.field("Involuntary Switches", (int) preempt.get_switches());
+   body.field("Run Delay (ms)", preempt.get_run_delay_ns() / 1e6);
+
+   /* Counters per bit window, one list per available counter */
+   if (use_perf) {
+      body.field("Perf Counters", perf.get_status());
+      body.field("Perf Window Kinds", perf_window_kinds);
+      for (int c = 0; c < PERF_NUM_COUNTERS && perf.is_open(); c++) {
+         if (!perf.available(c))
+            continue;
+         body.key(std::string("Perf ") + PerfCounters::name(c));
+         body.begin_string();
+         for (size_t i = 0; i < perf_windows.size(); i++) {
+            body.append_int(perf_windows[i].values[c]);
+            body.append_escaped(",", 1);
+         }
+         body.end_string();
+      }
+   }
+
+   /* Time-to-decision of the sequential test */
+   if (use_sprt) {
+      body.field("SPRT Decided Bits", sprt_decided_bits);
+      body.field("SPRT Undecided Bits", sprt_undecided_bits);
+      body.field("SPRT Mean Decision Time (ms)", sprt_decided_bits > 0 ? sprt_decision_mus_total / 1000.0 / sprt_decided_bits : 0.0);
    }
 
    /* Save samples if specified */
    if (success && (save_samples || channel_created)) {
-      std::string arr;
-      std::stringstream ss1, ss2;
-
       if (base_readings_len > 0) {
-         arr = "";
-         for (int i = 0; i < base_readings_len; i++) {
-            arr += std::to_string(base_readings[i]) + ',';
-         }
-         body["Base Sample"] = RSJresource(arr, true);
+         write_samples(body, "Base Sample", base_readings, base_readings_len);
       }
       
       if (bit1_readings_len > 0) {
-         arr = "";
-         for (int i = 0; i < bit1_readings_len; i++) {
-            arr += std::to_string(bit1_readings[i]) + ',';
-         }
-         body["Bit-1 Sample"] = RSJresource(arr, true);
+         write_samples(body, "Bit-1 Sample", bit1_readings, bit1_readings_len);
       }
       if (save_samples) {
-         ss1 << std::setprecision(15) << bit1_pvalue;
-         body["Bit-1 Pvalue"] = ss1.str();
+         body.field("Bit-1 Pvalue", bit1_pvalue);
       }
       
       if (bit0_readings_len > 0) {
-         arr = "";
-         for (int i = 0; i < bit0_readings_len; i++) {
-            arr += std::to_string(bit0_readings[i]) + ',';
-         }
-         body["Bit-0 Sample"] = RSJresource(arr, true);
+         write_samples(body, "Bit-0 Sample", bit0_readings, bit0_readings_len);
       }
       if (save_samples) {
-         ss2 << std::setprecision(15) << bit0_pvalue;
-         body["Bit-0 Pvalue"] = ss2.str();   //ss.str to preserve precision
+         body.field("Bit-0 Pvalue", bit0_pvalue);
+      }
+   }
+
+   /* Save the trace next to the result */
+   if (trace.is_open()) {
+      int trace_count = trace.get_count(), trace_overflow = trace.get_overflow();
+      trace.finish();
+      body.field("Trace Records", trace_count);
+      body.field("Trace Overflow", trace_overflow);
+      if (!s3bucket.empty() && !s3key.empty()) {
+         /* The protocol is over, so wait for it: the key is only reported once the trace is there */
+         uploader.put_file(s3bucket, s3key + ".trace", trace.get_path());
+         std::vector<upload_result_t> uploads = uploader.flush();
+         for (size_t i = 0; i < uploads.size(); i++) {
+            log_upload(uploads[i]);
+            if (uploads[i].key != s3key + ".trace")
+               continue;
+            if (uploads[i].ok)
+               body.field("Trace Key", uploads[i].key);
+            else
+               body.field("Trace Error", uploads[i].error);
+         }
+         unlink(trace.get_path().c_str());      /* /tmp outlives the invocation: don't leave it full */
+      }
+      else
+         body.field("Trace File", trace.get_path());
+   }
+
+   /* Save monitor results */
+   if (success && monitor_mode) {
+      body.key("Monitor").begin_object();
+      body.field("Duration (s)", monitor_secs);
+      body.field("Window (ms)", monitor_config.window_ms);
+      body.field("CPU Budget", monitor_config.cpu_budget);
+      body.field("CPU Used", monitor_stats.cpu_used);
+      body.field("Sample Rate", monitor_stats.samples_per_sec);
+      body.field("Idle Windows", monitor_stats.idle_windows);
+      body.field("Windows", monitor_stats.windows);
+      body.field("Skipped Windows", monitor_stats.skipped_windows);
+      body.field("Contended Windows", monitor_stats.contended_windows);
+      body.field("Samples", (int) monitor_stats.samples);
+      body.field("Baseline Size", monitor_stats.baseline_size);
+
+      /* Events as parallel comma-separated lists, like the samples */
+      std::string types, times, severities, ratios, pvalues;
+      for (size_t i = 0; i < monitor_events.size(); i++) {
+         types += monitor_events[i].onset ? "onset," : "offset,";
+         times += std::to_string(monitor_events[i].time_mus) + ',';
+         severities += std::to_string(monitor_events[i].severity) + ',';
+         ratios += std::to_string(monitor_events[i].latency_ratio) + ',';
+         std::stringstream pvalue;
+         pvalue << std::setprecision(6) << monitor_events[i].pvalue;
+         pvalues += pvalue.str() + ',';
       }
+      body.field("Event Types", types);
+      body.field("Event Times (us)", times);
+      body.field("Event Severity", severities);
+      body.field("Event Latency Ratio", ratios);
+      body.field("Event Pvalue", pvalues);
+      body.end_object();
    }
 
    /* Save covert channel info */
    if (setup_channel && channel_created) {
-      body["Channel"] = RSJresource("{}");
-      body["Channel"]["Role"] = sender_id == id ? "Sender" : "Receiver";
-      body["Channel"]["Sender Id"] = sender_id;
-      body["Channel"]["Receiver Id"] = receiver_id;
-      body["Channel"]["Bits"] = num_bits;
-      body["Channel"]["Rate"] = rate_bps;
-      body["Channel"]["Erasures"] = erasures;
+      body.key("Channel").begin_object();
+      body.field("Role", sender_id == id ? "Sender" : "Receiver");
+      body.field("Sender Id", sender_id);
+      body.field("Receiver Id", receiver_id);
+      body.field("Bits", num_bits);
+      body.field("Rate", rate_bps);
+      body.field("Erasures", erasures);
+      body.field("Erasures Descheduled", erasures_descheduled);
+      body.field("Erasures Receiver Absent", erasures_absent);
+      body.field("Threshold", access_threshold);
+      body.field("Threshold (ns)", (int) cycles_to_ns(access_threshold));
       
       /* Encode sent/received data */
-      std::string arr = "";
-      for (int i = 0; i < num_bits; i++) {
-         arr += data[i] ? "1" : "0";
+      if (encoding == ENCODING_DELTA_VARINT) {
+         body.field("Data", encode_bits(std::vector<bool>(data.begin(), data.begin() + num_bits)));
       }
-      body["Channel"]["Data"] = RSJresource(arr, true);
+      else {
+         body.key("Data").begin_string();
+         for (int i = 0; i < num_bits; i++) {
+            body.append_escaped(data[i] ? "1" : "0", 1);
+         }
+         body.end_string();
+      }
+      body.end_object();
    }
 
    /* Save some system info */
    /* Get MAC addresses and add to the buffer */ 
-   body["MAC Address"] = get_mac_addrs();
-   body["IP Address"] = get_ipaddr();
-   /* Get boot id */
-   std::ifstream ifs("/proc/sys/kernel/random/boot_id");
-   std::string boot_id ( (std::istreambuf_iterator<char>(ifs) ), (std::istreambuf_iterator<char>()) );
-   body["Boot ID"] = boot_id;
-   body["CPU CPI"] = get_cpu_cycles_per_operation();
+   body.field("MAC Address", host.mac_addrs);
+   body.field("IP Address", host.ip_addr);
+   body.field("Boot ID", host.boot_id);
+   body.field("CPU CPI", host.cpu_cpi);
+   body.field("Host Profile Cached", host_cached);
+   body.field("Host Profile (ms)", host.profile_ms);
+   body.field("TSC MHz", tsc_mhz);
+   body.field("TSC Source", tsc_mhz_source);
+   body.field("Waits", (int) tsc_wait_stats.waits);
+   body.field("Waits Missed", (int) tsc_wait_stats.missed);
+   body.field("Waits Slept", (int) tsc_wait_stats.sleeps);
+   body.field("Wait Overshoot Mean (ns)", tsc_wait_stats.waits ? cycles_to_ns(tsc_wait_stats.overshoot_total / tsc_wait_stats.waits) : 0.0);
+   body.field("Wait Overshoot Max (ns)", cycles_to_ns(tsc_wait_stats.overshoot_max));
 
    /* Save all the lambas that previously used the current container */
-   std::string arr;
-   for (int i = 0; i < lambdas.size()-1 ; i++) {
-      if (i == lambdas.size()-2)    arr += lambdas[i];
-      else                          arr += lambdas[i] + ',';
+   body.key("Predecessors").begin_string();
+   for (int i = 0; i + 1 < (int) lambdas.size(); i++) {
+      if (i > 0)     body.append_escaped(",", 1);
+      body.append_escaped(lambdas[i]);
    }
-   body["Predecessors"] = RSJresource(arr, true);
-   body["GUID"] = guid;
+   body.end_string();
+   body.field("GUID", guid);
+
+   body.field("S3 Client Reused", uploader.is_warm());
+
+   /* Uploads that are done by now */
+   std::vector<upload_result_t> uploads = uploader.finished();
+   for (size_t i = 0; i < uploads.size(); i++)
+      log_upload(uploads[i]);
 
    /* Save logs to response */
    if (log_) {
-      std::string logarr;
-      for (std::vector<std::string>::const_iterator it = begin (logs); it != end (logs); ++it) {
-         logarr += (*it) + '\t';
-      }
-      body["Logs"] = RSJresource(logarr, true);
+      body.field("Logs", logs.format('\t', log_budget));
    }
+   body.end_object();
 
-   /* Save response to s3 */
+   /* Save response to s3, in the background while the API response is put together. The
+    * uploader's client is kept across invocations and rebuilt if a request fails on it. */
    if (!s3bucket.empty() && !s3key.empty()){
-      /* WARNING: Always initialize S3 client object close to its usage. It expires after a while (100 seconds?) */
-      lprintf("Writing result to S3 at s3://%s/%s", s3bucket.c_str(), s3key.c_str());
-      Aws::S3::S3Client client(credentialsProvider, config);
-      write_to_s3(client, s3bucket, s3key, body.as_str());
+      uploader.put(s3bucket, s3key, body.str());
    }
-
-   // WARNING: Do not log using lprintf after this point, corrupts logs array that is being written into S3
-   AWS_LOGSTREAM_INFO(TAG, "Wrote result to S3");
    
    /* Prepare response with statuscode, headers and body
    * In the format required by Lambda Proxy Integration: 
-   * https://aws.amazon.com/premiumsupport/knowledge-center/malformed-502-api-gateway/ */  
-   RSJresource response("{}");
-   response["statusCode"] = 200;
-   response["headers"] = RSJresource("{}");
-   response["body"] = RSJresource("");
-   if (return_data) {
-      std::string escaped_body = util::escape_json(body.as_str());
-      response["body"] = RSJresource(escaped_body, true);  // don't parse escaped body as json object
+   * https://aws.amazon.com/premiumsupport/knowledge-center/malformed-502-api-gateway/ 
+   * The body goes in as an escaped string, straight from the body buffer */  
+   JsonWriter response(return_data ? body.size() + body.size() / 8 + 64 : 64);
+   response.begin_object();
+   response.field("statusCode", 200);
+   response.key("headers").begin_object();
+   response.end_object();
+   if (return_data)
+      response.field("body", body.str());
+   else
+      response.field("body", "");
+   response.end_object();
+
+   /* The sandbox is frozen as soon as we return: wait for the uploads here. The logs are
+    * already in the result, so how they went goes to the console (CloudWatch) instead. */
+   uploads = uploader.flush();
+   for (size_t i = 0; i < uploads.size(); i++) {
+      if (uploads[i].ok)
+         AWS_LOGSTREAM_INFO(TAG, "Wrote s3://" << uploads[i].bucket << "/" << uploads[i].key << " (" << uploads[i].bytes 
+            << " bytes, " << uploads[i].attempts << " attempts, " << uploads[i].ms << " ms)");
+      else
+         AWS_LOGSTREAM_INFO(TAG, "Could not write s3://" << uploads[i].bucket << "/" << uploads[i].key << ": " << uploads[i].error);
    }
 
    /* send response */
-   return invocation_response::success(response.as_str(), "application/json");
+   return invocation_response::success(response.str(), "application/json");
 }
 
 
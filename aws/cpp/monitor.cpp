@@ -0,0 +1,245 @@
+#include <ctime>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+
+#include "monitor.h"
+#include "ksdist.h"
+#include "latsort.h"
+
+#define MIN_WINDOW_SAMPLES          20      /* Fewer than this and the window is skipped           */
+#define MAX_RATE_STEP               2.0     /* Rate changes at most by this factor per window      */
+#define MAX_IDLE_WINDOWS            100     /* Duty cycle floor: sample at least 1 in 101 windows  */
+
+monitor_config_t monitor_default_config(void)
+{
+    monitor_config_t config;
+    config.window_ms = 100;
+    config.cpu_budget = 0.01;
+    config.max_samples_per_sec = 2000;
+    config.warmup_windows = 10;
+    config.baseline_windows = 50;
+    config.alpha = 0.001;
+    config.onset_windows = 2;
+    config.offset_windows = 3;
+    return config;
+}
+
+static inline int64_t now_mus(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static inline int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Sleep (never spin: spinning is exactly the CPU time we're budgeting) */
+static void sleep_until_mus(int64_t time_mus)
+{
+    struct timespec ts;
+    ts.tv_sec = time_mus / 1000000;
+    ts.tv_nsec = (time_mus % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int64_t median(std::vector<int64_t> values)
+{
+    if (values.empty())
+        return 0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+MembusMonitor::MembusMonitor(uint64_t* probe, const monitor_config_t& config, uint64_t seed) :
+    probe(probe), config(config), gen(seed), idle_windows(0), contended(false), contended_run(0), quiet_run(0),
+    cpu_ns_total(0), wall_mus_total(0), stop_flag(false)
+{
+    /* Least rate that still fills a window enough to decide on it (with some slack for Poisson) */
+    min_rate = 1.5 * MIN_WINDOW_SAMPLES * 1000.0 / config.window_ms;
+
+    /* Start from what the budget would allow at ~20us of CPU per sample; adjusted after every window */
+    rate = std::max(min_rate, std::min((double) config.max_samples_per_sec, config.cpu_budget * 50000));
+    stats.windows = stats.skipped_windows = stats.contended_windows = 0;
+    stats.samples = 0;
+    stats.cpu_used = 0;
+    stats.samples_per_sec = rate;
+    stats.idle_windows = 0;
+    stats.baseline_size = 0;
+}
+
+void MembusMonitor::run(int64_t duration_mus)
+{
+    int64_t end_mus = now_mus() + duration_mus;
+    int64_t window_mus = config.window_ms * 1000LL;
+    int64_t window_end = now_mus() + window_mus;
+    while (!stop_flag.load() && window_end <= end_mus) {
+        int64_t cpu_start = thread_cpu_ns();
+        int64_t wall_start = now_mus();
+        sample_window(window_end);
+        if (stop_flag.load())
+            break;
+        sleep_until_mus(window_end);
+        classify_window(window_end);
+        int64_t active_cpu_ns = thread_cpu_ns() - cpu_start;
+        int64_t active_mus = now_mus() - wall_start;
+
+        /* Sit out whole windows when even the least useful rate is over budget */
+        for (int i = 0; i < idle_windows && !stop_flag.load() && window_end + window_mus <= end_mus; i++) {
+            window_end += window_mus;
+            sleep_until_mus(window_end);
+        }
+
+        update_rate(active_cpu_ns, active_mus, thread_cpu_ns() - cpu_start, now_mus() - wall_start);
+        window_end += window_mus;
+    }
+}
+
+/* Poisson sample times within the window, sleeping between samples */
+void MembusMonitor::sample_window(int64_t window_end_mus)
+{
+    window.clear();
+    double mean_gap_mus = 1000000.0 / rate;
+    double next = now_mus();
+    while (!stop_flag.load()) {
+        next += gen.next(mean_gap_mus);
+        if (next >= window_end_mus)
+            break;
+        sleep_until_mus((int64_t) next);
+        window.push_back(sampler.sample_atomic(probe));
+    }
+}
+
+void MembusMonitor::classify_window(int64_t window_end_mus)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats.windows++;
+    stats.samples += window.size();
+    if ((int) window.size() < MIN_WINDOW_SAMPLES) {
+        stats.skipped_windows++;
+        return;
+    }
+
+    /* Everything seen at the start is the baseline; nothing to compare against yet */
+    if ((int) baseline_windows.size() < config.warmup_windows && !contended) {
+        add_to_baseline();
+        return;
+    }
+
+    ks.reset();
+    for (size_t i = 0; i < window.size(); i++)
+        ks.add(window[i]);
+    ks.statistic();
+    double d = ks.max_distance();
+    double pvalue = ks_pvalue(ks.baseline_size(), ks.size(), d);
+    double ratio = median(window) * 1.0 / std::max((int64_t) 1, baseline[baseline.size() / 2]);
+
+    /* Contention only ever slows the probe down */
+    bool window_contended = pvalue < config.alpha && ratio > 1;
+    if (window_contended) {
+        stats.contended_windows++;
+        contended_run++;
+        quiet_run = 0;
+    }
+    else {
+        quiet_run++;
+        contended_run = 0;
+    }
+
+    monitor_event_t event;
+    event.time_mus = window_end_mus;
+    event.severity = d;
+    event.latency_ratio = ratio;
+    event.pvalue = pvalue;
+    if (!contended && contended_run >= config.onset_windows) {
+        contended = true;
+        event.onset = true;
+        events.push_back(event);
+    }
+    else if (contended && quiet_run >= config.offset_windows) {
+        contended = false;
+        event.onset = false;
+        events.push_back(event);
+    }
+
+    /* Baseline follows slow drift (host load, frequency) but never absorbs contention */
+    if (!contended && !window_contended)
+        add_to_baseline();
+}
+
+void MembusMonitor::add_to_baseline()
+{
+    baseline_windows.push_back(window);
+    while ((int) baseline_windows.size() > config.baseline_windows)
+        baseline_windows.pop_front();
+
+    baseline.clear();
+    for (size_t i = 0; i < baseline_windows.size(); i++)
+        baseline.insert(baseline.end(), baseline_windows[i].begin(), baseline_windows[i].end());
+    sort_latencies(baseline.data(), baseline.size());
+    ks.set_baseline(baseline.data(), baseline.size());
+    stats.baseline_size = baseline.size();
+}
+
+/* Scale the rate by how far off budget the last sampled window was. Below the least useful
+ * rate, keep that rate and leave windows out instead (CPU per sample is roughly constant,
+ * so the fraction of sampled windows scales the CPU used). */
+void MembusMonitor::update_rate(int64_t active_cpu_ns, int64_t active_mus, int64_t cycle_cpu_ns, int64_t cycle_mus)
+{
+    cpu_ns_total += cycle_cpu_ns;
+    wall_mus_total += cycle_mus;
+    double active_fraction = active_cpu_ns / 1000.0 / std::max((int64_t) 1, active_mus);
+    double factor = active_fraction > 0 ? config.cpu_budget / active_fraction : MAX_RATE_STEP;
+    double wanted = rate * std::max(1 / MAX_RATE_STEP, std::min(MAX_RATE_STEP, factor));
+
+    if (wanted >= min_rate) {
+        rate = std::min((double) config.max_samples_per_sec, wanted);
+        idle_windows = 0;
+    }
+    else {
+        /* What one sampled window at min_rate costs, spread over enough windows to fit */
+        double fraction_at_min = active_fraction * min_rate / rate;
+        rate = min_rate;
+        idle_windows = std::min(MAX_IDLE_WINDOWS, (int) ceil(fraction_at_min / config.cpu_budget) - 1);
+        idle_windows = std::max(0, idle_windows);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    stats.cpu_used = cpu_ns_total / 1000.0 / std::max((int64_t) 1, wall_mus_total);
+    stats.samples_per_sec = rate;
+    stats.idle_windows = idle_windows;
+}
+
+void MembusMonitor::start()
+{
+    if (worker.joinable())
+        return;
+    stop_flag.store(false);
+    worker = std::thread(&MembusMonitor::run, this, INT64_MAX / 2);
+}
+
+void MembusMonitor::stop()
+{
+    stop_flag.store(true);
+    if (worker.joinable())
+        worker.join();
+}
+
+std::vector<monitor_event_t> MembusMonitor::take_events()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<monitor_event_t> taken;
+    taken.swap(events);
+    return taken;
+}
+
+monitor_stats_t MembusMonitor::get_stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
@@ -0,0 +1,103 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "kstest.h"
+#include "expgen.h"
+#include "tsc.h"
+
+typedef struct {
+    int window_ms;              /* Length of each decision window                                  */
+    double cpu_budget;          /* Fraction of one CPU the monitor may use (0.01 = 1%)             */
+    int max_samples_per_sec;    /* Sampling rate cap, however much budget is left                  */
+    int warmup_windows;         /* Windows taken into the baseline unconditionally at start        */
+    int baseline_windows;       /* Quiet windows kept in the rolling baseline                      */
+    double alpha;               /* KS p-value below which a window counts as contended             */
+    int onset_windows;          /* Consecutive contended windows before an onset event             */
+    int offset_windows;         /* Consecutive quiet windows before an offset event                */
+} monitor_config_t;
+
+monitor_config_t monitor_default_config(void);
+
+typedef struct {
+    bool onset;                 /* Contention started (else: ended)                                */
+    int64_t time_mus;           /* Epoch time at the end of the window that triggered the event    */
+    double severity;            /* KS distance D between that window and the baseline (0 to 1)     */
+    double latency_ratio;       /* Median latency of that window over the baseline median          */
+    double pvalue;
+} monitor_event_t;
+
+typedef struct {
+    int windows;
+    int skipped_windows;        /* Too few samples to decide (budget too small for the window)     */
+    int contended_windows;
+    int64_t samples;
+    double cpu_used;            /* Fraction of a CPU used, averaged over all windows               */
+    int samples_per_sec;        /* Current (budget-adjusted) sampling rate within a window         */
+    int idle_windows;           /* Current windows left out after every sampled one (duty cycle)   */
+    int baseline_size;
+} monitor_stats_t;
+
+/* Background noisy-neighbor detector. Samples membus lock latency on a probe address
+ * (a cacheline-straddling word, as in the protocol) at Poisson times, sleeping in
+ * between, and adjusts the sampling rate after every window so that its own CPU time
+ * stays within the budget. If even the least rate that can decide a window is over
+ * budget, it also leaves whole windows out. Each window is compared with a rolling
+ * baseline of recent quiet windows using the same online KS test read_bit uses; runs
+ * of contended (and then quiet) windows raise onset (and offset) events.
+ *
+ * Either call run() on a thread of your own, or start()/stop() a background thread and
+ * collect events with take_events() while it runs.
+ */
+class MembusMonitor
+{
+public:
+    MembusMonitor(uint64_t* probe, const monitor_config_t& config, uint64_t seed);
+    ~MembusMonitor()                { stop(); }
+
+    /* Monitor for the given duration (or until stop()); blocks */
+    void run(int64_t duration_mus);
+
+    void start();
+    void stop();
+
+    std::vector<monitor_event_t> take_events();
+    monitor_stats_t get_stats();
+    bool in_contention() const      { return contended; }
+
+private:
+    void sample_window(int64_t window_end_mus);
+    void classify_window(int64_t window_end_mus);
+    void update_rate(int64_t active_cpu_ns, int64_t active_mus, int64_t cycle_cpu_ns, int64_t cycle_mus);
+    void add_to_baseline();
+
+    uint64_t* probe;
+    monitor_config_t config;
+    ExpGenerator gen;
+    LatencySampler sampler;
+    OnlineKS ks;
+
+    std::vector<int64_t> window;
+    std::deque< std::vector<int64_t> > baseline_windows;
+    std::vector<int64_t> baseline;      /* Sorted union of baseline_windows */
+    double rate;                        /* Samples per second while sampling a window */
+    double min_rate;
+    int idle_windows;                   /* Windows skipped after each sampled one */
+    std::atomic<bool> contended;
+    int contended_run, quiet_run;
+    int64_t cpu_ns_total, wall_mus_total;
+
+    std::atomic<bool> stop_flag;
+    std::thread worker;
+    std::mutex lock;                    /* Guards events and stats */
+    std::vector<monitor_event_t> events;
+    monitor_stats_t stats;
+};
+
+#endif /* MONITOR_H */
@@ -0,0 +1,216 @@
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+static long perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+static inline uint64_t rdpmc_read(uint32_t counter)
+{
+    uint32_t low, high;
+    asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+    return ((uint64_t) high << 32) | low;
+}
+
+PerfCounters::PerfCounters() : leader(-1), num_open(0), rdpmc(false), status("not opened")
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        fds[i] = -1;
+        pages[i] = NULL;
+        slot[i] = -1;
+        start[i] = 0;
+    }
+}
+
+const char* PerfCounters::name(int counter)
+{
+    switch (counter) {
+    case PERF_BUS_LOCKS:            return "bus_locks";
+    case PERF_LLC_MISSES:           return "llc_misses";
+    case PERF_MEM_STALLS:           return "mem_stalls";
+    case PERF_CONTEXT_SWITCHES:     return "ctx_switches";
+    }
+    return "unknown";
+}
+
+bool PerfCounters::open(uint64_t bus_lock_raw)
+{
+    close();
+
+    struct { uint32_t type; uint64_t config; } events[PERF_NUM_COUNTERS] = {
+        { PERF_TYPE_RAW,        bus_lock_raw },
+        { PERF_TYPE_HARDWARE,   PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE,   PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+        { PERF_TYPE_SOFTWARE,   PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+
+    /* Hardware counters go in one group, led by the first that opens. The software
+     * counter stays out of it: a group read() is all it has, and that would be the only
+     * way to read the group too. */
+    bool intel = cpu_is_intel();
+    int first_errno = 0, hardware_open = 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        bool software = events[i].type == PERF_TYPE_SOFTWARE;
+        if (i == PERF_BUS_LOCKS && bus_lock_raw == PERF_BUS_LOCK_RAW && !intel)
+            continue;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = !software && leader < 0;   /* The group starts at once, on the leader */
+        attr.exclude_kernel = !software;    /* Allowed at perf_event_paranoid 2; switches happen in the kernel */
+        attr.exclude_hv = 1;
+        attr.read_format = software ? 0 : PERF_FORMAT_GROUP;
+
+        int fd = perf_event_open(&attr, 0, -1, software ? -1 : leader, 0);
+        if (fd < 0) {
+            if (first_errno == 0)   first_errno = errno;
+            continue;
+        }
+        fds[i] = fd;
+        num_open++;
+        if (software)
+            continue;
+        slot[i] = hardware_open++;
+        if (leader < 0)     leader = fd;
+
+        void* page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+        pages[i] = page == MAP_FAILED ? NULL : page;
+    }
+
+    if (num_open == 0) {
+        status = std::string("unavailable: ") + (first_errno ? strerror(first_errno) : "no usable events on this CPU");
+        return false;
+    }
+    if (leader >= 0) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    /* rdpmc only if every hardware counter allows it; else one read() covers the group */
+    rdpmc = leader >= 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (slot[i] < 0)
+            continue;
+        struct perf_event_mmap_page* page = (struct perf_event_mmap_page*) pages[i];
+        rdpmc = page != NULL && page->cap_user_rdpmc;
+        if (!rdpmc)     break;
+    }
+
+    status = "";
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        if (fds[i] >= 0)    status += std::string(status.empty() ? "" : ",") + name(i);
+    status += rdpmc ? " (rdpmc)" : " (read)";
+    if (bus_lock_raw == PERF_BUS_LOCK_RAW && !intel)
+        status += ", no bus_locks (not an Intel CPU)";
+    return true;
+}
+
+void PerfCounters::close()
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (pages[i])       munmap(pages[i], page_size);
+        if (fds[i] >= 0)    ::close(fds[i]);
+        fds[i] = -1;
+        pages[i] = NULL;
+        slot[i] = -1;
+    }
+    leader = -1;
+    num_open = 0;
+    rdpmc = false;
+    status = "not opened";
+}
+
+/* User-space read of a hardware counter (see perf_event_mmap_page in linux/perf_event.h).
+ * While the counter is not on a PMU (multiplexed out), the offset alone is its count */
+uint64_t PerfCounters::read_rdpmc(int counter)
+{
+    volatile struct perf_event_mmap_page* page = (struct perf_event_mmap_page*) pages[counter];
+    uint32_t seq, index;
+    uint64_t count;
+    do {
+        seq = page->lock;
+        asm volatile("" ::: "memory");
+        index = page->index;
+        count = page->offset;
+        if (page->cap_user_rdpmc && index) {
+            int width = page->pmc_width;
+            int64_t pmc = rdpmc_read(index - 1);
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        }
+        asm volatile("" ::: "memory");
+    } while (page->lock != seq);
+
+    return count;
+}
+
+void PerfCounters::read_hardware(uint64_t* values)
+{
+    if (leader < 0)
+        return;
+
+    if (rdpmc) {
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+            if (pages[i] != NULL)
+                values[i] = read_rdpmc(i);
+        return;
+    }
+
+    uint64_t group[1 + PERF_NUM_COUNTERS];
+    if (read(leader, group, sizeof(group)) <= 0)
+        return;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        if (slot[i] >= 0)
+            values[i] = group[1 + slot[i]];
+}
+
+void PerfCounters::read_software(uint64_t* values)
+{
+    int fd = fds[PERF_CONTEXT_SWITCHES];
+    uint64_t value;
+    if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value))
+        values[PERF_CONTEXT_SWITCHES] = value;
+}
+
+void PerfCounters::begin()
+{
+    read_software(start);
+    read_hardware(start);
+}
+
+perf_counts_t PerfCounters::end()
+{
+    perf_counts_t counts;
+    uint64_t now[PERF_NUM_COUNTERS];
+    memcpy(now, start, sizeof(now));
+    read_hardware(now);
+    read_software(now);
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        counts.values[i] = now[i] - start[i];
+    return counts;
+}
+
+std::string PerfCounters::format(const perf_counts_t& counts) const
+{
+    std::string text;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (fds[i] < 0)
+            continue;
+        if (!text.empty())      text += ", ";
+        text += std::string(name(i)) + "=" + std::to_string(counts.values[i]);
+    }
+    return text;
+}
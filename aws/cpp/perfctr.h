@@ -0,0 +1,88 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <cpuid.h>
+
+#define PERF_BUS_LOCK_RAW       0x10f4      /* SQ_MISC.SPLIT_LOCK (Intel Skylake server and later); model-specific */
+
+/* PERF_BUS_LOCK_RAW is an Intel event code: on other vendors it counts something else, if anything */
+static inline bool cpu_is_intel(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return false;
+    char vendor[12];
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    return memcmp(vendor, "GenuineIntel", 12) == 0;
+}
+
+/* Counters in the group. Any of them may be unavailable (no PMU in the guest, no
+ * such event on this CPU, perf_event_paranoid too strict) */
+enum {
+    PERF_BUS_LOCKS,             /* Split/bus locks taken by this thread                    */
+    PERF_LLC_MISSES,
+    PERF_MEM_STALLS,            /* Backend stall cycles (mostly memory-bound)              */
+    PERF_CONTEXT_SWITCHES,      /* Software event, works without a PMU                     */
+    PERF_NUM_COUNTERS
+};
+
+/* Counter deltas over one window; only valid where available() is true */
+typedef struct {
+    uint64_t values[PERF_NUM_COUNTERS];
+} perf_counts_t;
+
+/* Hardware counter group (and a software counter) on the calling thread, for co-sampling
+ * with the latency samples. Hardware counters are read with rdpmc where the kernel allows
+ * user-space access, else with a single read() of the group. The software counter has no
+ * rdpmc and is opened on its own, so that it never forces the group onto read(); its
+ * read() is done before begin()'s hardware reads and after end()'s, outside the window.
+ * If perf_event_open fails for a counter (or the raw bus-lock event is not Intel's) it is
+ * left out; if it fails for all of them, begin()/end() do nothing and return zeros.
+ *
+ * Counts only the thread that called open(): open, begin and end from the sampler.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters()                 { close(); }
+
+    /* Returns true if any counter could be opened; why not (if not) is in get_status().
+     * The default bus-lock event is only opened on Intel CPUs. */
+    bool open(uint64_t bus_lock_raw = PERF_BUS_LOCK_RAW);
+    void close();
+
+    bool is_open() const            { return num_open > 0; }
+    bool available(int counter) const   { return fds[counter] >= 0; }
+    bool uses_rdpmc() const         { return rdpmc; }
+    const std::string& get_status() const  { return status; }
+    static const char* name(int counter);
+
+    /* Bracket a window */
+    void begin();
+    perf_counts_t end();
+
+    /* "name=value, ..." for the available counters, for log lines */
+    std::string format(const perf_counts_t& counts) const;
+
+private:
+    void read_hardware(uint64_t* values);
+    void read_software(uint64_t* values);
+    uint64_t read_rdpmc(int counter);
+
+    int fds[PERF_NUM_COUNTERS];
+    void* pages[PERF_NUM_COUNTERS];     /* perf_event_mmap_page of each hardware counter */
+    int leader;
+    int num_open;
+    int slot[PERF_NUM_COUNTERS];        /* Position of each hardware counter in a group read */
+    bool rdpmc;
+    std::string status;
+    uint64_t start[PERF_NUM_COUNTERS];
+};
+
+#endif /* PERFCTR_H */
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "preempt.h"
+#include "tsc.h"
+
+PreemptionDetector::PreemptionDetector() : enabled(false), late_ns(DEFAULT_PREEMPT_LATE_NS), late_cycles(0),
+    max_run_delay(DEFAULT_PREEMPT_MAX_RUN_DELAY), schedstat_fd(-1), schedstat_tid(-1), bit_counters(false),
+    stalled_cycles(0), max_late_cycles(0)
+{
+    reset();
+}
+
+PreemptionDetector::~PreemptionDetector()
+{
+    if (schedstat_fd >= 0)
+        close(schedstat_fd);
+}
+
+void PreemptionDetector::configure(int64_t late_ns, double max_run_delay)
+{
+    this->late_ns = late_ns;
+    this->max_run_delay = max_run_delay;
+}
+
+void PreemptionDetector::reset()
+{
+    total_samples = total_late = 0;
+    descheduled_bits = 0;
+    total_switches = total_run_delay_ns = 0;
+}
+
+uint64_t PreemptionDetector::read_nivcsw()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0)
+        return 0;
+    return usage.ru_nivcsw;
+}
+
+/* Second field of /proc/thread-self/schedstat; 0 if the kernel doesn't keep schedstats */
+uint64_t PreemptionDetector::read_run_delay()
+{
+    int tid = syscall(SYS_gettid);
+    if (schedstat_tid != tid) {
+        if (schedstat_fd >= 0)
+            close(schedstat_fd);
+        schedstat_fd = open("/proc/thread-self/schedstat", O_RDONLY);
+        schedstat_tid = tid;
+    }
+    if (schedstat_fd < 0)
+        return 0;
+
+    char buf[128];
+    ssize_t len = pread(schedstat_fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return 0;
+    buf[len] = 0;
+    char* end;
+    strtoull(buf, &end, 10);            /* time on CPU */
+    return strtoull(end, NULL, 10);
+}
+
+sched_counters_t PreemptionDetector::read_counters()
+{
+    sched_counters_t counters;
+    counters.nivcsw = read_nivcsw();
+    counters.run_delay_ns = read_run_delay();
+    return counters;
+}
+
+void PreemptionDetector::begin_bit(bool counters)
+{
+    late_cycles = ns_to_cycles(late_ns);
+    bit.samples = bit.late = 0;
+    bit.switches = bit.run_delay_ns = 0;
+    bit.stalled_ns = bit.max_gap_ns = 0;
+    bit.descheduled = false;
+    stalled_cycles = max_late_cycles = 0;
+    bit_counters = enabled && counters;
+    if (bit_counters)
+        bit_start = read_counters();
+}
+
+preempt_bit_t PreemptionDetector::end_bit(int64_t duration_ns)
+{
+    if (!enabled)
+        return bit;
+
+    if (bit_counters) {
+        sched_counters_t now = read_counters();
+        bit.switches = now.nivcsw - bit_start.nivcsw;
+        bit.run_delay_ns = now.run_delay_ns - bit_start.run_delay_ns;
+    }
+    bit.stalled_ns = cycles_to_ns(stalled_cycles);
+    bit.max_gap_ns = cycles_to_ns(max_late_cycles);
+    bit.descheduled = bit.run_delay_ns > max_run_delay * duration_ns
+        || bit.stalled_ns > max_run_delay * duration_ns;
+
+    total_samples += bit.samples;
+    total_late += bit.late;
+    total_switches += bit.switches;
+    total_run_delay_ns += bit.run_delay_ns;
+    if (bit.descheduled)
+        descheduled_bits++;
+    return bit;
+}
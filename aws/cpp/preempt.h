@@ -0,0 +1,98 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <cstdint>
+
+#define DEFAULT_PREEMPT_LATE_NS         20000   /* A sample taken this late was held up by the scheduler (the wait before it spins) */
+#define DEFAULT_PREEMPT_MAX_RUN_DELAY   0.1     /* A bit that spent more than this fraction off CPU is an erasure                   */
+
+/* Scheduler counters of the calling thread */
+typedef struct {
+    uint64_t nivcsw;            /* Involuntary context switches (getrusage)                 */
+    uint64_t run_delay_ns;      /* Time spent runnable but waiting for a CPU (schedstat)    */
+} sched_counters_t;
+
+/* What happened to the thread over one bit */
+typedef struct {
+    int samples;
+    int late;                   /* Samples taken more than late_ns after they were due      */
+    uint64_t switches;          /* Involuntary context switches during the bit              */
+    uint64_t run_delay_ns;
+    int64_t stalled_ns;         /* Time samples were overdue by, summed over late samples   */
+    int64_t max_gap_ns;         /* Most overdue sample                                      */
+    bool descheduled;           /* Too much of the bit was spent off CPU to trust it        */
+} preempt_bit_t;
+
+/* Tells bits whose latencies measure the scheduler from bits that measure the membus.
+ * Nothing is read per sample: the sampler only hands over the TSC a sample was taken at
+ * and the TSC it was due at. It spins up to that point, so a sample that comes late
+ * means the thread (or its vCPU, which the guest's own counters don't see, e.g. stolen
+ * by the hypervisor) was off CPU. Per bit, the scheduler counters are read at both ends
+ * (if asked for), and a bit is descheduled if its run delay (schedstat) or the time its
+ * samples were overdue by is over max_run_delay of it. The latencies themselves are
+ * never judged: heavy contention looks just like a stall from a single sample.
+ *
+ * Reads the counters of the calling thread: use from the sampling thread only.
+ */
+class PreemptionDetector
+{
+public:
+    PreemptionDetector();
+    ~PreemptionDetector();
+
+    void configure(int64_t late_ns, double max_run_delay);
+    void set_enabled(bool enable)   { enabled = enable; }
+    bool is_enabled() const         { return enabled; }
+
+    sched_counters_t read_counters();
+
+    /* Bracket a bit (or any interval); end_bit() returns what happened in it. Without
+     * counters, only late samples are looked at (no syscalls at all). */
+    void begin_bit(bool counters = true);
+    preempt_bit_t end_bit(int64_t duration_ns);
+
+    /* A sample was taken at start_tsc, due at due_tsc (0 if it had no due time) */
+    inline void sample(uint64_t start_tsc, uint64_t due_tsc) {
+        if (!enabled)
+            return;
+        bit.samples++;
+        if (due_tsc == 0 || start_tsc <= due_tsc + late_cycles)
+            return;
+        uint64_t overdue = start_tsc - due_tsc;
+        bit.late++;
+        stalled_cycles += overdue;
+        if (overdue > max_late_cycles)
+            max_late_cycles = overdue;
+    }
+
+    /* Totals since reset() */
+    void reset();
+    int64_t get_samples() const         { return total_samples; }
+    int64_t get_late() const            { return total_late; }
+    int get_descheduled_bits() const    { return descheduled_bits; }
+    uint64_t get_switches() const       { return total_switches; }
+    uint64_t get_run_delay_ns() const   { return total_run_delay_ns; }
+
+private:
+    uint64_t read_nivcsw();
+    uint64_t read_run_delay();
+
+    bool enabled;
+    int64_t late_ns;
+    uint64_t late_cycles;               /* late_ns at the current TSC rate */
+    double max_run_delay;
+
+    int schedstat_fd;
+    int schedstat_tid;                  /* Thread the open schedstat file belongs to */
+
+    bool bit_counters;                  /* Counters were read at the start of the bit */
+    sched_counters_t bit_start;
+    preempt_bit_t bit;
+    uint64_t stalled_cycles, max_late_cycles;     /* Of the current bit */
+
+    int64_t total_samples, total_late;
+    int descheduled_bits;
+    uint64_t total_switches, total_run_delay_ns;
+};
+
+#endif /* PREEMPT_H */
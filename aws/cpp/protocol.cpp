@@ -0,0 +1,47 @@
+#include "protocol.h"
+
+MembusProtocol::MembusProtocol(int my_id, int max_phases, int max_bits_in_id, bool repeat_phases) :
+    my_id(my_id), max_phases(max_phases < MAX_PHASES ? max_phases : MAX_PHASES), max_bits_in_id(max_bits_in_id),
+    repeat_phases(repeat_phases), phase(0), bit_pos(max_bits_in_id - 1), advertised(false), advertising(true),
+    id_read(0), id_erasures(0), last_id_read(0), finished(max_phases <= 0 || max_bits_in_id <= 0)
+{
+    result.num_phases = 0;
+}
+
+bool MembusProtocol::bit_done(int bit_read, bool erased)
+{
+    if (finished)
+        return false;
+
+    /* Stop advertising if my bit is 0 and bit read is 1 i.e., someone else has higher id than mine */
+    if (advertising && !my_bit() && bit_read)
+        advertising = false;
+
+    id_read = (2 * id_read) + bit_read;     /* We get bits in most to least significant order */
+    if (erased)
+        id_erasures |= 1 << bit_pos;
+
+    if (--bit_pos >= 0)
+        return false;
+
+    /* End of phase */
+    last_id_read = id_read;
+    if (id_read == 0) {                     /* End of protocol */
+        finished = true;
+        return true;
+    }
+    result.ids[result.num_phases] = id_read;
+    result.erasures[result.num_phases++] = id_erasures;
+    if (!repeat_phases && id_read == my_id) /* My part is done, I will just listen from now on */
+        advertised = true;
+
+    if (++phase >= max_phases)
+        finished = true;
+    else {
+        bit_pos = max_bits_in_id - 1;
+        advertising = !advertised;
+        id_read = 0;
+        id_erasures = 0;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#define MAX_PHASES               15
+
+typedef struct {
+    int num_phases;
+    int ids[MAX_PHASES];
+    int erasures[MAX_PHASES];       /* Bits of each id that were read while descheduled */
+} result_t;
+
+/* One participant's side of the id exchange, without any I/O. Ids go out most significant
+ * bit first, one bit per slot. A participant that is still advertising writes (contends)
+ * in the slots where its id has a 1 and reads in the others; it stops advertising as soon
+ * as it reads a 1 where its own bit is 0, since someone with a higher id is out there.
+ * What is read (1 for a slot we wrote in) assembles into the max id of the phase. Phases
+ * go on until an empty phase (id 0) or max_phases; a participant whose id was learned
+ * only listens from then on, unless repeat_phases is set.
+ *
+ * The handler drives it with real membus reads and writes, the simulator with modeled ones.
+ */
+class MembusProtocol
+{
+public:
+    MembusProtocol(int my_id, int max_phases, int max_bits_in_id, bool repeat_phases);
+
+    bool done() const               { return finished; }
+    int get_phase() const           { return phase; }
+    int get_bit_pos() const         { return bit_pos; }
+    bool my_bit() const             { return my_id & (1 << bit_pos); }
+    int get_id_read() const         { return last_id_read; }
+    const result_t& get_result() const  { return result; }
+
+    /* Write (contend) in the current slot rather than read it */
+    bool writing() const            { return advertising && my_bit(); }
+
+    /* Record the bit of the current slot (1 if we wrote) and move on to the next one. An
+     * erased bit is one read while we were off CPU for too much of the slot: it is taken
+     * as read, but marked in the result so the id can be told apart from a clean one.
+     * Returns true if that completed a phase; get_id_read() then has the id read in it. */
+    bool bit_done(int bit_read, bool erased = false);
+
+private:
+    int my_id;
+    int max_phases;
+    int max_bits_in_id;
+    bool repeat_phases;
+
+    int phase;
+    int bit_pos;
+    bool advertised;            /* My id was learned in an earlier phase    */
+    bool advertising;           /* Still in the running in this phase       */
+    int id_read;
+    int id_erasures;            /* Erased bits of id_read                   */
+    int last_id_read;           /* Id read in the last complete phase       */
+    bool finished;
+    result_t result;
+};
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,441 @@
+/* Discrete-event simulator for the id exchange protocol (run_membus_protocol), to
+ * explore max_phases, bits per id, bit duration and the KS cutoff without running
+ * hundreds of Lambdas. Each virtual participant runs the handler's own protocol logic
+ * (MembusProtocol); only the membus is modeled. A reader's latency samples are drawn
+ * at the handler's Poisson sampling times, from the Bit-1 distribution while some
+ * writer is contending and from the Bit-0 distribution otherwise, and the bit is read
+ * with the same OnlineKS statistic (or p-value) against a baseline drawn from the Base
+ * distribution. Distributions come from handler responses saved with "samples": true
+ * (their "Base Sample", "Bit-0 Sample" and "Bit-1 Sample" lists); without any, a
+ * synthetic model is used.
+ *
+ * Noise models, per participant:
+ *   clock skew   each participant's slot boundaries are off by N(0, skew) microseconds
+ *   preemption   in each slot, with probability P, it is off CPU for an exponentially
+ *                distributed stretch (mean L ms): a writer does not contend during it, a
+ *                reader takes no samples during it (and marks the bit as an erasure if the
+ *                stretch is over 10% of the slot, like the handler's preemption filter)
+ *   bit flips    each read bit is flipped with probability F
+ *
+ * Every combination of the comma-separated lists is simulated for the given number of
+ * trials, spread over worker threads, and reported as: participants that learned the
+ * right ids, trials in which all did, reads that got the slot wrong, and protocol time.
+ *
+ * Usage: ./protosim [-f response.json]... [-n participants] [-p phases] [-b bits] [-d bit_ms]
+ *                   [-c ks_cutoff] [-a ks_alpha] [-k skew_us] [-P preempt_prob] [-L preempt_ms]
+ *                   [-F flip_prob] [-R samples_per_sec] [-x (distinct phases)] [-t trials]
+ *                   [-j threads] [-s seed] [-o results.csv]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "kstest.h"
+#include "ksdist.h"
+#include "samplecodec.h"
+
+#define DEFAULT_PARTICIPANTS        "100"
+#define DEFAULT_PHASES              "2"
+#define DEFAULT_BITS                "10"
+#define DEFAULT_BIT_MS              "1000"
+#define DEFAULT_KS_CUTOFF           3.0         /* DEFAULT_KS_MEAN_CUTOFF in main.cpp, scaled to -R like the handler does */
+#define DEFAULT_SKEW_US             "0"
+#define DEFAULT_TRIALS              10
+#define DEFAULT_SAMPLES_PER_SEC     1000        /* SAMPLES_PER_SECOND in main.cpp */
+#define DEFAULT_PREEMPT_MS          20.0
+#define DEFAULT_REPEAT_PHASES       true        /* repeat_phases in the handler's request; -x turns it off */
+#define WRITE_STOP_MUS              12000       /* Writers and readers stop 10 ms + BIT_GUARD_MUS before the next slot */
+#define BASELINE_MIN_MUS            1000000     /* Baseline is sampled for max(bit duration, 1 s) */
+#define MAX_RUN_DELAY               0.1         /* DEFAULT_PREEMPT_MAX_RUN_DELAY in preempt.h */
+#define MUS_PER_SEC                 1000000
+#define SYNTHETIC_SAMPLES           10000
+
+using Clock = std::chrono::steady_clock;
+
+typedef struct {
+   std::vector<int64_t> base, bit0, bit1;
+} distributions_t;
+
+/* One point in parameter space */
+typedef struct {
+   int participants;
+   int phases;
+   int bits;
+   int bit_mus;
+   double cutoff;
+   double skew_mus;
+} config_t;
+
+/* Knobs that are the same for every point */
+typedef struct {
+   double alpha;                /* Decide on p-values if > 0 */
+   double preempt_prob;
+   double preempt_mus;
+   double flip_prob;
+   int samples_per_sec;
+   bool repeat_phases;
+} model_t;
+
+typedef struct {
+   int correct;                 /* Participants that learned exactly the expected ids */
+   bool all_correct;
+   double mean_secs;            /* Protocol time, averaged over participants */
+   double max_secs;
+   int64_t reads;
+   int64_t read_errors;         /* Reads that differ from the slot's bit (whether anyone wrote in it) */
+} trial_t;
+
+typedef struct {
+   double start, end;
+} interval_t;
+
+static bool load_distributions(const char* path, distributions_t& dist)
+{
+   std::ifstream file(path);
+   if (!file)
+      return false;
+   std::stringstream ss;
+   ss << file.rdbuf();
+   std::string text = ss.str();
+   /* Either sample encoding; appended to what earlier files gave */
+   std::vector<int64_t> values;
+   if (find_samples(text, "Base Sample", values))    dist.base.insert(dist.base.end(), values.begin(), values.end());
+   if (find_samples(text, "Bit-0 Sample", values))   dist.bit0.insert(dist.bit0.end(), values.begin(), values.end());
+   if (find_samples(text, "Bit-1 Sample", values))   dist.bit1.insert(dist.bit1.end(), values.begin(), values.end());
+   return true;
+}
+
+/* Stand-in when no measurements are given: locked-op latencies (cycles) with a tail,
+ * roughly twice as slow under contention */
+static void synthetic_distributions(distributions_t& dist, uint64_t seed)
+{
+   std::mt19937_64 rng(seed);
+   std::lognormal_distribution<double> quiet(log(1000.0), 0.08), busy(log(2000.0), 0.25);
+   std::uniform_real_distribution<double> uniform(0, 1);
+   for (int i = 0; i < SYNTHETIC_SAMPLES; i++) {
+      double tail = uniform(rng) < 0.01 ? 3 : 1;
+      dist.base.push_back(quiet(rng) * tail);
+      dist.bit0.push_back(quiet(rng) * tail);
+      dist.bit1.push_back(busy(rng) * tail);
+   }
+}
+
+static std::vector<double> parse_doubles(const char* list)
+{
+   std::vector<double> values;
+   std::stringstream ss(list);
+   std::string item;
+   while (std::getline(ss, item, ','))
+      if (!item.empty())   values.push_back(atof(item.c_str()));
+   return values;
+}
+
+/* Remove [cut.start, cut.end) from an interval (leaves zero, one or two pieces) */
+static void subtract(const interval_t& from, const interval_t& cut, std::vector<interval_t>& out)
+{
+   if (cut.end <= from.start || cut.start >= from.end) {
+      out.push_back(from);
+      return;
+   }
+   if (cut.start > from.start)     out.push_back({ from.start, cut.start });
+   if (cut.end < from.end)         out.push_back({ cut.end, from.end });
+}
+
+/* Sort and merge into disjoint intervals */
+static void merge(std::vector<interval_t>& intervals)
+{
+   std::sort(intervals.begin(), intervals.end(), [](const interval_t& a, const interval_t& b) { return a.start < b.start; });
+   size_t out = 0;
+   for (size_t i = 0; i < intervals.size(); i++) {
+      if (out > 0 && intervals[i].start <= intervals[out - 1].end)
+         intervals[out - 1].end = std::max(intervals[out - 1].end, intervals[i].end);
+      else
+         intervals[out++] = intervals[i];
+   }
+   intervals.resize(out);
+}
+
+static inline int64_t draw(const std::vector<int64_t>& from, std::mt19937_64& rng)
+{
+   return from[rng() % from.size()];
+}
+
+/* Simulates one run of the protocol with distinct random ids. Time is in microseconds
+ * from the start of the first protocol slot on the reference clock. */
+static trial_t simulate(const config_t& cfg, const model_t& model, const distributions_t& dist, OnlineKS& ks, uint64_t seed)
+{
+   std::mt19937_64 rng(seed);
+   std::uniform_real_distribution<double> uniform(0, 1);
+   std::normal_distribution<double> skew(0, cfg.skew_mus > 0 ? cfg.skew_mus : 1);
+   std::exponential_distribution<double> preempt_len(1.0 / model.preempt_mus);
+   double mean_gap_mus = MUS_PER_SEC * 1.0 / model.samples_per_sec;
+   std::exponential_distribution<double> gap(1.0 / mean_gap_mus);
+   int n = cfg.participants;
+   int max_id = 1 << cfg.bits;
+
+   /* Ids, clocks and baselines */
+   std::vector<int> ids;
+   std::vector<bool> used(max_id, false);
+   while ((int) ids.size() < n) {
+      int id = 1 + rng() % (max_id - 1);
+      if (!used[id]) {
+         used[id] = true;
+         ids.push_back(id);
+      }
+   }
+   std::vector<double> offset(n, 0);
+   if (cfg.skew_mus > 0)
+      for (int i = 0; i < n; i++)    offset[i] = skew(rng);
+
+   int baseline_samples = (int64_t) std::max(cfg.bit_mus, BASELINE_MIN_MUS) * model.samples_per_sec / MUS_PER_SEC;
+   std::vector< std::vector<int64_t> > baselines(n);
+   for (int i = 0; i < n; i++) {
+      baselines[i].resize(baseline_samples);
+      for (int s = 0; s < baseline_samples; s++)    baselines[i][s] = draw(dist.base, rng);
+      std::sort(baselines[i].begin(), baselines[i].end());
+   }
+
+   std::vector<MembusProtocol> protocols;
+   for (int i = 0; i < n; i++)
+      protocols.push_back(MembusProtocol(ids[i], cfg.phases, cfg.bits, model.repeat_phases));
+   std::vector<int> slots_run(n, 0);
+
+   /* Slots go in lockstep (they are wall-clock slots); contention of the previous slot
+    * is kept around for participants whose clocks are behind */
+   trial_t trial = { 0, false, 0, 0, 0, 0 };
+   std::vector<interval_t> busy, prev_busy, pieces;
+   std::vector<interval_t> stall(n);
+   double window = std::max(0, cfg.bit_mus - WRITE_STOP_MUS);
+   for (int slot = 0; ; slot++) {
+      double slot_start = (double) slot * cfg.bit_mus;
+      bool any = false, written = false;
+
+      /* Where everyone is this slot, and who writes when */
+      busy.clear();
+      for (int i = 0; i < n; i++) {
+         if (protocols[i].done())
+            continue;
+         any = true;
+         double start = slot_start + offset[i];
+         stall[i] = { 0, 0 };
+         if (model.preempt_prob > 0 && uniform(rng) < model.preempt_prob) {
+            double at = start + uniform(rng) * window;
+            stall[i] = { at, at + preempt_len(rng) };
+         }
+         if (protocols[i].writing()) {
+            written = true;
+            pieces.clear();
+            subtract({ start, start + window }, stall[i], pieces);
+            busy.insert(busy.end(), pieces.begin(), pieces.end());
+         }
+      }
+      if (!any)
+         break;
+      std::vector<interval_t> contention = busy;
+      contention.insert(contention.end(), prev_busy.begin(), prev_busy.end());
+      merge(contention);
+
+      /* Reads */
+      for (int i = 0; i < n; i++) {
+         MembusProtocol& protocol = protocols[i];
+         if (protocol.done())
+            continue;
+         slots_run[i]++;
+         if (protocol.writing()) {
+            protocol.bit_done(1);
+            continue;
+         }
+
+         double start = slot_start + offset[i];
+         double stalled = std::max(0.0, std::min(stall[i].end, start + window) - stall[i].start);
+         bool erased = stalled > MAX_RUN_DELAY * cfg.bit_mus;
+         int bit = 0;
+         ks.set_baseline(baselines[i].data(), baselines[i].size());
+         size_t c = 0;
+         int num_samples = (int64_t) cfg.bit_mus * model.samples_per_sec / MUS_PER_SEC;
+         double t = start;
+         for (int s = 0; s < num_samples && t < start + window; s++) {
+            if (t < stall[i].start || t >= stall[i].end) {
+               while (c < contention.size() && contention[c].end <= t)    c++;
+               bool contended = c < contention.size() && contention[c].start <= t;
+               ks.add(draw(contended ? dist.bit1 : dist.bit0, rng));
+            }
+            t += gap(rng);
+         }
+         if (ks.size() > 0) {
+            double ksvalue = ks.statistic();
+            bit = model.alpha > 0 ? ks_pvalue(ks.baseline_size(), ks.size(), ks.max_distance()) < model.alpha : ksvalue >= cfg.cutoff;
+         }
+         if (model.flip_prob > 0 && uniform(rng) < model.flip_prob)
+            bit = !bit;
+         trial.reads++;
+         trial.read_errors += bit != written;
+         protocol.bit_done(bit, erased);
+      }
+      prev_busy.swap(busy);
+   }
+
+   /* The ids everyone should end up with: the largest ids in order, or the max id over and over */
+   std::vector<int> expected(ids);
+   std::sort(expected.rbegin(), expected.rend());
+   if (model.repeat_phases)
+      expected.assign(cfg.phases, expected[0]);
+   expected.resize(std::min(cfg.phases, (int) expected.size()));
+
+   trial.all_correct = true;
+   double baseline_secs = std::max(cfg.bit_mus, BASELINE_MIN_MUS) * 1.0 / MUS_PER_SEC;
+   for (int i = 0; i < n; i++) {
+      const result_t& result = protocols[i].get_result();
+      bool right = result.num_phases == (int) expected.size() && std::equal(expected.begin(), expected.end(), result.ids);
+      trial.correct += right;
+      trial.all_correct &= right;
+      double secs = baseline_secs + slots_run[i] * (double) cfg.bit_mus / MUS_PER_SEC;
+      trial.mean_secs += secs / n;
+      trial.max_secs = std::max(trial.max_secs, secs);
+   }
+   return trial;
+}
+
+int main(int argc, char** argv)
+{
+   const char *participants = DEFAULT_PARTICIPANTS, *phases = DEFAULT_PHASES, *bits = DEFAULT_BITS;
+   const char *bit_ms = DEFAULT_BIT_MS, *cutoffs = NULL, *skews = DEFAULT_SKEW_US;
+   const char* csv_path = NULL;
+   std::vector<const char*> files;
+   model_t model = { 0, 0, DEFAULT_PREEMPT_MS * 1000, 0, DEFAULT_SAMPLES_PER_SEC, DEFAULT_REPEAT_PHASES };
+   int trials = DEFAULT_TRIALS;
+   int threads = std::max(1u, std::thread::hardware_concurrency());
+   uint64_t seed = 1;
+
+   int opt;
+   while ((opt = getopt(argc, argv, "f:n:p:b:d:c:a:k:P:L:F:R:xt:j:s:o:")) != -1) {
+      switch (opt) {
+      case 'f':   files.push_back(optarg);                    break;
+      case 'n':   participants = optarg;                      break;
+      case 'p':   phases = optarg;                            break;
+      case 'b':   bits = optarg;                              break;
+      case 'd':   bit_ms = optarg;                            break;
+      case 'c':   cutoffs = optarg;                           break;
+      case 'a':   model.alpha = atof(optarg);                 break;
+      case 'k':   skews = optarg;                             break;
+      case 'P':   model.preempt_prob = atof(optarg);          break;
+      case 'L':   model.preempt_mus = atof(optarg) * 1000;    break;
+      case 'F':   model.flip_prob = atof(optarg);             break;
+      case 'R':   model.samples_per_sec = atoi(optarg);       break;
+      case 'x':   model.repeat_phases = false;                break;
+      case 't':   trials = atoi(optarg);                      break;
+      case 'j':   threads = atoi(optarg);                     break;
+      case 's':   seed = strtoull(optarg, NULL, 10);          break;
+      case 'o':   csv_path = optarg;                          break;
+      default:
+         printf("Usage: %s [-f response.json]... [-n participants] [-p phases] [-b bits] [-d bit_ms] [-c ks_cutoff] [-a ks_alpha]\n"
+                "          [-k skew_us] [-P preempt_prob] [-L preempt_ms] [-F flip_prob] [-R samples_per_sec] [-x] [-t trials]\n"
+                "          [-j threads] [-s seed] [-o results.csv]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   distributions_t dist;
+   for (size_t f = 0; f < files.size(); f++) {
+      if (!load_distributions(files[f], dist)) {
+         printf("ERROR! Cannot read %s\n", files[f]);
+         return 1;
+      }
+   }
+   if (files.empty())
+      synthetic_distributions(dist, seed);
+   if (dist.base.empty() || dist.bit0.empty() || dist.bit1.empty()) {
+      printf("ERROR! Need Base, Bit-0 and Bit-1 samples (run the handler with \"samples\": true); got %lu, %lu, %lu\n",
+         dist.base.size(), dist.bit0.size(), dist.bit1.size());
+      return 1;
+   }
+   printf("Latency samples: %lu base, %lu bit-0, %lu bit-1 (%s)\n", dist.base.size(), dist.bit0.size(), dist.bit1.size(),
+      files.empty() ? "synthetic" : "measured");
+
+   /* Every combination of the lists */
+   std::vector<config_t> configs;
+   std::vector<double> n_list = parse_doubles(participants), p_list = parse_doubles(phases), b_list = parse_doubles(bits);
+   std::vector<double> d_list = parse_doubles(bit_ms), k_list = parse_doubles(skews), c_list;
+   if (cutoffs != NULL)
+      c_list = parse_doubles(cutoffs);
+   else if (model.samples_per_sec > 0)
+      c_list.push_back(ks_mean_cutoff(DEFAULT_KS_CUTOFF, DEFAULT_SAMPLES_PER_SEC, model.samples_per_sec));
+   for (double n : n_list) for (double p : p_list) for (double b : b_list)
+      for (double d : d_list) for (double c : c_list) for (double k : k_list) {
+         config_t cfg = { (int) n, (int) p, (int) b, (int) (d * 1000), c, k };
+         if (cfg.bits < 2 || cfg.bits > 30 || cfg.participants < 1 || cfg.participants >= (1 << cfg.bits) - 1
+               || cfg.phases < 1 || cfg.phases > MAX_PHASES || cfg.bit_mus <= WRITE_STOP_MUS) {
+            printf("ERROR! Bad point: %d participants, %d phases, %d bits, %d ms bits (ids must fit in the bits, "
+               "phases at most %d, bits longer than %d ms)\n", cfg.participants, cfg.phases, cfg.bits, cfg.bit_mus / 1000,
+               MAX_PHASES, WRITE_STOP_MUS / 1000);
+            return 1;
+         }
+         configs.push_back(cfg);
+      }
+   if (configs.empty() || trials <= 0 || threads <= 0 || model.samples_per_sec <= 0 || model.preempt_mus <= 0) {
+      printf("ERROR! Nothing to simulate\n");
+      return 1;
+   }
+
+   /* Workers take (point, trial) pairs off a shared counter */
+   std::vector<trial_t> results(configs.size() * trials);
+   std::atomic<size_t> next(0);
+   auto start = Clock::now();
+   std::vector<std::thread> workers;
+   for (int w = 0; w < threads; w++) {
+      workers.push_back(std::thread([&]() {
+         OnlineKS ks;
+         size_t job;
+         while ((job = next.fetch_add(1)) < results.size())
+            results[job] = simulate(configs[job / trials], model, dist, ks, seed * 0x9E3779B97F4A7C15ULL + job);
+      }));
+   }
+   for (size_t w = 0; w < workers.size(); w++)
+      workers[w].join();
+   double wall_secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+   FILE* csv = csv_path ? fopen(csv_path, "w") : NULL;
+   if (csv)
+      fprintf(csv, "participants,phases,bits,bit_ms,cutoff,skew_us,trials,correct_frac,all_correct_frac,read_error_rate,mean_secs,max_secs\n");
+   printf("%6s %6s %4s %7s %6s %8s | %9s %9s %9s %9s %9s\n", "lambdas", "phases", "bits", "bit_ms",
+      model.alpha > 0 ? "alpha" : "cutoff", "skew_us", "correct", "all_ok", "read_err", "mean_s", "max_s");
+   for (size_t c = 0; c < configs.size(); c++) {
+      const config_t& cfg = configs[c];
+      double correct = 0, all_ok = 0, mean_secs = 0, max_secs = 0;
+      int64_t reads = 0, errors = 0;
+      for (int t = 0; t < trials; t++) {
+         const trial_t& trial = results[c * trials + t];
+         correct += trial.correct * 1.0 / cfg.participants / trials;
+         all_ok += trial.all_correct * 1.0 / trials;
+         mean_secs += trial.mean_secs / trials;
+         max_secs = std::max(max_secs, trial.max_secs);
+         reads += trial.reads;
+         errors += trial.read_errors;
+      }
+      double read_err = reads ? errors * 1.0 / reads : 0;
+      double threshold = model.alpha > 0 ? model.alpha : cfg.cutoff;
+      printf("%6d %6d %4d %7d %6g %8g | %8.2f%% %8.2f%% %8.4f%% %9.2f %9.2f\n", cfg.participants, cfg.phases, cfg.bits,
+         cfg.bit_mus / 1000, threshold, cfg.skew_mus, correct * 100, all_ok * 100, read_err * 100, mean_secs, max_secs);
+      if (csv)
+         fprintf(csv, "%d,%d,%d,%d,%g,%g,%d,%.6f,%.6f,%.6f,%.3f,%.3f\n", cfg.participants, cfg.phases, cfg.bits,
+            cfg.bit_mus / 1000, threshold, cfg.skew_mus, trials, correct, all_ok, read_err, mean_secs, max_secs);
+   }
+   if (csv)
+      fclose(csv);
+   printf("Simulated %lu runs in %.2f s on %d threads\n", results.size(), wall_secs, threads);
+   return 0;
+}
@@ -0,0 +1,226 @@
+/* Offline replay of read_bit decisions over binary traces recorded by the handler
+ * ("trace": true in the request; see trace.h). For each read bit, the recorded samples
+ * are run through read_bit's decision logic again (OnlineKS mean statistic against the
+ * cutoff, or its p-value against alpha, SPRT if the run used it; descheduled bits are
+ * decided the same way and only counted as erasures) with the run's own settings or
+ * with the ones given here, and the result is compared with what the handler decided.
+ * Every detector in the table below is also evaluated on each bit, so a new statistic
+ * can be tried on real traces by adding an entry there.
+ *
+ * Writes one CSV line per bit (to stdout, or -o) and a summary per trace to stderr.
+ * Dropped samples (-k, and the "dropped" column) only exist in traces from handlers
+ * that still dropped samples taken while descheduled; newer ones keep every sample.
+ *
+ * Usage: ./replay [-c ks_cutoff] [-a ks_alpha (decide on p-values)]
+ *                 [-k (keep dropped samples, old traces only)] [-o bits.csv] trace...
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+
+#include "trace.h"
+#include "kstest.h"
+#include "ksdist.h"
+#include "sprt.h"
+
+/* Statistic of a bit's samples against the (sorted) baseline */
+typedef double (*detector_fn)(const std::vector<int64_t>& base, std::vector<int64_t>& window);
+
+static double detect_ks_mean(const std::vector<int64_t>& base, std::vector<int64_t>& window)
+{
+   return kstest_mean((int64_t*) base.data(), base.size(), true, window.data(), window.size(), false);
+}
+
+/* kstest_mean() over histograms of the two samples, with bins just wide enough that the
+ * baseline's range fits (values further out are clamped into the edge bins): how much
+ * the statistic loses when the samples are kept as fixed-size histograms instead */
+static double detect_ks_hist(const std::vector<int64_t>& base, std::vector<int64_t>& window)
+{
+   static LatencyHistogram base_hist, window_hist;
+   if (base.empty() || window.empty())
+      return 0;
+   int shift = 0;
+   while (((base.back() - base.front()) >> shift) >= LatencyHistogram::DEFAULT_BINS)
+      shift++;
+   base_hist.configure(base.front(), LatencyHistogram::DEFAULT_BINS, shift);
+   window_hist.configure(base.front(), LatencyHistogram::DEFAULT_BINS, shift);
+   base_hist.add(base.data(), base.size());
+   window_hist.add(window.data(), window.size());
+   return kstest_mean(base_hist, window_hist);
+}
+
+static double detect_mean_ratio(const std::vector<int64_t>& base, std::vector<int64_t>& window)
+{
+   double b = 0, w = 0;
+   for (size_t i = 0; i < base.size(); i++)     b += base[i];
+   for (size_t i = 0; i < window.size(); i++)   w += window[i];
+   return base.empty() || window.empty() || b == 0 ? 0 : (w / window.size()) / (b / base.size());
+}
+
+/* Fraction of samples above the baseline's 99th percentile */
+static double detect_tail_fraction(const std::vector<int64_t>& base, std::vector<int64_t>& window)
+{
+   if (base.empty() || window.empty())
+      return 0;
+   int64_t p99 = base[(size_t) (base.size() * 0.99)];
+   size_t above = 0;
+   for (size_t i = 0; i < window.size(); i++)   above += window[i] > p99;
+   return above * 1.0 / window.size();
+}
+
+static const struct {
+   const char* name;
+   detector_fn fn;
+} detectors[] = {
+   { "ks_mean_full",   detect_ks_mean },
+   { "ks_hist",        detect_ks_hist },
+   { "mean_ratio",     detect_mean_ratio },
+   { "tail_fraction",  detect_tail_fraction },
+};
+static const int num_detectors = sizeof(detectors) / sizeof(detectors[0]);
+
+typedef struct {
+   double cutoff;               /* Override the trace's settings if >= 0 */
+   double alpha;
+   bool keep_dropped;
+} options_t;
+
+typedef struct {
+   int bits;
+   int written;
+   int agree;
+   int flipped_to_1;            /* Handler read 0, replay reads 1 */
+   int flipped_to_0;
+   int descheduled;
+} summary_t;
+
+static summary_t replay(const char* path, const trace_file_t& trace, const options_t& opts, FILE* out)
+{
+   const trace_header_t* h = trace.header;
+   summary_t summary = { 0, 0, 0, 0, 0, 0 };
+   bool use_pvalue = opts.alpha >= 0 ? true : opts.cutoff >= 0 ? false : h->use_pvalue;
+   double cutoff = opts.cutoff >= 0 ? opts.cutoff : h->ks_cutoff;
+   double alpha = opts.alpha >= 0 ? opts.alpha : h->ks_alpha;
+
+   /* Baseline: the calibration samples, as read_bit keeps them */
+   std::vector<int64_t> base, window;
+   for (uint64_t r = 0; r < trace.count; r++) {
+      const trace_record_t& rec = trace.records[r];
+      if (rec.kind == TRACE_BASE_SAMPLE && (opts.keep_dropped || !(rec.flags & TRACE_DROPPED)))
+         base.push_back(rec.value);
+   }
+   std::sort(base.begin(), base.end());
+   OnlineKS ks;
+   ks.set_baseline(base.data(), base.size());
+   SPRT sprt;
+   bool use_sprt = h->use_sprt;
+   if (use_sprt) {
+      sprt.configure(h->sprt_alpha, h->sprt_beta, h->sprt_p1, h->sprt_quantile);
+      use_sprt = sprt.set_baseline(base.data(), base.size());
+   }
+
+   int dropped = 0;
+   for (uint64_t r = 0; r < trace.count; r++) {
+      const trace_record_t& rec = trace.records[r];
+      switch (rec.kind) {
+      case TRACE_BIT_SAMPLE:
+         if (rec.flags & TRACE_DROPPED) {
+            dropped++;
+            if (!opts.keep_dropped)
+               break;
+         }
+         ks.add(rec.value);
+         if (use_sprt)   sprt.add(rec.value);
+         window.push_back(rec.value);
+         break;
+
+      case TRACE_BIT_WRITTEN:
+         summary.written++;
+         break;
+
+      case TRACE_BIT_READ: {
+         /* Same decision as read_bit */
+         double ksvalue = ks.statistic();
+         double pvalue = ks_pvalue(ks.baseline_size(), ks.size(), ks.max_distance());
+         int bit = use_pvalue ? pvalue < alpha : ksvalue >= cutoff;
+         if (use_sprt && sprt.get_decision() >= 0)
+            bit = sprt.get_decision();
+         bool descheduled = rec.flags & TRACE_DESCHEDULED;
+
+         summary.bits++;
+         summary.descheduled += descheduled;
+         summary.agree += bit == rec.value;
+         summary.flipped_to_1 += bit && !rec.value;
+         summary.flipped_to_0 += !bit && rec.value;
+
+         fprintf(out, "%s,%d,%d,%d,%lu,%d,%d,%d,%d,%.6f,%.6f,%.6g,%d", path, h->id, rec.phase, rec.bit_pos, window.size(),
+            dropped, descheduled, rec.value, bit, ksvalue, ks.max_distance(), pvalue, use_sprt ? sprt.get_decision() : -1);
+         for (int d = 0; d < num_detectors; d++)
+            fprintf(out, ",%.6f", detectors[d].fn(base, window));
+         fprintf(out, "\n");
+
+         ks.reset();
+         sprt.reset();
+         window.clear();
+         dropped = 0;
+         break;
+      }
+      }
+   }
+   return summary;
+}
+
+int main(int argc, char** argv)
+{
+   options_t opts = { -1, -1, false };
+   const char* out_path = NULL;
+   int opt;
+   while ((opt = getopt(argc, argv, "c:a:ko:")) != -1) {
+      switch (opt) {
+      case 'c':   opts.cutoff = atof(optarg);     break;
+      case 'a':   opts.alpha = atof(optarg);      break;
+      case 'k':   opts.keep_dropped = true;       break;
+      case 'o':   out_path = optarg;              break;
+      default:
+         printf("Usage: %s [-c ks_cutoff] [-a ks_alpha] [-k] [-o bits.csv] trace...\n", argv[0]);
+         return 1;
+      }
+   }
+   if (optind >= argc) {
+      printf("ERROR! Provide one or more trace files\n");
+      return 1;
+   }
+   FILE* out = out_path ? fopen(out_path, "w") : stdout;
+   if (out == NULL) {
+      printf("ERROR! Cannot write %s\n", out_path);
+      return 1;
+   }
+
+   fprintf(out, "trace,id,phase,bit_pos,samples,dropped,descheduled,recorded,replayed,ks_mean,ks_d,pvalue,sprt");
+   for (int d = 0; d < num_detectors; d++)
+      fprintf(out, ",%s", detectors[d].name);
+   fprintf(out, "\n");
+
+   for (int f = optind; f < argc; f++) {
+      trace_file_t trace;
+      if (!trace_map(argv[f], &trace)) {
+         fprintf(stderr, "ERROR! Cannot read trace %s: %s\n", argv[f], strerror(errno));
+         continue;
+      }
+      summary_t s = replay(argv[f], trace, opts, out);
+      fprintf(stderr, "%s: lambda %d, %lu records (%lu did not fit), %d bits read, %d written, %d descheduled; "
+         "replay agrees on %d, 0->1 on %d, 1->0 on %d\n", argv[f], trace.header->id, trace.count, trace.header->overflow,
+         s.bits, s.written, s.descheduled, s.agree, s.flipped_to_1, s.flipped_to_0);
+      trace_unmap(&trace);
+   }
+   if (out != stdout)
+      fclose(out);
+   return 0;
+}
@@ -0,0 +1,304 @@
+/* ROC and threshold sweep over the latency samples saved by experiments (invoke.py
+ * writes base_samples<id>, bit0_samples<id> and bit1_samples<id> into out/<experiment>
+ * for runs with "samples": true). Every sample file of the given experiments is
+ * memory-mapped and parsed on a pool of threads, and every base-vs-bit0 pair (a 0-bit)
+ * and base-vs-bit1 pair (a 1-bit) is scored with:
+ *   ks_mean      the KS mean statistic read_bit compares with DEFAULT_KS_MEAN_CUTOFF
+ *   ks_pvalue    -log10 of the KS p-value (p-value decisions, "ks_decision": "pvalue")
+ *   ttest        -log10 of the Welch t-test p-value
+ *   mean_lat     mean latency in cycles, which is what the covert channel receiver
+ *                compares with ATOMIC_OPS_LATENCY_WITH_LOCKING_THRESHOLD (per op)
+ * For each platform (experiments grouped by a key of their config.json, Region by
+ * default) and statistic, the ROC curve is swept over all thresholds and the one with
+ * the best TPR - FPR (Youden's J) is reported, along with the best one that keeps FPR
+ * under a target.
+ *
+ * Usage: ./rocsweep [-g config_key] [-f max_fpr] [-j threads] [-o roc.csv] out/<experiment>...
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kstest.h"
+#include "jsonreader.h"
+#include "ksdist.h"
+#include "latsort.h"
+
+#define DEFAULT_GROUP_KEY       "Region"
+#define DEFAULT_MAX_FPR         0.01
+#define MIN_PVALUE              1e-300          /* p-values are scored as -log10(p); keep them finite */
+
+double get_pvalue(const double* array1, int size1, const double* array2, int size2);     /* ttest.cpp */
+
+using Clock = std::chrono::steady_clock;
+
+enum { STAT_KS_MEAN, STAT_KS_PVALUE, STAT_TTEST, STAT_MEAN_LAT, NUM_STATS };
+static const char* stat_names[NUM_STATS] = { "ks_mean", "ks_pvalue", "ttest", "mean_lat" };
+static const char* stat_units[NUM_STATS] = { "", "-log10(p)", "-log10(p)", "cycles" };
+
+/* One lambda of one experiment */
+typedef struct {
+   int experiment;
+   int id;
+   std::string base, bit0, bit1;       /* Paths; empty if missing */
+} job_t;
+
+/* A scored base-vs-bit pair */
+typedef struct {
+   int group;
+   bool positive;                      /* bit1 (contention) pair */
+   double scores[NUM_STATS];
+} pair_t;
+
+/* Read the latencies of a sample file (a "Latencies" header, then one number per line) */
+static bool map_samples(const std::string& path, std::vector<int64_t>& out)
+{
+   out.clear();
+   int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0)
+      return false;
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+   }
+   if (st.st_size == 0) {                /* An empty file is an empty sample, mmap would refuse it */
+      close(fd);
+      return true;
+   }
+   const char* data = (const char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (data == MAP_FAILED)
+      return false;
+   madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+
+   const char* p = data;
+   const char* end = data + st.st_size;
+   while (p < end) {
+      /* Lines that do not start with a number (the header, blanks) are skipped */
+      if (*p >= '0' && *p <= '9') {
+         int64_t value = 0;
+         while (p < end && *p >= '0' && *p <= '9')    value = value * 10 + (*p++ - '0');
+         out.push_back(value);
+      }
+      while (p < end && *p != '\n')   p++;
+      p++;
+   }
+   munmap((void*) data, st.st_size);
+   return true;
+}
+
+/* Value of a key in config.json, or "" */
+static std::string config_value(const std::string& dir, const char* key)
+{
+   JsonDoc config;
+   if (!config.parse_file((dir + "/config.json").c_str()))
+      return "";
+   return config[key].as<std::string>("");
+}
+
+static void list_jobs(const std::string& dir, int experiment, std::vector<job_t>& jobs)
+{
+   std::map<int, job_t> by_id;
+   DIR* d = opendir(dir.c_str());
+   if (d == NULL) {
+      fprintf(stderr, "ERROR! Cannot open %s\n", dir.c_str());
+      return;
+   }
+   struct dirent* entry;
+   while ((entry = readdir(d)) != NULL) {
+      int id;
+      char kind[16];
+      if (sscanf(entry->d_name, "%15[a-z0-9]_samples%d", kind, &id) != 2)
+         continue;
+      job_t& job = by_id[id];
+      job.experiment = experiment;
+      job.id = id;
+      std::string path = dir + "/" + entry->d_name;
+      if (strcmp(kind, "base") == 0)         job.base = path;
+      else if (strcmp(kind, "bit0") == 0)    job.bit0 = path;
+      else if (strcmp(kind, "bit1") == 0)    job.bit1 = path;
+   }
+   closedir(d);
+   for (std::map<int, job_t>::iterator it = by_id.begin(); it != by_id.end(); ++it)
+      if (!it->second.base.empty() && (!it->second.bit0.empty() || !it->second.bit1.empty()))
+         jobs.push_back(it->second);
+}
+
+static void score(const std::vector<int64_t>& base, const std::vector<double>& base_d, OnlineKS& ks,
+   const std::vector<int64_t>& window, double* scores)
+{
+   ks.reset();
+   double mean = 0;
+   for (size_t i = 0; i < window.size(); i++) {
+      ks.add(window[i]);
+      mean += window[i];
+   }
+   scores[STAT_KS_MEAN] = ks.statistic();
+   double p = ks_pvalue(base.size(), window.size(), ks.max_distance());
+   scores[STAT_KS_PVALUE] = -log10(std::max(p, MIN_PVALUE));
+   std::vector<double> window_d(window.begin(), window.end());
+   p = get_pvalue(base_d.data(), base_d.size(), window_d.data(), window_d.size());
+   scores[STAT_TTEST] = -log10(std::max(p, MIN_PVALUE));
+   scores[STAT_MEAN_LAT] = mean / window.size();
+}
+
+typedef struct {
+   double threshold, tpr, fpr;
+} roc_point_t;
+
+/* ROC of "score >= threshold means a 1-bit", one point per distinct score */
+static std::vector<roc_point_t> roc_curve(std::vector< std::pair<double, bool> >& scored, double* auc)
+{
+   std::sort(scored.begin(), scored.end(), [](const std::pair<double, bool>& a, const std::pair<double, bool>& b) {
+      return a.first > b.first;
+   });
+   int pos = 0, neg = 0;
+   for (size_t i = 0; i < scored.size(); i++)   scored[i].second ? pos++ : neg++;
+
+   std::vector<roc_point_t> curve;
+   int tp = 0, fp = 0;
+   double area = 0, last_tpr = 0, last_fpr = 0;
+   curve.push_back({ INFINITY, 0, 0 });
+   for (size_t i = 0; i < scored.size(); ) {
+      double threshold = scored[i].first;
+      for (; i < scored.size() && scored[i].first == threshold; i++)
+         scored[i].second ? tp++ : fp++;
+      roc_point_t point = { threshold, pos ? tp * 1.0 / pos : 0, neg ? fp * 1.0 / neg : 0 };
+      area += (point.fpr - last_fpr) * (point.tpr + last_tpr) / 2;
+      last_tpr = point.tpr;
+      last_fpr = point.fpr;
+      curve.push_back(point);
+   }
+   *auc = area;
+   return curve;
+}
+
+int main(int argc, char** argv)
+{
+   const char* group_key = DEFAULT_GROUP_KEY;
+   const char* roc_path = NULL;
+   double max_fpr = DEFAULT_MAX_FPR;
+   int threads = std::max(1u, std::thread::hardware_concurrency());
+   int opt;
+   while ((opt = getopt(argc, argv, "g:f:j:o:")) != -1) {
+      switch (opt) {
+      case 'g':   group_key = optarg;             break;
+      case 'f':   max_fpr = atof(optarg);         break;
+      case 'j':   threads = atoi(optarg);         break;
+      case 'o':   roc_path = optarg;              break;
+      default:
+         printf("Usage: %s [-g config_key] [-f max_fpr] [-j threads] [-o roc.csv] experiment_dir...\n", argv[0]);
+         return 1;
+      }
+   }
+   if (optind >= argc || threads <= 0) {
+      printf("ERROR! Provide one or more experiment directories (and a positive thread count)\n");
+      return 1;
+   }
+
+   /* Experiments, their platform group and their lambdas */
+   std::vector<std::string> groups;
+   std::vector<int> group_of;
+   std::vector<job_t> jobs;
+   for (int e = optind; e < argc; e++) {
+      std::string group = config_value(argv[e], group_key);
+      if (group.empty())   group = "-";
+      std::vector<std::string>::iterator it = std::find(groups.begin(), groups.end(), group);
+      group_of.push_back(it - groups.begin());
+      if (it == groups.end())   groups.push_back(group);
+      list_jobs(argv[e], e - optind, jobs);
+   }
+   if (jobs.empty()) {
+      printf("ERROR! No base_samples<id> with bit0/bit1_samples<id> found\n");
+      return 1;
+   }
+
+   /* Score every pair on the pool; each job writes only its own two slots */
+   auto start = Clock::now();
+   std::vector<pair_t> pairs(jobs.size() * 2);
+   std::vector<char> valid(jobs.size() * 2, 0);
+   std::atomic<size_t> next(0);
+   std::vector<std::thread> workers;
+   for (int w = 0; w < threads; w++) {
+      workers.push_back(std::thread([&]() {
+         OnlineKS ks;
+         std::vector<int64_t> base, window;
+         size_t j;
+         while ((j = next.fetch_add(1)) < jobs.size()) {
+            const job_t& job = jobs[j];
+            if (!map_samples(job.base, base) || base.empty())
+               continue;
+            sort_latencies(base.data(), base.size());
+            ks.set_baseline(base.data(), base.size());
+            std::vector<double> base_d(base.begin(), base.end());
+            for (int bit = 0; bit < 2; bit++) {
+               const std::string& path = bit ? job.bit1 : job.bit0;
+               if (path.empty() || !map_samples(path, window) || window.empty())
+                  continue;
+               pair_t& pair = pairs[j * 2 + bit];
+               pair.group = group_of[job.experiment];
+               pair.positive = bit;
+               score(base, base_d, ks, window, pair.scores);
+               valid[j * 2 + bit] = 1;
+            }
+         }
+      }));
+   }
+   for (size_t w = 0; w < workers.size(); w++)
+      workers[w].join();
+   double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+   FILE* roc = roc_path ? fopen(roc_path, "w") : NULL;
+   if (roc)
+      fprintf(roc, "platform,statistic,threshold,tpr,fpr\n");
+   printf("%-16s %-10s %6s %6s %7s | %12s %7s %7s | %12s %7s %7s\n", "platform", "statistic", "zeros", "ones", "auc",
+      "best_thresh", "tpr", "fpr", "fpr_thresh", "tpr", "fpr");
+   for (size_t g = 0; g < groups.size(); g++) {
+      for (int s = 0; s < NUM_STATS; s++) {
+         std::vector< std::pair<double, bool> > scored;
+         int zeros = 0, ones = 0;
+         for (size_t p = 0; p < pairs.size(); p++) {
+            if (!valid[p] || pairs[p].group != (int) g)
+               continue;
+            scored.push_back(std::make_pair(pairs[p].scores[s], pairs[p].positive));
+            pairs[p].positive ? ones++ : zeros++;
+         }
+         if (scored.empty())
+            continue;
+
+         double auc;
+         std::vector<roc_point_t> curve = roc_curve(scored, &auc);
+         roc_point_t best = curve[0], capped = curve[0];
+         for (size_t c = 0; c < curve.size(); c++) {
+            if (curve[c].tpr - curve[c].fpr > best.tpr - best.fpr)     best = curve[c];
+            if (curve[c].fpr <= max_fpr && curve[c].tpr > capped.tpr)  capped = curve[c];
+            if (roc)
+               fprintf(roc, "%s,%s,%g,%.6f,%.6f\n", groups[g].c_str(), stat_names[s], curve[c].threshold, curve[c].tpr, curve[c].fpr);
+         }
+         printf("%-16s %-10s %6d %6d %7.4f | %12.4g %6.2f%% %6.2f%% | %12.4g %6.2f%% %6.2f%%  %s\n", groups[g].c_str(), stat_names[s],
+            zeros, ones, auc, best.threshold, best.tpr * 100, best.fpr * 100, capped.threshold, capped.tpr * 100, capped.fpr * 100,
+            stat_units[s]);
+      }
+   }
+   if (roc)
+      fclose(roc);
+   printf("Scored %lu pairs from %lu lambdas in %.2f s on %d threads\n",
+      (size_t) std::count(valid.begin(), valid.end(), 1), jobs.size(), secs, threads);
+   return 0;
+}
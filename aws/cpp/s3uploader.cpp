@@ -0,0 +1,299 @@
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/http/Scheme.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#include <aws/core/utils/stream/ResponseStream.h>
+#include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+
+#include "s3uploader.h"
+
+static const char TAG[] = "S3Uploader";
+
+using Clock = std::chrono::steady_clock;
+
+/* Request body read in place from the caller's buffer */
+static std::shared_ptr<Aws::IOStream> body_stream(const char* data, size_t length)
+{
+    return Aws::MakeShared<Aws::Utils::Stream::DefaultUnderlyingStream>(TAG,
+        Aws::MakeUnique<Aws::Utils::Stream::PreallocatedStreamBuf>(TAG, (unsigned char*) data, (uint64_t) length));
+}
+
+void S3Uploader::configure(const std::shared_ptr<Aws::Auth::AWSCredentialsProvider>& provider,
+    const Aws::Client::ClientConfiguration& config)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    warm = configured;
+    if (warm)
+        return;
+    configured = true;
+    this->provider = provider;
+    this->config = config;
+
+    const char* endpoint = getenv("S3_ENDPOINT");
+    if (endpoint != NULL && endpoint[0] != 0) {
+        std::string e(endpoint);
+        if (e.compare(0, 7, "http://") == 0) {
+            this->config.scheme = Aws::Http::Scheme::HTTP;
+            this->config.verifySSL = false;
+            e = e.substr(7);
+        }
+        else if (e.compare(0, 8, "https://") == 0)
+            e = e.substr(8);
+        this->config.endpointOverride = e;
+    }
+}
+
+std::shared_ptr<Aws::S3::S3Client> S3Uploader::get_client(bool rebuild)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (client == NULL || rebuild) {
+        /* Path-style addressing for endpoint overrides: local servers don't resolve <bucket>.host */
+        bool virtual_addressing = config.endpointOverride.empty();
+        client = Aws::MakeShared<Aws::S3::S3Client>(TAG, provider, config,
+            Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, virtual_addressing);
+    }
+    return client;
+}
+
+bool S3Uploader::check_bucket(const std::string& bucket, upload_result_t* result)
+{
+    if (!checked_buckets.insert(bucket).second)
+        return false;
+    static const char test_data[] = "Some data..";
+    job_t job = { bucket, S3_TEST_KEY, NULL, test_data, sizeof(test_data) - 1, "" };
+    *result = upload(job);
+    if (!result->ok)
+        checked_buckets.erase(bucket);      /* Try again next time */
+    return true;
+}
+
+void S3Uploader::put(const std::string& bucket, const std::string& key, const std::string& data)
+{
+    job_t job = { bucket, key, NULL, data.data(), data.size(), "" };
+    start(job);
+}
+
+void S3Uploader::put(const std::string& bucket, const std::string& key, std::string&& data)
+{
+    std::shared_ptr<std::string> owned = std::make_shared<std::string>(std::move(data));
+    job_t job = { bucket, key, owned, owned->data(), owned->size(), "" };
+    start(job);
+}
+
+void S3Uploader::put_file(const std::string& bucket, const std::string& key, const std::string& path)
+{
+    job_t job = { bucket, key, NULL, NULL, 0, path };
+    start(job);
+}
+
+void S3Uploader::start(const job_t& job)
+{
+    threads.push_back(std::thread(&S3Uploader::run, this, job));
+}
+
+std::vector<upload_result_t> S3Uploader::finished()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<upload_result_t> done;
+    done.swap(results);
+    return done;
+}
+
+std::vector<upload_result_t> S3Uploader::flush()
+{
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+    return finished();
+}
+
+void S3Uploader::run(job_t job)
+{
+    upload_result_t result = upload(job);
+    std::lock_guard<std::mutex> guard(lock);
+    results.push_back(result);
+}
+
+upload_result_t S3Uploader::upload(job_t job)
+{
+    Clock::time_point t0 = Clock::now();
+    upload_result_t result = { job.bucket, job.key, 0, false, 0, 0, 0, "" };
+
+    void* mapped = NULL;
+    if (!job.path.empty()) {
+        int fd = open(job.path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            result.error = std::string("cannot open ") + job.path + ": " + strerror(errno);
+        }
+        else if (st.st_size > 0) {
+            mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                mapped = NULL;
+                result.error = std::string("cannot map ") + job.path + ": " + strerror(errno);
+            }
+            else {
+                job.data = (const char*) mapped;
+                job.length = st.st_size;
+            }
+        }
+        else
+            job.data = "";
+        if (fd >= 0)
+            close(fd);
+    }
+    result.bytes = job.length;
+
+    if (job.data != NULL) {
+        const char* local_dir = getenv("LOCAL_S3_DIR");
+        if (local_dir != NULL && local_dir[0] != 0) {
+            result.attempts = 1;
+            result.ok = put_local(local_dir, job, result.error);
+        }
+        else {
+            /* Second attempt with a new client: covers expired credentials and dead connections */
+            for (int attempt = 0; attempt < 2 && !result.ok; attempt++) {
+                std::shared_ptr<Aws::S3::S3Client> c = get_client(attempt > 0);
+                result.attempts++;
+                result.error.clear();
+                try {
+                    result.ok = job.length > S3_MULTIPART_THRESHOLD ? put_multipart(*c, job, &result.parts, result.error)
+                        : put_object(*c, job, result.error);
+                }
+                catch (std::exception& e) {
+                    result.error = e.what();
+                }
+            }
+        }
+    }
+
+    if (mapped != NULL)
+        munmap(mapped, job.length);
+    result.ms = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count() / 1000.0;
+    return result;
+}
+
+bool S3Uploader::put_object(Aws::S3::S3Client& client, const job_t& job, std::string& error)
+{
+    Aws::S3::Model::PutObjectRequest request;
+    request.SetBucket(job.bucket);
+    request.SetKey(job.key);
+    request.SetContentLength(job.length);
+    request.SetBody(body_stream(job.data, job.length));
+
+    Aws::S3::Model::PutObjectOutcome outcome = client.PutObject(request);
+    if (!outcome.IsSuccess())
+        error = outcome.GetError().GetMessage();
+    return outcome.IsSuccess();
+}
+
+/* Parts go up from several threads, each straight from its slice of the buffer */
+bool S3Uploader::put_multipart(Aws::S3::S3Client& client, const job_t& job, int* parts, std::string& error)
+{
+    Aws::S3::Model::CreateMultipartUploadRequest create;
+    create.SetBucket(job.bucket);
+    create.SetKey(job.key);
+    Aws::S3::Model::CreateMultipartUploadOutcome created = client.CreateMultipartUpload(create);
+    if (!created.IsSuccess()) {
+        error = created.GetError().GetMessage();
+        return false;
+    }
+    Aws::String upload_id = created.GetResult().GetUploadId();
+
+    int num_parts = (int) ((job.length + S3_PART_SIZE - 1) / S3_PART_SIZE);
+    std::vector<Aws::String> etags(num_parts);
+    std::vector<std::string> errors(num_parts);
+    std::atomic<int> next(0);
+    std::atomic<bool> failed(false);
+    auto upload_parts = [&]() {
+        int p;
+        while (!failed.load() && (p = next.fetch_add(1)) < num_parts) {
+            size_t offset = (size_t) p * S3_PART_SIZE;
+            size_t length = std::min((size_t) S3_PART_SIZE, job.length - offset);
+            Aws::S3::Model::UploadPartRequest part;
+            part.SetBucket(job.bucket);
+            part.SetKey(job.key);
+            part.SetUploadId(upload_id);
+            part.SetPartNumber(p + 1);
+            part.SetContentLength(length);
+            part.SetBody(body_stream(job.data + offset, length));
+            Aws::S3::Model::UploadPartOutcome outcome = client.UploadPart(part);
+            if (outcome.IsSuccess())
+                etags[p] = outcome.GetResult().GetETag();
+            else {
+                errors[p] = outcome.GetError().GetMessage();
+                failed.store(true);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < std::min(num_parts, S3_PART_THREADS); t++)
+        workers.push_back(std::thread(upload_parts));
+    upload_parts();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+    *parts = num_parts;
+
+    if (!failed.load()) {
+        Aws::S3::Model::CompletedMultipartUpload uploaded;
+        for (int p = 0; p < num_parts; p++) {
+            Aws::S3::Model::CompletedPart part;
+            part.SetPartNumber(p + 1);
+            part.SetETag(etags[p]);
+            uploaded.AddParts(part);
+        }
+        Aws::S3::Model::CompleteMultipartUploadRequest complete;
+        complete.SetBucket(job.bucket);
+        complete.SetKey(job.key);
+        complete.SetUploadId(upload_id);
+        complete.SetMultipartUpload(uploaded);
+        Aws::S3::Model::CompleteMultipartUploadOutcome outcome = client.CompleteMultipartUpload(complete);
+        if (outcome.IsSuccess())
+            return true;
+        error = outcome.GetError().GetMessage();
+    }
+    else {
+        for (int p = 0; p < num_parts && error.empty(); p++)
+            error = errors[p];
+    }
+
+    /* Don't leave the parts behind (they are billed until aborted) */
+    Aws::S3::Model::AbortMultipartUploadRequest abort;
+    abort.SetBucket(job.bucket);
+    abort.SetKey(job.key);
+    abort.SetUploadId(upload_id);
+    client.AbortMultipartUpload(abort);
+    return false;
+}
+
+bool S3Uploader::put_local(const char* dir, const job_t& job, std::string& error)
+{
+    std::string path = std::string(dir) + "/" + job.bucket;
+    mkdir(path.c_str(), 0755);
+    path += "/" + job.key;
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL || fwrite(job.data, 1, job.length, file) != job.length) {
+        error = std::string("cannot write ") + path + ": " + strerror(errno);
+        if (file != NULL)
+            fclose(file);
+        return false;
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef S3UPLOADER_H
+#define S3UPLOADER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <aws/core/Aws.h>
+#include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/client/ClientConfiguration.h>
+#include <aws/s3/S3Client.h>
+
+#define S3_MULTIPART_THRESHOLD  (16 << 20)      /* Bodies larger than this go up in parts */
+#define S3_PART_SIZE            (8 << 20)       /* S3 wants at least 5 MB in every part but the last */
+#define S3_PART_THREADS         4               /* Parts in flight at once */
+#define S3_TEST_KEY             "temp"
+
+typedef struct {
+    std::string bucket;
+    std::string key;
+    size_t bytes;
+    bool ok;
+    int attempts;               /* 2 if the first one failed and was retried with a new client */
+    int parts;                  /* 0 for a single PutObject */
+    double ms;
+    std::string error;
+} upload_result_t;
+
+/* Uploads to S3 that outlive the invocation that started them. One client is kept for
+ * the life of the sandbox, so warm invocations reuse its connections; the client signs
+ * every request with fresh credentials from the provider, and if a request fails anyway
+ * (expired token, connection dropped while idle) it is rebuilt and the upload retried
+ * once. Uploads run in the background and are sent straight from the caller's buffer
+ * or a mapped file; the handler must flush() before returning, as the sandbox is frozen
+ * (background threads included) once it has.
+ *
+ * Local stand-ins: with LOCAL_S3_DIR set (lambdaemu), objects are written to
+ * <LOCAL_S3_DIR>/<bucket>/<key>; with S3_ENDPOINT set (e.g. http://127.0.0.1:9000 for
+ * an S3-compatible server), requests go there with path-style addressing.
+ */
+class S3Uploader
+{
+public:
+    S3Uploader() : configured(false), warm(false) { }
+    ~S3Uploader()               { flush(); }
+
+    /* Called by every invocation; the client is only built the first time */
+    void configure(const std::shared_ptr<Aws::Auth::AWSCredentialsProvider>& provider,
+        const Aws::Client::ClientConfiguration& config);
+
+    /* Test write to the bucket, once per bucket in this sandbox (till one succeeds). Waits
+     * for it, so it is over before anything timing-sensitive starts. Returns false if the
+     * bucket was already checked, and result is left alone. */
+    bool check_bucket(const std::string& bucket, upload_result_t* result);
+
+    /* Starts an upload of data, which must stay alive and unchanged until flush() */
+    void put(const std::string& bucket, const std::string& key, const std::string& data);
+    /* Same, for data the uploader takes over */
+    void put(const std::string& bucket, const std::string& key, std::string&& data);
+    /* Same, for a file (mapped, not read in) */
+    void put_file(const std::string& bucket, const std::string& key, const std::string& path);
+
+    /* Results of the uploads finished so far, without waiting */
+    std::vector<upload_result_t> finished();
+    /* Waits for every upload; returns the results not collected yet */
+    std::vector<upload_result_t> flush();
+
+    /* Whether an earlier invocation set the uploader (and its client) up */
+    bool is_warm() const        { return warm; }
+
+private:
+    typedef struct {
+        std::string bucket;
+        std::string key;
+        std::shared_ptr<std::string> owned;
+        const char* data;
+        size_t length;
+        std::string path;       /* put_file: mapped by the upload thread */
+    } job_t;
+
+    void start(const job_t& job);
+    void run(job_t job);
+    upload_result_t upload(job_t job);
+    std::shared_ptr<Aws::S3::S3Client> get_client(bool rebuild);
+    bool put_object(Aws::S3::S3Client& client, const job_t& job, std::string& error);
+    bool put_multipart(Aws::S3::S3Client& client, const job_t& job, int* parts, std::string& error);
+    bool put_local(const char* dir, const job_t& job, std::string& error);
+
+    std::shared_ptr<Aws::Auth::AWSCredentialsProvider> provider;
+    Aws::Client::ClientConfiguration config;
+    std::shared_ptr<Aws::S3::S3Client> client;
+    bool configured;
+    bool warm;
+    std::set<std::string> checked_buckets;
+
+    std::mutex lock;            /* Guards client and results */
+    std::vector<std::thread> threads;
+    std::vector<upload_result_t> results;
+};
+
+#endif /* S3UPLOADER_H */
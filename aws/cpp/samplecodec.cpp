@@ -0,0 +1,220 @@
+#include <cstring>
+#include <cstdlib>
+#include "samplecodec.h"
+
+static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+const char* encoding_name(sample_encoding_t encoding)
+{
+    return encoding == ENCODING_DELTA_VARINT ? "delta-varint" : "decimal";
+}
+
+bool parse_encoding(const std::string& name, sample_encoding_t* encoding)
+{
+    if (name == "decimal")              *encoding = ENCODING_DECIMAL;
+    else if (name == "delta-varint")    *encoding = ENCODING_DELTA_VARINT;
+    else                                return false;
+    return true;
+}
+
+static inline void put_varint(std::vector<uint8_t>& buf, uint64_t v)
+{
+    while (v >= 0x80) {
+        buf.push_back((uint8_t) (v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back((uint8_t) v);
+}
+
+static inline bool get_varint(const std::vector<uint8_t>& buf, size_t* pos, uint64_t* v)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < buf.size(); shift += 7) {
+        uint8_t byte = buf[(*pos)++];
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void base64_encode(const uint8_t* data, size_t length, std::string& out)
+{
+    out.reserve(out.size() + (length + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t triple = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+        out += BASE64_CHARS[(triple >> 18) & 0x3f];
+        out += BASE64_CHARS[(triple >> 12) & 0x3f];
+        out += BASE64_CHARS[(triple >> 6) & 0x3f];
+        out += BASE64_CHARS[triple & 0x3f];
+    }
+    if (i < length) {
+        uint32_t triple = data[i] << 16;
+        if (i + 1 < length)     triple |= data[i+1] << 8;
+        out += BASE64_CHARS[(triple >> 18) & 0x3f];
+        out += BASE64_CHARS[(triple >> 12) & 0x3f];
+        out += i + 1 < length ? BASE64_CHARS[(triple >> 6) & 0x3f] : '=';
+        out += '=';
+    }
+}
+
+bool base64_decode(const char* text, size_t length, std::vector<uint8_t>& out)
+{
+    static int8_t table[256];
+    if (table['B'] == 0) {
+        memset(table, -1, sizeof(table));
+        for (int i = 0; i < 64; i++)
+            table[(uint8_t) BASE64_CHARS[i]] = i;
+    }
+
+    out.clear();
+    out.reserve(length / 4 * 3);
+    uint32_t bits = 0;
+    int nbits = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '=')
+            break;
+        int8_t v = table[(uint8_t) text[i]];
+        if (v < 0)
+            return false;
+        bits = (bits << 6) | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            out.push_back((uint8_t) (bits >> nbits));
+        }
+    }
+    return true;
+}
+
+std::string encode_samples(const int64_t* values, size_t n)
+{
+    std::vector<uint8_t> buf;
+    buf.reserve(n * 2 + 10);
+    put_varint(buf, n);
+    int64_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t delta = (int64_t) ((uint64_t) values[i] - (uint64_t) prev);
+        put_varint(buf, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));     /* zigzag */
+        prev = values[i];
+    }
+    std::string out;
+    base64_encode(buf.data(), buf.size(), out);
+    return out;
+}
+
+bool decode_samples(const char* text, size_t length, std::vector<int64_t>& values)
+{
+    std::vector<uint8_t> buf;
+    size_t pos = 0;
+    uint64_t n, zz;
+    if (!base64_decode(text, length, buf) || !get_varint(buf, &pos, &n) || n > buf.size())
+        return false;
+
+    values.clear();
+    values.reserve(n);
+    int64_t prev = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (!get_varint(buf, &pos, &zz))
+            return false;
+        prev = (int64_t) ((uint64_t) prev + ((zz >> 1) ^ (0 - (zz & 1))));
+        values.push_back(prev);
+    }
+    return true;
+}
+
+std::string encode_bits(const std::vector<bool>& bits)
+{
+    std::vector<uint8_t> buf;
+    put_varint(buf, bits.size());
+    size_t start = buf.size();
+    buf.resize(start + (bits.size() + 7) / 8, 0);
+    for (size_t i = 0; i < bits.size(); i++)
+        if (bits[i])
+            buf[start + i / 8] |= 0x80 >> (i % 8);
+    std::string out;
+    base64_encode(buf.data(), buf.size(), out);
+    return out;
+}
+
+bool decode_bits(const char* text, size_t length, std::vector<bool>& bits)
+{
+    std::vector<uint8_t> buf;
+    size_t pos = 0;
+    uint64_t n;
+    if (!base64_decode(text, length, buf) || !get_varint(buf, &pos, &n) || (n + 7) / 8 > buf.size() - pos)
+        return false;
+
+    bits.assign(n, false);
+    for (size_t i = 0; i < n; i++)
+        bits[i] = buf[pos + i / 8] & (0x80 >> (i % 8));
+    return true;
+}
+
+/* Locates the string value of key: skips the (possibly escaped) quotes and colon after it
+ * and the value's opening quote, and ends at the next quote or backslash, which neither
+ * encoding contains (so an empty value is found as one) */
+static bool find_value(const std::string& text, const char* key, const char** value, size_t* length)
+{
+    size_t keylen = strlen(key);
+    size_t at = text.find(key);
+    while (at != std::string::npos && at + keylen < text.size() && text[at + keylen] != '"' && text[at + keylen] != '\\')
+        at = text.find(key, at + 1);
+    if (at == std::string::npos)
+        return false;
+    at = text.find(':', at + keylen);
+    if (at == std::string::npos)
+        return false;
+    size_t start = text.find_first_not_of(" \t\\", at + 1);
+    if (start == std::string::npos || text[start] != '"')
+        return false;
+    start++;
+    size_t end = text.find_first_of("\\\"", start);
+    *value = text.c_str() + start;
+    *length = (end == std::string::npos ? text.size() : end) - start;
+    return true;
+}
+
+bool find_samples(const std::string& text, const char* key, std::vector<int64_t>& values)
+{
+    const char* value;
+    size_t length;
+    if (!find_value(text, key, &value, &length))
+        return false;
+
+    /* Base64 has no commas; the decimal list always ends with one (or is empty) */
+    if (length > 0 && memchr(value, ',', length) == NULL)
+        return decode_samples(value, length, values);
+    values.clear();
+    const char* p = value;
+    const char* stop = value + length;
+    while (p < stop) {
+        char* next;
+        long long v = strtoll(p, &next, 10);
+        if (next == p)  p++;
+        else {
+            values.push_back(v);
+            p = next;
+        }
+    }
+    return true;
+}
+
+bool find_bits(const std::string& text, const char* key, std::vector<bool>& bits)
+{
+    const char* value;
+    size_t length;
+    if (!find_value(text, key, &value, &length))
+        return false;
+
+    /* '0'/'1' per bit, or base64 (which a long enough bit string never looks like) */
+    if (strspn(value, "01") < length)
+        return decode_bits(value, length, bits);
+    bits.clear();
+    for (size_t i = 0; i < length; i++)
+        bits.push_back(value[i] == '1');
+    return true;
+}
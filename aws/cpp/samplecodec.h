@@ -0,0 +1,38 @@
+#ifndef SAMPLECODEC_H
+#define SAMPLECODEC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Encodings of the sample arrays ("Base Sample", "Bit-1 Sample", ...) and channel data
+ * in the handler's response, selected per request with "encoding" */
+typedef enum {
+    ENCODING_DECIMAL = 0,       /* "1203,1188,1240," and one '0'/'1' character per bit (default) */
+    ENCODING_DELTA_VARINT,      /* base64 of the formats below */
+} sample_encoding_t;
+
+const char* encoding_name(sample_encoding_t encoding);
+bool parse_encoding(const std::string& name, sample_encoding_t* encoding);
+
+/* Samples: LEB128 varint count, then each value's difference from the previous one
+ * (the first from 0), zigzag-mapped and LEB128 varint-encoded. Latencies sit in a narrow
+ * range, and the sorted base sample becomes mostly single-byte deltas. Base64 (standard
+ * alphabet, padded) so it stays a plain JSON string. */
+std::string encode_samples(const int64_t* values, size_t n);
+bool decode_samples(const char* text, size_t length, std::vector<int64_t>& values);
+
+/* Bits: varint bit count, then the bits packed MSB first, base64 like the samples */
+std::string encode_bits(const std::vector<bool>& bits);
+bool decode_bits(const char* text, size_t length, std::vector<bool>& bits);
+
+/* Pull the named sample list ("Base Sample", ...) out of the raw text of a saved response,
+ * in either encoding. Works whether or not the body was JSON-escaped again inside the
+ * Lambda envelope. Returns false if the key is missing or its value does not decode. */
+bool find_samples(const std::string& text, const char* key, std::vector<int64_t>& values);
+bool find_bits(const std::string& text, const char* key, std::vector<bool>& bits);
+
+void base64_encode(const uint8_t* data, size_t length, std::string& out);
+bool base64_decode(const char* text, size_t length, std::vector<uint8_t>& out);
+
+#endif /* SAMPLECODEC_H */
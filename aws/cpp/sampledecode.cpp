@@ -0,0 +1,152 @@
+/* Decodes sample arrays and channel data from handler responses in either encoding
+ * ("encoding": "decimal" or "delta-varint", see samplecodec.h), for analysis of results
+ * saved to S3.
+ *
+ * With -k, each file is a saved response and the value of that key is decoded ("Base
+ * Sample", "Bit-0 Sample", "Bit-1 Sample", or "Data" with -b). Without -k, each input
+ * line is one encoded value. Samples are printed one per line, under a "Latencies"
+ * header with -H (the format of the sample files invoke.py writes, which rocsweep
+ * reads); bits as a '0'/'1' string. -s prints the decimal and encoded sizes to stderr.
+ * -e does the reverse: encodes one decimal sample per input line into a delta-varint
+ * string.
+ *
+ * Usage: ./sampledecode [-k key] [-b (bits)] [-H] [-s] [-e] [-o out] [file...]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "samplecodec.h"
+
+typedef struct {
+   const char* key;
+   bool bits;
+   bool header;
+   bool sizes;
+} options_t;
+
+static size_t decimal_size(const std::vector<int64_t>& values)
+{
+   size_t size = 0;
+   char buf[24];
+   for (size_t i = 0; i < values.size(); i++)
+      size += snprintf(buf, sizeof(buf), "%lld,", (long long) values[i]);
+   return size;
+}
+
+static bool decode(const std::string& text, const char* name, const options_t& opts, FILE* out)
+{
+   if (opts.bits) {
+      std::vector<bool> bits;
+      bool ok = opts.key ? find_bits(text, opts.key, bits) : decode_bits(text.data(), text.size(), bits);
+      if (!ok) {
+         fprintf(stderr, "ERROR! Cannot decode bits in %s\n", name);
+         return false;
+      }
+      for (size_t i = 0; i < bits.size(); i++)
+         fputc(bits[i] ? '1' : '0', out);
+      fputc('\n', out);
+      if (opts.sizes)
+         fprintf(stderr, "%s: %lu bits\n", name, bits.size());
+      return true;
+   }
+
+   std::vector<int64_t> values;
+   bool ok = opts.key ? find_samples(text, opts.key, values) : decode_samples(text.data(), text.size(), values);
+   if (!ok) {
+      fprintf(stderr, "ERROR! Cannot decode samples in %s\n", name);
+      return false;
+   }
+   if (opts.header)
+      fprintf(out, "Latencies\n");
+   for (size_t i = 0; i < values.size(); i++)
+      fprintf(out, "%lld\n", (long long) values[i]);
+   if (opts.sizes) {
+      size_t encoded = encode_samples(values.data(), values.size()).size();
+      size_t decimal = decimal_size(values);
+      fprintf(stderr, "%s: %lu samples, %lu bytes as decimal, %lu as delta-varint (%.1fx)\n", name,
+         values.size(), decimal, encoded, encoded ? decimal * 1.0 / encoded : 0);
+   }
+   return true;
+}
+
+/* One decimal value per line (blank lines and a header line are skipped) */
+static void encode(std::istream& in, FILE* out)
+{
+   std::vector<int64_t> values;
+   std::string line;
+   while (std::getline(in, line)) {
+      char* end;
+      long long v = strtoll(line.c_str(), &end, 10);
+      if (end != line.c_str())
+         values.push_back(v);
+   }
+   fprintf(out, "%s\n", encode_samples(values.data(), values.size()).c_str());
+}
+
+int main(int argc, char** argv)
+{
+   options_t opts = { NULL, false, false, false };
+   bool encoding = false;
+   const char* out_path = NULL;
+   int opt;
+   while ((opt = getopt(argc, argv, "k:bHseo:")) != -1) {
+      switch (opt) {
+      case 'k':   opts.key = optarg;         break;
+      case 'b':   opts.bits = true;          break;
+      case 'H':   opts.header = true;        break;
+      case 's':   opts.sizes = true;         break;
+      case 'e':   encoding = true;           break;
+      case 'o':   out_path = optarg;         break;
+      default:
+         printf("Usage: %s [-k key] [-b] [-H] [-s] [-e] [-o out] [file...]\n", argv[0]);
+         return 1;
+      }
+   }
+   FILE* out = out_path ? fopen(out_path, "w") : stdout;
+   if (out == NULL) {
+      printf("ERROR! Cannot write %s\n", out_path);
+      return 1;
+   }
+
+   int failed = 0;
+   for (int f = optind; f < argc || f == optind; f++) {
+      const char* name = f < argc ? argv[f] : "stdin";
+      std::ifstream file;
+      if (f < argc) {
+         file.open(argv[f]);
+         if (!file) {
+            fprintf(stderr, "ERROR! Cannot read %s\n", argv[f]);
+            failed++;
+            continue;
+         }
+      }
+      std::istream& in = f < argc ? file : std::cin;
+
+      if (encoding) {
+         encode(in, out);
+      }
+      else if (opts.key) {
+         std::stringstream ss;
+         ss << in.rdbuf();
+         failed += !decode(ss.str(), name, opts, out);
+      }
+      else {
+         std::string line;
+         while (std::getline(in, line))
+            if (!line.empty())
+               failed += !decode(line, name, opts, out);
+      }
+   }
+   if (out != stdout)
+      fclose(out);
+   return failed > 0;
+}
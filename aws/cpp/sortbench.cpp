@@ -0,0 +1,82 @@
+/* Benchmark for sorting latency samples: LatencySorter (counting/radix) against
+ * timSort and std::sort at the sample sizes the protocol sees (1k per bit at the
+ * default rate, 5k baselines, 100k at high rates or in offline analysis).
+ * Inputs look like membus latencies: a bulk around a few thousand cycles plus rare
+ * large outliers (preemptions), which push the sorter from counting to radix sort.
+ *
+ * Usage: ./sortbench [repetitions]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "latsort.h"
+
+#define DEFAULT_REPETITIONS     50
+
+using Clock = std::chrono::high_resolution_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+typedef void (*sort_fn)(int64_t arr[], int n);
+
+static void std_sort(int64_t arr[], int n)     { std::sort(arr, arr + n); }
+
+static LatencySorter sorter;
+static void latency_sort(int64_t arr[], int n) { sorter.sort(arr, n); }
+
+/* Median time (ns) to sort a copy of the input */
+static int64_t time_sort(sort_fn fn, const std::vector<int64_t>& input, std::vector<int64_t>& expected, int reps)
+{
+   std::vector<int64_t> times, arr;
+   for (int r = 0; r < reps; r++) {
+      arr = input;
+      Clock::time_point t0 = Clock::now();
+      fn(arr.data(), arr.size());
+      Clock::time_point t1 = Clock::now();
+      times.push_back(duration_cast<nanoseconds>(t1 - t0).count());
+      if (arr != expected) {
+         printf("ERROR! Array not sorted properly!\n");
+         exit(1);
+      }
+   }
+   std::sort(times.begin(), times.end());
+   return times[times.size() / 2];
+}
+
+int main(int argc, char** argv)
+{
+   int reps = argc > 1 ? atoi(argv[1]) : DEFAULT_REPETITIONS;
+   if (reps <= 0) {
+      printf("ERROR! Provide a positive number of repetitions\n");
+      return 1;
+   }
+
+   int sizes[] = {1000, 5000, 100000};
+   double outlier_rates[] = {0, 0.001};
+   srand(1);
+   printf("%8s %9s %12s %12s %12s\n", "size", "outliers", "timSort", "std::sort", "LatencySort");
+   for (int s = 0; s < 3; s++) {
+      for (int o = 0; o < 2; o++) {
+         int n = sizes[s];
+         std::vector<int64_t> input(n);
+         for (int i = 0; i < n; i++) {
+            input[i] = 3500 + rand() % 2000;
+            if (rand() < outlier_rates[o] * RAND_MAX)
+               input[i] = 20000 + rand() % 1000000;
+         }
+         std::vector<int64_t> expected = input;
+         std::sort(expected.begin(), expected.end());
+
+         printf("%8d %9.3f %10ld ns %9ld ns %9ld ns\n", n, outlier_rates[o],
+            time_sort(timSort, input, expected, reps),
+            time_sort(std_sort, input, expected, reps),
+            time_sort(latency_sort, input, expected, reps));
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,43 @@
+#include <cmath>
+
+#include "sprt.h"
+
+/* Keep p0 away from 0 and 1 so that a single sample can never be infinitely convincing */
+#define SPRT_MIN_P      0.01
+#define SPRT_MAX_P      0.99
+
+void SPRT::configure(double alpha, double beta, double p1, double quantile)
+{
+    this->alpha = alpha;
+    this->beta = beta;
+    this->p1 = p1;
+    this->quantile = quantile;
+    upper = log((1 - beta) / alpha);
+    lower = log(beta / (1 - alpha));
+    enabled = false;
+    reset();
+}
+
+bool SPRT::set_baseline(const int64_t* sorted, int size)
+{
+    enabled = false;
+    if (size <= 0 || alpha <= 0 || alpha >= 1 || beta <= 0 || beta >= 1 || quantile < 0 || quantile >= 1)
+        return false;
+
+    /* Threshold at the quantile; p0 is what actually lies above it (latencies have lots of ties) */
+    int idx = (int) (quantile * (size - 1));
+    threshold = sorted[idx];
+    int above = size;
+    while (above > 0 && sorted[above - 1] > threshold)  above--;
+    p0 = (size - above) * 1.0 / size;
+    if (p0 < SPRT_MIN_P)    p0 = SPRT_MIN_P;
+    if (p0 > SPRT_MAX_P)    p0 = SPRT_MAX_P;
+    if (p1 <= p0 || p1 >= 1)
+        return false;
+
+    inc_above = log(p1 / p0);
+    inc_below = log((1 - p1) / (1 - p0));
+    enabled = true;
+    reset();
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef SPRT_H
+#define SPRT_H
+
+#include <cstdint>
+
+/* Wald's sequential probability ratio test for reading a bit early.
+ * Each latency sample is reduced to a coin flip: does it exceed a quantile of the
+ * baseline sample? Without contention that happens with probability p0 (measured
+ * on the baseline), with contention we expect p1 > p0. The log-likelihood ratio
+ * is accumulated per sample and a decision is made as soon as it crosses the bounds
+ * given by the tolerated false-positive (alpha) and false-negative (beta) rates.
+ */
+class SPRT
+{
+public:
+    SPRT() : enabled(false), threshold(0), p0(0), inc_above(0), inc_below(0),
+        upper(0), lower(0), llr(0), samples(0), decision(-1) {}
+
+    /* Error bounds and the fraction of samples above threshold expected under contention */
+    void configure(double alpha, double beta, double p1, double quantile);
+
+    /* Derive threshold and p0 from a sorted baseline sample. Returns false (and disables
+     * the test) if the baseline cannot separate p0 from p1. */
+    bool set_baseline(const int64_t* sorted, int size);
+
+    void reset() { llr = 0; samples = 0; decision = -1; }
+
+    /* Add a sample; returns the decision (0/1) once made, -1 while undecided */
+    inline int add(int64_t latency) {
+        if (decision >= 0)  return decision;
+        llr += latency > threshold ? inc_above : inc_below;
+        samples++;
+        if (llr >= upper)         decision = 1;
+        else if (llr <= lower)    decision = 0;
+        return decision;
+    }
+
+    bool is_enabled() const         { return enabled; }
+    int get_decision() const        { return decision; }
+    int get_samples() const         { return samples; }
+    int64_t get_threshold() const   { return threshold; }
+    double get_p0() const           { return p0; }
+
+private:
+    bool enabled;
+    double alpha, beta, p1, quantile;
+    int64_t threshold;
+    double p0;
+    double inc_above, inc_below;        /* LLR increments for a sample above/below threshold */
+    double upper, lower;                /* Decision bounds on the LLR                        */
+    double llr;
+    int samples;
+    int decision;
+};
+
+#endif /* SPRT_H */
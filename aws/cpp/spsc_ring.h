@@ -0,0 +1,69 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#define SPSC_CACHELINE_SIZE     64
+
+/* Bounded lock-free queue for exactly one producer and one consumer thread.
+ * Capacity is rounded up to a power of two. Head and tail live on their own cache
+ * lines and each side keeps a cached copy of the other's index, so in the common
+ * case a push or pop touches no cache line the other thread is writing.
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t min_capacity) : head(0), cached_tail(0), tail(0), cached_head(0) {
+        size_t capacity = 1;
+        while (capacity < min_capacity)  capacity <<= 1;
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    /* Producer side. Returns false if the ring is full. */
+    inline bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+                return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer side. Returns false if the ring is empty. */
+    inline bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const     { return mask + 1; }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    /* Written by the consumer */
+    alignas(SPSC_CACHELINE_SIZE) std::atomic<size_t> head;
+    size_t cached_tail;
+
+    /* Written by the producer */
+    alignas(SPSC_CACHELINE_SIZE) std::atomic<size_t> tail;
+    size_t cached_head;
+
+    char pad[SPSC_CACHELINE_SIZE - sizeof(size_t) * 2];
+};
+
+#endif /* SPSC_RING_H */
@@ -7,6 +7,8 @@
 #include <ctime>
 #include <cstdlib>
 
+#include "latsort.h"
+
 using namespace std;
 using Clock = std::chrono::high_resolution_clock;
 using microseconds = std::chrono::microseconds;
@@ -35,12 +37,15 @@ void insertionSort(int64_t arr[], int left, int right)
 } 
   
 // merge function merges the sorted runs 
-void merge(int64_t arr[], int l, int m, int r) 
+// (halves are copied to a caller-provided buffer of at least r-l+1 
+// elements; stack arrays here overflowed on large inputs)
+void merge(int64_t arr[], int l, int m, int r, int64_t tmp[]) 
 { 
     // original array is broken in two parts 
     // left and right array 
     int len1 = m - l + 1, len2 = r - m; 
-    int64_t left[len1], right[len2]; 
+    int64_t* left = tmp;
+    int64_t* right = tmp + len1; 
     for (int i = 0; i < len1; i++) 
         left[i] = arr[l + i]; 
     for (int i = 0; i < len2; i++) 
@@ -88,6 +93,8 @@ void merge(int64_t arr[], int l, int m, int r)
 // array[0...n-1] (similar to merge sort) 
 void timSort(int64_t arr[], int n) 
 { 
+    std::vector<int64_t> tmp(n > RUN ? n : 0);
+
     // Sort individual subarrays of size RUN 
     for (int i = 0; i < n; i += RUN) 
         insertionSort(arr, i, min((i+RUN-1), (n-1))); 
@@ -110,7 +117,7 @@ void timSort(int64_t arr[], int n)
             // merge sub array arr[left.....mid] & 
             // arr[mid+1....right] 
             if (mid < right)
-                merge(arr, left, mid, right); 
+                merge(arr, left, mid, right, tmp.data()); 
         }
     } 
 }
@@ -0,0 +1,92 @@
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+bool TraceWriter::open(const char* path, uint64_t capacity)
+{
+    finish();
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    map_size = sizeof(trace_header_t) + capacity * sizeof(trace_record_t);
+    if (ftruncate(fd, map_size) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    /* MAP_POPULATE doesn't dirty the pages of a shared mapping, so the first store to each
+     * would still fault (while sampling); writing them all now takes those faults here */
+    void* addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    memset(addr, 0, map_size);
+    header = (trace_header_t*) addr;
+    header->magic = TRACE_MAGIC;
+    records = (trace_record_t*) (header + 1);
+    this->capacity = capacity;
+    this->path = path;
+    count = overflow = 0;
+    return true;
+}
+
+uint64_t TraceWriter::finish()
+{
+    if (header == NULL)
+        return 0;
+    header->records = count;
+    header->overflow = overflow;
+    munmap(header, map_size);
+    header = NULL;
+    records = NULL;
+
+    uint64_t size = sizeof(trace_header_t) + count * sizeof(trace_record_t);
+    if (ftruncate(fd, size) != 0)
+        size = map_size;
+    ::close(fd);
+    return size;
+}
+
+bool trace_map(const char* path, trace_file_t* trace)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(trace_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    trace->header = (const trace_header_t*) addr;
+    trace->records = (const trace_record_t*) (trace->header + 1);
+    trace->size = st.st_size;
+    trace->count = (st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+    if (trace->header->magic != TRACE_MAGIC) {
+        munmap(addr, st.st_size);
+        errno = EINVAL;
+        return false;
+    }
+    if (trace->header->records < trace->count)
+        trace->count = trace->header->records;
+    return true;
+}
+
+void trace_unmap(trace_file_t* trace)
+{
+    if (trace->header != NULL)
+        munmap((void*) trace->header, trace->size);
+    trace->header = NULL;
+}
@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+#define TRACE_MAGIC             0x31454341525442ULL     /* "BTRACE1" */
+#define DEFAULT_TRACE_RECORDS   (1 << 20)               /* 16 MB, about 17 minutes of samples at 1000/s */
+#define MAX_TRACE_RECORDS       (1 << 24)               /* 256 MB: half of a Lambda's /tmp */
+
+/* Record kinds */
+enum {
+    TRACE_BASE_SAMPLE,          /* Baseline (calibration) sample: value is the latency in cycles   */
+    TRACE_BIT_SAMPLE,           /* Sample while reading a bit: value is the latency in cycles      */
+    TRACE_BIT_READ,             /* End of a read bit: value is the bit read_bit decided            */
+    TRACE_BIT_WRITTEN           /* End of a written bit: value is 1                                */
+};
+
+/* Record flags */
+#define TRACE_DROPPED           0x1     /* Sample dropped by the filter (old traces only)   */
+#define TRACE_DESCHEDULED       0x2     /* Bit read while descheduled (an erasure)          */
+
+/* Settings of the run, so that a replay can redo its decisions */
+typedef struct {
+    uint64_t magic;
+    int32_t id;
+    int32_t samples_per_second;
+    int32_t bit_duration_mus;
+    int32_t use_pvalue;
+    double tsc_mhz;
+    double ks_cutoff;
+    double ks_alpha;
+    int32_t use_sprt;
+    int32_t reserved;
+    double sprt_alpha, sprt_beta, sprt_p1, sprt_quantile;
+    uint64_t records;           /* Records that follow the header                   */
+    uint64_t overflow;          /* Records that did not fit                         */
+} trace_header_t;
+
+typedef struct {
+    uint64_t tsc;               /* Sample start, or the end of the bit              */
+    int32_t value;
+    uint8_t kind;
+    uint8_t phase;
+    uint8_t bit_pos;
+    uint8_t flags;
+} trace_record_t;
+
+/* Binary trace of every latency sample and bit decision, for replaying read_bit offline.
+ * Records go into a file-backed mapping that is allocated and written over up front, so
+ * that there are no page faults in the sampling loop and adding one is a bounds check and
+ * a 16-byte store; records beyond the capacity are only counted. finish() trims the file
+ * to what was written.
+ *
+ * Not thread-safe: add() from the sampling thread only.
+ */
+class TraceWriter
+{
+public:
+    TraceWriter() : header(NULL), records(NULL), capacity(0), count(0), overflow(0), map_size(0), fd(-1) {}
+    ~TraceWriter()              { finish(); }
+
+    /* Create the file and map room for this many records; settings go in get_header() */
+    bool open(const char* path, uint64_t capacity = DEFAULT_TRACE_RECORDS);
+    bool is_open() const        { return header != NULL; }
+    trace_header_t* get_header()    { return header; }
+
+    inline void add(int kind, uint64_t tsc, int64_t value, int phase, int bit_pos, int flags) {
+        if (header == NULL)
+            return;
+        if (count < capacity) {
+            trace_record_t& r = records[count++];
+            r.tsc = tsc;
+            r.value = (int32_t) value;
+            r.kind = kind;
+            r.phase = phase;
+            r.bit_pos = bit_pos;
+            r.flags = flags;
+        }
+        else
+            overflow++;
+    }
+
+    uint64_t get_count() const      { return count; }
+    uint64_t get_overflow() const   { return overflow; }
+    const std::string& get_path() const { return path; }
+
+    /* Unmap and trim the file; returns its size in bytes (0 if there was no trace) */
+    uint64_t finish();
+
+private:
+    trace_header_t* header;
+    trace_record_t* records;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t overflow;
+    size_t map_size;
+    int fd;
+    std::string path;
+};
+
+/* Read-only view of a trace file */
+typedef struct {
+    const trace_header_t* header;
+    const trace_record_t* records;
+    uint64_t count;
+    size_t size;
+} trace_file_t;
+
+/* Map a trace file; returns false (with errno set, EINVAL if it is not a trace) on failure */
+bool trace_map(const char* path, trace_file_t* trace);
+void trace_unmap(trace_file_t* trace);
+
+#endif /* TRACE_H */
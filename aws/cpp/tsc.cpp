@@ -0,0 +1,151 @@
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "tsc.h"
+
+double tsc_mhz = 0;
+const char* tsc_mhz_source = "none";
+tsc_wait_stats_t tsc_wait_stats;
+
+/* Spinning waits re-derive their TSC target this close to the deadline, so an error in
+ * the calibrated rate cannot build up over long (multi-second) waits */
+#define REANCHOR_WINDOW_MUS      1000
+
+/* CPUID.80000007H:EDX[8] - TSC ticks at a constant rate across P/C-states */
+bool tsc_is_invariant(void)
+{
+   unsigned int eax, ebx, ecx, edx;
+   if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+      return false;
+   __cpuid(0x80000007, eax, ebx, ecx, edx);
+   return edx & (1 << 8);
+}
+
+/* CPUID.15H: TSC = crystal clock (ECX Hz) * EBX / EAX. Returns 0 when not enumerated
+ * (AMD, older Intel and many hypervisors, Firecracker included, leave it out) */
+double tsc_mhz_from_cpuid(void)
+{
+   unsigned int eax, ebx, ecx, edx;
+   if (__get_cpuid_max(0, NULL) < 0x15)
+      return 0;
+   __cpuid(0x15, eax, ebx, ecx, edx);
+   if (eax == 0 || ebx == 0 || ecx == 0)
+      return 0;
+   return ecx * 1.0 * ebx / eax / 1e6;
+}
+
+static inline int64_t monotonic_raw_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+   return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Reads TSC bracketed by two clock reads and keeps the tightest of a few tries,
+ * so a preemption between the reads doesn't skew the pairing */
+static void paired_read(int64_t* ns, uint64_t* tsc)
+{
+   int64_t best_gap = INT64_MAX;
+   for (int i = 0; i < 5; i++) {
+      int64_t before = monotonic_raw_ns();
+      uint64_t t = tsc_start();
+      int64_t after = monotonic_raw_ns();
+      if (after - before < best_gap) {
+         best_gap = after - before;
+         *ns = before + (after - before) / 2;
+         *tsc = t;
+      }
+   }
+}
+
+double tsc_mhz_measured(int measure_ms)
+{
+   int64_t ns0, ns1;
+   uint64_t tsc0, tsc1;
+   paired_read(&ns0, &tsc0);
+   while (monotonic_raw_ns() - ns0 < measure_ms * 1000000LL);
+   paired_read(&ns1, &tsc1);
+   return (tsc1 - tsc0) * 1000.0 / (ns1 - ns0);
+}
+
+double tsc_calibrate(int measure_ms)
+{
+   tsc_mhz = tsc_mhz_from_cpuid();
+   tsc_mhz_source = "cpuid";
+   if (tsc_mhz == 0) {
+      tsc_mhz = tsc_mhz_measured(measure_ms);
+      tsc_mhz_source = "measured";
+   }
+   return tsc_mhz;
+}
+
+
+static inline int64_t realtime_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+TscDeadline::TscDeadline(int64_t epoch_mus) : epoch_ns(epoch_mus * 1000), target(0)
+{
+   if (tsc_mhz == 0)
+      tsc_calibrate();
+   anchor();
+}
+
+/* Maps the deadline to a TSC value against a fresh clock reading */
+void TscDeadline::anchor()
+{
+   uint64_t now_tsc = tsc_now();
+   int64_t remaining_ns = epoch_ns - realtime_ns();
+   target = now_tsc + (int64_t) (remaining_ns * tsc_mhz / 1000.0);
+}
+
+int TscDeadline::wait(int64_t sleep_margin_mus)
+{
+   if (!pending()) {
+      tsc_wait_stats.missed++;
+      return 1;
+   }
+
+   /* Hand the CPU back for the bulk of a long wait */
+   if (sleep_margin_mus > 0) {
+      int64_t wake_ns = epoch_ns - sleep_margin_mus * 1000;
+      if (realtime_ns() < wake_ns) {
+         struct timespec ts;
+         ts.tv_sec = wake_ns / 1000000000LL;
+         ts.tv_nsec = wake_ns % 1000000000LL;
+         while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR);
+         tsc_wait_stats.sleeps++;
+         anchor();
+      }
+   }
+
+   int64_t window = ns_to_cycles(REANCHOR_WINDOW_MUS * 1000.0);
+   if ((int64_t) (target - tsc_now()) > window) {
+      while ((int64_t) (target - tsc_now()) > window)
+         _mm_pause();
+      anchor();
+   }
+
+   uint64_t now;
+   while ((now = tsc_now()) < target)
+      _mm_pause();
+
+   uint64_t overshoot = now - target;
+   tsc_wait_stats.waits++;
+   tsc_wait_stats.overshoot_total += overshoot;
+   if (overshoot > tsc_wait_stats.overshoot_max)
+      tsc_wait_stats.overshoot_max = overshoot;
+   return 0;
+}
+
+void tsc_reset_wait_stats(void)
+{
+   memset(&tsc_wait_stats, 0, sizeof(tsc_wait_stats));
+}
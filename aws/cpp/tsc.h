@@ -0,0 +1,123 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <cstdint>
+
+/* Serialized TSC readings for timing short code sections
+ * (Ref: Intel, "How to Benchmark Code Execution Times on Intel IA-32 and IA-64 Instruction Set Architectures")
+ * LFENCE before RDTSC keeps earlier instructions from drifting into the measured section;
+ * RDTSCP waits for the measured section to retire and the LFENCE after it keeps later
+ * instructions from starting before the counter is read. */
+static inline uint64_t tsc_start(void)
+{
+   uint32_t lo, hi;
+   __asm__ __volatile__ ("lfence\n\t"
+            "rdtsc\n\t" : "=a" (lo), "=d" (hi) :: "memory");
+   return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t tsc_stop(void)
+{
+   uint32_t lo, hi, aux;
+   __asm__ __volatile__ ("rdtscp\n\t"
+            "lfence\n\t" : "=a" (lo), "=d" (hi), "=c" (aux) :: "memory");
+   return ((uint64_t)hi << 32) | lo;
+}
+
+/* Plain (unserialized) read for timestamps where a few cycles of skew don't matter */
+static inline uint64_t tsc_now(void)
+{
+   uint32_t lo, hi;
+   __asm__ __volatile__ ("rdtsc\n\t" : "=a" (lo), "=d" (hi));
+   return ((uint64_t)hi << 32) | lo;
+}
+
+/* TSC frequency of this host, filled in by tsc_calibrate() */
+extern double tsc_mhz;
+extern const char* tsc_mhz_source;
+
+/* Gets the TSC frequency (MHz) from CPUID leaf 0x15 when the CPU reports it,
+ * else measures it against CLOCK_MONOTONIC_RAW for the given duration */
+double tsc_calibrate(int measure_ms = 20);
+double tsc_mhz_from_cpuid(void);
+double tsc_mhz_measured(int measure_ms);
+bool tsc_is_invariant(void);
+
+static inline double cycles_to_ns(uint64_t cycles)   { return cycles * 1000.0 / tsc_mhz; }
+static inline uint64_t ns_to_cycles(double ns)       { return (uint64_t) (ns * tsc_mhz / 1000.0); }
+
+/* A wall-clock deadline (CLOCK_REALTIME, i.e. Clock::now() in the handler) converted to a TSC
+ * target once, so checking or spinning on it costs an RDTSC rather than a clock read */
+class TscDeadline
+{
+public:
+   explicit TscDeadline(int64_t epoch_mus);
+
+   inline bool pending() const   { return tsc_now() < target; }
+
+   /* Blocks till the deadline: sleeps with clock_nanosleep() until sleep_margin_mus before it
+    * (if positive), then spins on the TSC. Returns 1 right away if the deadline has passed. */
+   int wait(int64_t sleep_margin_mus = 0);
+
+   uint64_t get_target() const   { return target; }
+
+private:
+   void anchor();
+
+   int64_t epoch_ns;
+   uint64_t target;
+};
+
+/* How late TscDeadline::wait() returned, accumulated over the process (cycles) */
+typedef struct {
+   uint64_t waits;
+   uint64_t missed;              /* deadline had already passed when wait() was called */
+   uint64_t sleeps;
+   uint64_t overshoot_total;
+   uint64_t overshoot_max;
+} tsc_wait_stats_t;
+
+extern tsc_wait_stats_t tsc_wait_stats;
+void tsc_reset_wait_stats(void);
+
+/* Times operations with serialized start/stop TSC readings. Keeps no shared state,
+ * so every sampling thread should own its own instance. */
+class LatencySampler
+{
+public:
+   LatencySampler() : t0(0), overhead(0) {}
+
+   inline void start()           { t0 = tsc_start(); }
+   inline uint64_t stop()        { return tsc_stop() - t0; }
+
+   /* Latency of one locked add (the membus probe) */
+   inline uint64_t sample_atomic(uint64_t* addr) {
+      start();
+      __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
+      return stop();
+   }
+
+   /* Minimum cycles reported for an empty start/stop pair, i.e. the floor included
+    * in every sample. Measured over the given number of tries and remembered. */
+   uint64_t measure_overhead(int tries = 1000) {
+      uint64_t min = UINT64_MAX;
+      for (int i = 0; i < tries; i++) {
+         start();
+         uint64_t cycles = stop();
+         if (cycles < min)    min = cycles;
+      }
+      overhead = min;
+      return overhead;
+   }
+
+   uint64_t get_overhead() const { return overhead; }
+
+   /* TSC at the start of the last measurement, i.e. when the last sample was taken */
+   uint64_t get_start() const    { return t0; }
+
+private:
+   uint64_t t0;
+   uint64_t overhead;
+};
+
+#endif /* TSC_H */
@@ -0,0 +1,114 @@
+/* Microbenchmark for the TSC sampler: reports the measurement floor of an empty
+ * start/stop pair and of a timed __atomic_fetch_add on an ordinary and on a
+ * cacheline-straddling address, next to the old unserialized RDTSC readings.
+ * The floor is what every membus latency sample carries on top of the real
+ * locking latency. Also reports how late TscDeadline waits return.
+ *
+ * Usage: ./tscbench [iterations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+
+#include "tsc.h"
+
+#define DEFAULT_ITERATIONS      100000
+#define CACHELINE_SIZE          64
+
+typedef struct {
+   uint64_t min;
+   uint64_t median;
+   uint64_t p99;
+} bench_stats_t;
+
+static bench_stats_t summarize(std::vector<uint64_t>& cycles)
+{
+   std::sort(cycles.begin(), cycles.end());
+   bench_stats_t stats;
+   stats.min = cycles[0];
+   stats.median = cycles[cycles.size() / 2];
+   stats.p99 = cycles[cycles.size() * 99 / 100];
+   return stats;
+}
+
+static void report(const char* name, std::vector<uint64_t>& cycles)
+{
+   bench_stats_t stats = summarize(cycles);
+   printf("%-40s min %6lu  median %6lu  p99 %6lu cycles  (median %.1lf ns)\n", name, stats.min, stats.median, stats.p99,
+      cycles_to_ns(stats.median));
+}
+
+int main(int argc, char** argv)
+{
+   int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+   if (iterations <= 0) {
+      printf("ERROR! Provide a positive number of iterations\n");
+      return 1;
+   }
+   std::vector<uint64_t> cycles(iterations);
+   LatencySampler sampler;
+
+   /* Two cache lines, so we can also time an atomic that straddles them */
+   uint8_t* lines = (uint8_t*) aligned_alloc(CACHELINE_SIZE, 2 * CACHELINE_SIZE);
+   uint64_t* aligned = (uint64_t*) lines;
+   uint64_t* straddled = (uint64_t*) (lines + CACHELINE_SIZE - 4);
+   *aligned = *straddled = 0;
+
+   tsc_calibrate();
+   printf("TSC frequency: %.1lf MHz (%s, invariant: %d)\n", tsc_mhz, tsc_mhz_source, tsc_is_invariant());
+   printf("TSC frequency (measured): %.1lf MHz\n", tsc_mhz_measured(100));
+   printf("Overhead floor (LatencySampler::measure_overhead): %lu cycles\n", sampler.measure_overhead());
+
+   for (int i = 0; i < iterations; i++) {
+      sampler.start();
+      cycles[i] = sampler.stop();
+   }
+   report("serialized, empty", cycles);
+
+   for (int i = 0; i < iterations; i++)
+      cycles[i] = sampler.sample_atomic(aligned);
+   report("serialized, atomic add", cycles);
+
+   for (int i = 0; i < iterations; i++)
+      cycles[i] = sampler.sample_atomic(straddled);
+   report("serialized, atomic add (straddled)", cycles);
+
+   /* What the globals-based rdtsc()/rdtsc1() pair used to measure */
+   for (int i = 0; i < iterations; i++) {
+      uint64_t start = tsc_now();
+      __atomic_fetch_add(aligned, 1, __ATOMIC_SEQ_CST);
+      cycles[i] = tsc_now() - start;
+   }
+   report("unserialized, atomic add", cycles);
+
+   for (int i = 0; i < iterations; i++) {
+      uint64_t start = tsc_now();
+      __atomic_fetch_add(straddled, 1, __ATOMIC_SEQ_CST);
+      cycles[i] = tsc_now() - start;
+   }
+   report("unserialized, atomic add (straddled)", cycles);
+
+   /* Deadline waits a millisecond apart, spinning all the way and sleeping till 200us before */
+   int64_t margins[] = {0, 200};
+   for (int m = 0; m < 2; m++) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      int64_t deadline_mus = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+      tsc_reset_wait_stats();
+      for (int i = 0; i < 200; i++) {
+         deadline_mus += 1000;
+         TscDeadline(deadline_mus).wait(margins[m]);
+      }
+      printf("deadline waits (sleep margin %3ld us): %lu waits, %lu missed, %lu slept, overshoot mean %.0lf ns, max %.0lf ns\n",
+         margins[m], tsc_wait_stats.waits, tsc_wait_stats.missed, tsc_wait_stats.sleeps,
+         tsc_wait_stats.waits ? cycles_to_ns(tsc_wait_stats.overshoot_total / tsc_wait_stats.waits) : 0.0,
+         cycles_to_ns(tsc_wait_stats.overshoot_max));
+   }
+
+   free(lines);
+   return 0;
+}
@@ -24,6 +24,7 @@ import numpy as np
 import scipy.stats as stats
 from reedsolo import RSCodec, ReedSolomonError
 import string
+import base64
 
 
 MAX_CONCURRENT = 1500
@@ -31,6 +32,7 @@ req_q = Queue(MAX_CONCURRENT * 2)
 data_q = Queue(MAX_CONCURRENT * 2)
 order_q = Queue(MAX_CONCURRENT * 2)
 samples = False
+encoding = "decimal"
 
 # Endpoint of the covert channel
 class ChannelInfo:
@@ -169,6 +171,34 @@ def oneSidedLeftTailedConfInterval(mean, std, num, alpha):
     nf = num - 1
     return stats.t.interval(alpha_two_sided, nf, mean, std)[1]
 
+# Read a LEB128 varint from buf at pos, returns (value, next pos)
+def read_varint(buf, pos):
+    value, shift = 0, 0
+    while True:
+        byte = buf[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+# Decode a "delta-varint" sample array (see cpp/samplecodec.h) back to the decimal "v1,v2,...," form
+def decode_samples(text):
+    buf = base64.b64decode(text)
+    count, pos = read_varint(buf, 0)
+    values, prev = [], 0
+    for _ in range(count):
+        zz, pos = read_varint(buf, pos)
+        prev += (zz >> 1) ^ -(zz & 1)
+        values.append(str(prev))
+    return ",".join(values) + ","
+
+# Decode "delta-varint" packed channel bits back to a '0'/'1' string
+def decode_bits(text):
+    buf = base64.b64decode(text)
+    count, pos = read_varint(buf, 0)
+    return "".join("1" if buf[pos + i // 8] & (0x80 >> (i % 8)) else "0" for i in range(count))
+
 # Call URL
 def getResponse(ourl, body):
     try:
@@ -202,6 +232,7 @@ def worker():
             "maxbits": bits_in_id, 
             "bitduration": bit_duration,
             "samples": samples, 
+            "encoding": encoding,
             "s3bucket": s3bucket if use_s3 else "", 
             "s3key": s3file if use_s3 else "",
             "guid": guid,
@@ -339,6 +370,7 @@ def main():
     parser.add_argument('-d', '--delay', action='store', type=int, help='initial delay for lambdas to sync up (in seconds)', default=30)
     parser.add_argument('-n', '--name', action='store', help='lambda name, if URL should be retrieved from cache', default="membusv2")
     parser.add_argument('-s', '--samples', action='store_true', help='save observed latency samples to log', default=False)
+    parser.add_argument('-enc', '--encoding', action='store', choices=["decimal", "delta-varint"], help='encoding of samples and channel data in results (delta-varint is ~3x smaller)', default="decimal")
     parser.add_argument('-seq', '--sequence', action='store_true', help='invoke lambdas sequentially one after another (requires huge start-up delay)', default=False)
     parser.add_argument('--useapi', action='store_true', help='Use response returned by API for data rather than writing to storage account', default=False)
     parser.add_argument('--retrys3', action='store_true', help='Do not invoke lambdas, just retry downloading results from S3 for an earlier experiment (provided with --outdir)', default=False)
@@ -438,8 +470,9 @@ def main():
     unique_id = datetime.now().strftime("%m-%d-%H-%M") if not args.retrys3 else args.outdir
 
     # Start enough threads
-    global samples
+    global samples, encoding
     samples = args.samples
+    encoding = args.encoding
     for i in range(args.count):
         t = Thread(target=worker, args=())
         t.daemon = True
@@ -524,6 +557,13 @@ def main():
                 # print(item)   #raw
                 item_d = json.loads(item.decode("utf-8") if isinstance(item, bytes) else item , strict=False)
 
+                # Compact encodings go back to the decimal form everything below expects
+                if item_d.get("Encoding") == "delta-varint":
+                    for key in ["Base Sample", "Bit-1 Sample", "Bit-0 Sample"]:
+                        if key in item_d:   item_d[key] = decode_samples(item_d[key])
+                    if "Channel" in item_d and "Data" in item_d["Channel"]:
+                        item_d["Channel"]["Data"] = decode_bits(item_d["Channel"]["Data"])
+
                 # # Get lambda run time
                 # if "Start Time" in item_d and "End Time" in item_d:
                     
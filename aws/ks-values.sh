@@ -2,6 +2,7 @@
 # Analyze the KS (Kolmogorov Smirinov) test values for 
 # latency samples obtained in different experiments 
 # to figure out the right threshold for 0/1-bit
+# (cpp/rocsweep computes ROC curves and the best cutoffs per platform from the raw samples, in parallel)
 #
 
 prefix=$1
@@ -52,7 +52,7 @@ done
 
 # # Prepare to run a VM per region during each run just to see if VMs and lambdas are colocated
 # pushd cpp/
-# g++ local_main.cpp kstest.cpp timsort.cpp -o local_membus
+# g++ local_main.cpp kstest.cpp latsort.cpp timsort.cpp -o local_membus
 # popd
 
 # # Colococation by regions
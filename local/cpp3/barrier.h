@@ -0,0 +1,88 @@
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include <cstdint>
+#include <climits>
+#include <ctime>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tsc.h"
+
+#define START_BARRIER_ENV       "MEMBUS_START_BARRIER"     /* Name of the shm object, set by the launcher */
+
+/* Start barrier shared by the launcher and all participants (in /dev/shm). Participants
+ * arrive once they are ready to start; when all have, the launcher picks a release TSC
+ * a little in the future and wakes them, and each spins until that TSC. With an invariant
+ * TSC that is the same instant on every core, so everyone starts together, no matter
+ * how long their process took to come up. */
+typedef struct {
+   std::atomic<int> arrived;
+   std::atomic<int> released;       /* 0 until release_* are set */
+   uint64_t release_tsc;
+   int64_t release_mus;             /* Same instant in wall-clock time (for the protocol's schedule) */
+} start_barrier_t;
+
+static inline long futex(std::atomic<int>* addr, int op, int val, const struct timespec* timeout)
+{
+   return syscall(SYS_futex, (int*) addr, op, val, timeout, NULL, 0);
+}
+
+static inline start_barrier_t* barrier_map(const char* name, bool create)
+{
+   int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+   if (fd < 0)
+      return NULL;
+   if (create && ftruncate(fd, sizeof(start_barrier_t)) != 0) {
+      close(fd);
+      return NULL;
+   }
+   void* addr = mmap(NULL, sizeof(start_barrier_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   return addr == MAP_FAILED ? NULL : (start_barrier_t*) addr;
+}
+
+/* Participant: arrive, sleep till released, spin till the release TSC. Returns how late
+ * (in cycles) we saw the release TSC, i.e. this participant's start skew. */
+static inline uint64_t barrier_wait(start_barrier_t* barrier)
+{
+   barrier->arrived.fetch_add(1);
+   futex(&barrier->arrived, FUTEX_WAKE, INT_MAX, NULL);
+   while (barrier->released.load() == 0)
+      futex(&barrier->released, FUTEX_WAIT, 0, NULL);
+
+   uint64_t now;
+   while ((now = tsc_now()) < barrier->release_tsc)
+      __builtin_ia32_pause();
+   return now - barrier->release_tsc;
+}
+
+/* Launcher: wait (up to timeout_ms) for count arrivals, then release everyone lead_ns from now */
+static inline bool barrier_release(start_barrier_t* barrier, int count, int64_t lead_ns, int timeout_ms)
+{
+   struct timespec start, now;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int arrived;
+   while ((arrived = barrier->arrived.load()) < count) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      int64_t left_ms = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+      if (left_ms <= 0)
+         return false;
+      struct timespec wait = { 0, 10 * 1000000 };
+      futex(&barrier->arrived, FUTEX_WAIT, arrived, &wait);
+   }
+
+   struct timespec wall;
+   clock_gettime(CLOCK_REALTIME, &wall);
+   barrier->release_tsc = tsc_now() + ns_to_cycles(lead_ns);
+   barrier->release_mus = wall.tv_sec * 1000000LL + wall.tv_nsec / 1000 + lead_ns / 1000;
+   barrier->released.store(1);
+   futex(&barrier->released, FUTEX_WAKE, INT_MAX, NULL);
+   return true;
+}
+
+#endif /* BARRIER_H */
@@ -31,6 +31,8 @@
 #include <ifaddrs.h>
 
 #include "util.h"
+#include "tsc.h"
+#include "barrier.h"
 
 char const TAG[] = "MEMBUS";
 
@@ -105,25 +107,6 @@ uint64_t rand_xorshf96(void) {          //period 2^96-1
 }
 
 
-/* Rdtsc blocks for time measurements */
-unsigned cycles_low, cycles_high, cycles_low1, cycles_high1;
-
-static __inline__ unsigned long long rdtsc(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high), "=r" (cycles_low)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
-static __inline__ unsigned long long rdtsc1(void)
-{
-   __asm__ __volatile__ ("RDTSC\n\t"
-            "mov %%edx, %0\n\t"
-            "mov %%eax, %1\n\t": "=r" (cycles_high1), "=r" (cycles_low1)::
-            "%rax", "rbx", "rcx", "rdx");
-}
-
 double next_poisson_time(double rate)
 {
    return -logf(1.0f - ((double) random()) / (double) (RAND_MAX)) / rate;
@@ -285,18 +268,13 @@ int read_bit(uint64_t* addr, microseconds release_time_mus, int bit_duration_sec
    /* Release a bit early to avoid overruns (and allow for post-processing) */
    release_time_mus -= ten_ms;
 
-   int64_t start, end, mean, count = 0;
+   LatencySampler sampler;
+   int64_t mean, count = 0;
    // lprintf("%ld, %ld,\n", next.count(), release_time_mus.count());      /** COMMENT OUT IN REAL RUNS **/
    for (i = 0; i < num_samples && within_time(release_time_mus); i++)
    {   
       // Get a sample
-      rdtsc();
-      __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
-      rdtsc1();
-
-      start = ( ((int64_t)cycles_high << 32) | cycles_low );
-      end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-      samples[i] = (end - start);
+      samples[i] = sampler.sample_atomic(addr);
       count++;
          
       next += microseconds((int)next_poisson_time(sampling_rate_mus));
@@ -370,17 +348,14 @@ void write_bit(uint64_t* addr, microseconds release_time_mus)
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 uint64_t perform_random_access(void* buffer, size_t buf_size, int num_accesses) {         // TODO: Inline it?
-   uint64_t src = 100, rand, start, end;
-   rdtsc();
+   uint64_t src = 100, rand;
+   LatencySampler sampler;
+   sampler.start();
    for(int i = 0; i < num_accesses; i++) {
       rand = rand_xorshf96() % buf_size;
       memcpy(buffer + rand, &src, sizeof(uint64_t));
    }
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   return (end - start);
+   return sampler.stop();
 }
 #pragma GCC pop_options
 
@@ -389,22 +364,18 @@ uint64_t perform_random_access(void* buffer, size_t buf_size, int num_accesses)
    NOTE: It seems like the GCC optimization options are important to properly measure time
  */
 inline uint64_t perform_exotic_ops(uint64_t* cacheline_addr, int num_accesses) {
-   uint64_t start, end;
-   rdtsc();
+   LatencySampler sampler;
+   sampler.start();
    for (int i = 0; i < ATOMIC_OPS_BATCH_SIZE; i++)
       __atomic_fetch_add(cacheline_addr, 1, __ATOMIC_SEQ_CST);
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   return (end - start);
+   return sampler.stop();
 }
 
 /* Send a data segment */
 int send_data(std::vector<bool> data, int nbits, microseconds start_time_mus, uint64_t* cacheline_addr, void* big_buffer, size_t big_buf_size) {
    microseconds bit_start_mus, bit_end_mus;
    int num_erasures, erasures[nbits];
-   uint64_t start, end, access_cycles, access_count, access_avg, access_thresh, cycles;
+   uint64_t access_cycles, access_count, access_avg, access_thresh, cycles;
 
    /* Wait till the startpoint */
    microseconds one_ms = microseconds(1000);
@@ -470,7 +441,7 @@ int send_data(std::vector<bool> data, int nbits, microseconds start_time_mus, ui
 int receive_data(std::vector<bool> data, int nbits, microseconds start_time_mus, uint64_t* cacheline_addr) {
    microseconds bit_start_mus, bit_end_mus;
    int num_erasures, erasures[nbits];
-   uint64_t start, end, access_cycles, access_count, access_avg, cycles;
+   uint64_t access_cycles, access_count, access_avg, cycles;
    std::vector<bool> result;
 
    /* Wait till the startpoint */
@@ -569,12 +540,8 @@ uint64_t* get_cache_line_straddled_address()
    // lprintf("Membus latencies with sliding address:\n");
    // for (int j = -8; j < 16; j++) {
    //    uint64_t* cacheline = (uint64_t*)((uint8_t*)(arr+i-1) + j);
-   //    rdtsc();
-   //    __atomic_fetch_add(cacheline, 1, __ATOMIC_SEQ_CST);
-   //    rdtsc1();
-   //    uint64_t start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   //    uint64_t end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
-   //    lprintf("%d,%lu\n", j, (end - start));
+   //    LatencySampler sampler;
+   //    lprintf("%d,%lu\n", j, sampler.sample_atomic(cacheline));
    // }
 
    return (uint64_t*)addr;
@@ -755,20 +722,18 @@ std::string get_ipaddr(void) {
 #pragma GCC optimize ("O0")
 double get_cpu_cycles_per_operation() {
    int TIMES = 1e8;
-   uint64_t x = 0, start, end;
+   uint64_t x = 0;
    microseconds begin_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
 
-   rdtsc();
+   LatencySampler sampler;
+   sampler.start();
    for(int i = 0; i < TIMES; i++)  x += i;
-   rdtsc1();
-
-   start = ( ((int64_t)cycles_high << 32) | cycles_low );
-   end = ( ((int64_t)cycles_high1 << 32) | cycles_low1 );
+   uint64_t cycles = sampler.stop();
        
    microseconds end_time = duration_cast<microseconds>(Clock::now().time_since_epoch());
    lprintf("Calculating CPU CPI took %.2lf seconds\n", (end_time - begin_time).count() * 1.0 / MUS_PER_SEC);
 
-   return (end - start) * 1.0 / TIMES;
+   return cycles * 1.0 / TIMES;
 }
 #pragma GCC pop_options
 
@@ -782,13 +747,34 @@ const std::string current_datetime() {
    return buf;
 }
 
+/* When started by the launcher, everyone starts at the barrier's release instant (plus time for
+ * the protocol's early sync); else at the given wall-clock second */
+microseconds wait_for_start(start_barrier_t* barrier, long start_time_secs, uint64_t* skew_cycles)
+{
+   if (barrier == NULL)
+      return duration_cast<microseconds>(seconds(start_time_secs));
+   *skew_cycles = barrier_wait(barrier);
+   return microseconds(barrier->release_mus + 20000);
+}
+
+/* Usage: ./lambda <id> <start time (secs since epoch), ignored under the launcher> [protocol|channel] */
 int main(int argc, char** argv)
 {
    std::string role;
    int id = 0;
-   long start_time_secs;
+   long start_time_secs = 0;
    bool parsed_id = false, parsed_time = false;
    bool success = true;
+   std::string mode = argc >= 4 ? argv[3] : "channel";
+   uint64_t skew_cycles = 0;
+
+   /* Started by the launcher? */
+   start_barrier_t* barrier = NULL;
+   const char* barrier_name = getenv(START_BARRIER_ENV);
+   if (barrier_name != NULL && (barrier = barrier_map(barrier_name, false)) == NULL) {
+      printf("ERROR! Cannot attach to start barrier %s\n", barrier_name);
+      return 1;
+   }
 
    /* Parse Lambda Id */
    if (argc >= 2) {
@@ -811,11 +797,14 @@ int main(int argc, char** argv)
          parsed_time = true;
       }
    }
-   if (!parsed_time) {
+   if (!parsed_time && barrier == NULL) {
       printf("ERROR! Provide proper arg 2: time in seconds since epoch\n");
       return 1;
    }
 
+   tsc_calibrate();
+   lprintf("TSC frequency: %.1lf MHz (%s, invariant: %d)\n", tsc_mhz, tsc_mhz_source, tsc_is_invariant());
+
    /* Run membus protcol */
    if (success) {
       /* Using a good seed that is different enough for each lambda is critical as 
@@ -854,6 +843,17 @@ int main(int argc, char** argv)
       double protocol_time;
       bool sender = false, receiver = false;
 
+      if (success && mode == "protocol") {
+         microseconds start_time_mus = wait_for_start(barrier, start_time_secs, &skew_cycles);
+         result_t* result = run_membus_protocol(id, start_time_mus, max_phases, max_bits, bit_duration_secs, addr, false, &protocol_time);
+
+         /* CAUTION: The launcher parses this line */
+         printf("RESULT id=%d mode=protocol skew_ns=%.0lf time=%.2lf phases=%d ids=", id, cycles_to_ns(skew_cycles), protocol_time, result->num_phases);
+         for (int i = 0; i < result->num_phases; i++)   printf("%s%d", i ? ":" : "", result->ids[i]);
+         printf("\n");
+         return 0;
+      }
+
       if (success) {
          result_t* result;
 
@@ -877,7 +877,7 @@ int main(int argc, char** argv)
       int nbits = 500;
       for(int i = 0; i < nbits; i++)   data_to_send.push_back(random() % 2 == 0);
       // for(int i = 0; i < nbits; i++)   data_to_send.push_back(false);
-      microseconds start_time_mus = duration_cast<microseconds>(seconds(start_time_secs));
+      int erasures = 0;
 
       if (sender){       
          printf("Lambda %d: I'm the sender!\n", id);
@@ -887,12 +887,20 @@ int main(int argc, char** argv)
          void* dummy_buffer = malloc(DUMMY_BUF_SIZE + sizeof(uint64_t));   
          memset(dummy_buffer, 1, DUMMY_BUF_SIZE);     // this is necessary to actually allocate memory
 
-         send_data(data_to_send, nbits, start_time_mus, addr, dummy_buffer, DUMMY_BUF_SIZE);
+         microseconds start_time_mus = wait_for_start(barrier, start_time_secs, &skew_cycles);
+         erasures = send_data(data_to_send, nbits, start_time_mus, addr, dummy_buffer, DUMMY_BUF_SIZE);
       }
       if (receiver){     
          printf("Lambda %d: I'm the receiver!\n", id); 
-         receive_data(data_to_send, nbits, start_time_mus, addr);
+         microseconds start_time_mus = wait_for_start(barrier, start_time_secs, &skew_cycles);
+         erasures = receive_data(data_to_send, nbits, start_time_mus, addr);
       }
+      if (!sender && !receiver)
+         wait_for_start(barrier, start_time_secs, &skew_cycles);     /* Launcher waits for everyone */
+
+      /* CAUTION: The launcher parses this line */
+      printf("RESULT id=%d mode=channel skew_ns=%.0lf role=%s erasures=%d\n", id, cycles_to_ns(skew_cycles),
+         sender ? "sender" : receiver ? "receiver" : "none", erasures);
    }
 
    return 0;
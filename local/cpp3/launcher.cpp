@@ -0,0 +1,407 @@
+/* Launcher for local co-residence experiments, in place of run.sh's taskset loop.
+ * Forks N ./lambda participants onto CPUs picked from the host topology, holds them
+ * at a shared-memory futex barrier until all are ready and releases them at the same
+ * TSC instant (see barrier.h), then collects the RESULT line each prints over a pipe.
+ * Can sweep several participant counts in one go.
+ *
+ * Topology specs:
+ *   cores      one hardware thread per physical core, socket by socket (default)
+ *   smt        SMT siblings next to each other (pairs share a core)
+ *   sockets    round-robin across sockets
+ *   0,2,4-7    these CPUs, in this order
+ * Participants beyond the number of CPUs wrap around and share them.
+ *
+ * Writes one line per participant to <out>.csv and <out>.json, and prints how many
+ * participants learned the right ids (protocol mode) or the channel erasures. In
+ * channel mode, lambda skips the protocol and takes 101 and 303 as its result, so the
+ * first two participants get those ids (the sender and the receiver) and the rest
+ * random ones.
+ *
+ * Usage: ./launcher [-n counts (e.g. 4 or 2,8,32 or 2-128 for powers of 2)] [-t topology]
+ *                   [-m protocol|channel] [-r trials] [-o out] [-l lead_ms] [-b ./lambda]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "tsc.h"
+#include "barrier.h"
+
+#define MAX_ID                  (1 << 10)       /* MAX_BITS_IN_ID in lambda.cpp */
+#define PROTOCOL_PHASES         2               /* max_phases in lambda.cpp */
+#define DEFAULT_LEAD_MS         50              /* Release this far after the last arrival (futex wakeups of everyone) */
+#define ARRIVAL_TIMEOUT_MS      60000
+#define CHANNEL_SENDER_ID       101             /* Protocol result hardcoded in lambda.cpp's channel mode */
+#define CHANNEL_RECEIVER_ID     303
+
+typedef struct {
+   int cpu;
+   int core;
+   int socket;
+} cpu_info_t;
+
+typedef struct {
+   int count;                  /* Participants in this run */
+   int trial;
+   int index;
+   cpu_info_t cpu;
+   int id;
+   pid_t pid;
+   int fd;                     /* Read end of its stdout */
+   std::string output;
+   int exit_status;
+   std::map<std::string, std::string> result;     /* key=value pairs of its RESULT line */
+} participant_t;
+
+static int read_int(const std::string& path, int fallback)
+{
+   std::ifstream file(path);
+   int value;
+   return file >> value ? value : fallback;
+}
+
+static std::vector<int> parse_list(const std::string& spec)
+{
+   std::vector<int> values;
+   std::stringstream ss(spec);
+   std::string range;
+   while (std::getline(ss, range, ',')) {
+      int first, last;
+      if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2)
+         for (int v = first; v <= last; v++)   values.push_back(v);
+      else if (sscanf(range.c_str(), "%d", &first) == 1)
+         values.push_back(first);
+   }
+   return values;
+}
+
+/* CPUs we may use, in the order the topology spec asks for */
+static std::vector<cpu_info_t> plan_cpus(const std::string& spec)
+{
+   std::vector<cpu_info_t> cpus;
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   sched_getaffinity(0, sizeof(set), &set);
+   for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (!CPU_ISSET(c, &set))
+         continue;
+      std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+      cpu_info_t cpu = { c, read_int(topology + "core_id", c), read_int(topology + "physical_package_id", 0) };
+      cpus.push_back(cpu);
+   }
+
+   if (spec == "smt" || spec == "cores" || spec == "sockets") {
+      /* Siblings (same socket and core) end up next to each other */
+      std::sort(cpus.begin(), cpus.end(), [](const cpu_info_t& a, const cpu_info_t& b) {
+         return a.socket != b.socket ? a.socket < b.socket : a.core != b.core ? a.core < b.core : a.cpu < b.cpu;
+      });
+      if (spec == "smt")
+         return cpus;
+
+      /* First thread of every core, then the second threads, ... */
+      std::vector<cpu_info_t> ordered;
+      std::vector<bool> taken(cpus.size(), false);
+      while (ordered.size() < cpus.size()) {
+         std::set< std::pair<int, int> > seen;
+         for (size_t i = 0; i < cpus.size(); i++) {
+            if (taken[i] || !seen.insert(std::make_pair(cpus[i].socket, cpus[i].core)).second)
+               continue;
+            taken[i] = true;
+            ordered.push_back(cpus[i]);
+         }
+      }
+      if (spec == "cores")
+         return ordered;
+
+      /* Deal them out across sockets */
+      std::map< int, std::vector<cpu_info_t> > by_socket;
+      for (size_t i = 0; i < ordered.size(); i++)    by_socket[ordered[i].socket].push_back(ordered[i]);
+      std::vector<cpu_info_t> dealt;
+      for (size_t round = 0; dealt.size() < ordered.size(); round++)
+         for (std::map< int, std::vector<cpu_info_t> >::iterator it = by_socket.begin(); it != by_socket.end(); ++it)
+            if (round < it->second.size())    dealt.push_back(it->second[round]);
+      return dealt;
+   }
+
+   /* Explicit list */
+   std::vector<cpu_info_t> listed;
+   std::vector<int> wanted = parse_list(spec);
+   for (size_t w = 0; w < wanted.size(); w++)
+      for (size_t i = 0; i < cpus.size(); i++)
+         if (cpus[i].cpu == wanted[w])    listed.push_back(cpus[i]);
+   return listed;
+}
+
+/* "4", "2,8,32", or "2-128" (powers of two in between) */
+static std::vector<int> parse_counts(const std::string& spec)
+{
+   int first, last;
+   std::vector<int> counts;
+   if (spec.find(',') == std::string::npos && sscanf(spec.c_str(), "%d-%d", &first, &last) == 2) {
+      for (int n = first; n <= last; n *= 2)    counts.push_back(n);
+      return counts;
+   }
+   return parse_list(spec);
+}
+
+static void parse_result(participant_t& p)
+{
+   size_t at = p.output.rfind("RESULT ");
+   if (at == std::string::npos)
+      return;
+   std::istringstream line(p.output.substr(at + 7, p.output.find('\n', at) - at - 7));
+   std::string pair;
+   while (line >> pair) {
+      size_t eq = pair.find('=');
+      if (eq != std::string::npos)    p.result[pair.substr(0, eq)] = pair.substr(eq + 1);
+   }
+}
+
+static int64_t monotonic_ms()
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/* Stops the participants forked so far and removes the barrier, when a run can't go on */
+static void abort_run(std::vector<participant_t>& participants, size_t forked, start_barrier_t* barrier, const std::string& name)
+{
+   for (size_t i = 0; i < forked; i++) {
+      kill(participants[i].pid, SIGKILL);
+      waitpid(participants[i].pid, NULL, 0);
+      if (participants[i].fd >= 0)    close(participants[i].fd);
+      participants[i].fd = -1;
+   }
+   munmap(barrier, sizeof(start_barrier_t));
+   shm_unlink(name.c_str());
+}
+
+/* One run: fork everyone, release them together, gather their output */
+static bool run(std::vector<participant_t>& participants, const char* binary, const std::string& mode, int64_t lead_ns)
+{
+   std::string name = "/membus-barrier-" + std::to_string(getpid());
+   start_barrier_t* barrier = barrier_map(name.c_str(), true);
+   if (barrier == NULL) {
+      printf("ERROR! Cannot create start barrier %s: %s\n", name.c_str(), strerror(errno));
+      return false;
+   }
+   barrier->arrived.store(0);
+   barrier->released.store(0);
+
+   for (size_t i = 0; i < participants.size(); i++) {
+      participant_t& p = participants[i];
+      int pipefd[2];
+      if (pipe(pipefd) != 0) {
+         printf("ERROR! Out of pipes\n");
+         abort_run(participants, i, barrier, name);
+         return false;
+      }
+      p.pid = fork();
+      if (p.pid == 0) {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         CPU_SET(p.cpu.cpu, &set);
+         sched_setaffinity(0, sizeof(set), &set);
+         dup2(pipefd[1], 1);
+         dup2(pipefd[1], 2);
+         close(pipefd[0]);
+         setenv(START_BARRIER_ENV, name.c_str(), 1);
+         std::string id = std::to_string(p.id);
+         execl(binary, binary, id.c_str(), "0", mode.c_str(), (char*) NULL);
+         printf("Could not run %s: %s\n", binary, strerror(errno));
+         _exit(127);
+      }
+      close(pipefd[1]);
+      p.fd = pipefd[0];
+   }
+
+   /* Drain pipes while waiting, so nobody blocks on a full pipe before arriving */
+   bool released = false;
+   int64_t start_ms = monotonic_ms();
+   size_t open_fds = participants.size();
+   while (open_fds > 0) {
+      std::vector<struct pollfd> fds;
+      std::vector<size_t> owners;
+      for (size_t i = 0; i < participants.size(); i++) {
+         if (participants[i].fd < 0)
+            continue;
+         struct pollfd fd = { participants[i].fd, POLLIN, 0 };
+         fds.push_back(fd);
+         owners.push_back(i);
+      }
+      poll(fds.data(), fds.size(), 10);
+      for (size_t f = 0; f < fds.size(); f++) {
+         if (!fds[f].revents)
+            continue;
+         participant_t& p = participants[owners[f]];
+         char buf[4096];
+         ssize_t n = read(p.fd, buf, sizeof(buf));
+         if (n > 0)
+            p.output.append(buf, n);
+         else {
+            close(p.fd);
+            p.fd = -1;
+            open_fds--;
+         }
+      }
+
+      if (!released && barrier->arrived.load() >= (int) participants.size()) {
+         released = barrier_release(barrier, participants.size(), lead_ns, 0);
+      }
+      else if (!released && monotonic_ms() - start_ms > ARRIVAL_TIMEOUT_MS) {
+         printf("ERROR! Only %d of %lu participants got ready\n", barrier->arrived.load(), participants.size());
+         for (size_t i = 0; i < participants.size(); i++)    kill(participants[i].pid, SIGKILL);
+         released = true;
+      }
+   }
+
+   for (size_t i = 0; i < participants.size(); i++) {
+      int status = 0;
+      waitpid(participants[i].pid, &status, 0);
+      participants[i].exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+      parse_result(participants[i]);
+   }
+   munmap(barrier, sizeof(start_barrier_t));
+   shm_unlink(name.c_str());
+   return true;
+}
+
+static std::string field(const participant_t& p, const char* key)
+{
+   std::map<std::string, std::string>::const_iterator it = p.result.find(key);
+   return it == p.result.end() ? "" : it->second;
+}
+
+/* Did this participant learn the ids it should have (the largest ids, one per phase)? */
+static bool learned_right_ids(const participant_t& p, const std::vector<int>& expected)
+{
+   std::map<std::string, std::string>::const_iterator ids = p.result.find("ids");
+   if (ids == p.result.end())
+      return false;
+   std::ostringstream want;
+   for (size_t i = 0; i < expected.size(); i++)    want << (i ? ":" : "") << expected[i];
+   return ids->second == want.str();
+}
+
+int main(int argc, char** argv)
+{
+   std::string counts_spec = "4", topology = "cores", mode = "protocol", out = "launcher";
+   const char* binary = "./lambda";
+   int trials = 1, lead_ms = DEFAULT_LEAD_MS;
+   int opt;
+   while ((opt = getopt(argc, argv, "n:t:m:r:o:l:b:")) != -1) {
+      switch (opt) {
+      case 'n':   counts_spec = optarg;       break;
+      case 't':   topology = optarg;          break;
+      case 'm':   mode = optarg;              break;
+      case 'r':   trials = atoi(optarg);      break;
+      case 'o':   out = optarg;               break;
+      case 'l':   lead_ms = atoi(optarg);     break;
+      case 'b':   binary = optarg;            break;
+      default:
+         printf("Usage: %s [-n counts] [-t cores|smt|sockets|cpu list] [-m protocol|channel] [-r trials] [-o out] [-l lead_ms] [-b ./lambda]\n", argv[0]);
+         return 1;
+      }
+   }
+   std::vector<int> counts = parse_counts(counts_spec);
+   std::vector<cpu_info_t> cpus = plan_cpus(topology);
+   if (counts.empty() || cpus.empty() || trials <= 0 || lead_ms < 0 || (mode != "protocol" && mode != "channel")) {
+      printf("ERROR! Need participant counts, usable CPUs for the topology, positive trials and a known mode\n");
+      return 1;
+   }
+   int min_count = mode == "channel" ? 2 : 1;
+   for (size_t c = 0; c < counts.size(); c++) {
+      if (counts[c] < min_count || counts[c] >= MAX_ID) {
+         printf("ERROR! Participant counts must be in [%d, %d) in %s mode\n", min_count, MAX_ID, mode.c_str());
+         return 1;
+      }
+   }
+   tsc_calibrate();
+   srand(getpid());
+
+   std::ofstream csv(out + ".csv"), json(out + ".json");
+   csv << "count,trial,index,cpu,core,socket,id,pid,exit,skew_ns,time,phases,ids,correct,role,erasures\n";
+   json << "[";
+   bool first_json = true;
+
+   for (size_t c = 0; c < counts.size(); c++) {
+      int count = counts[c];
+      if (count > (int) cpus.size())
+         printf("Note: %d participants on %lu CPUs, some will share\n", count, cpus.size());
+
+      for (int trial = 0; trial < trials; trial++) {
+         /* Distinct random ids, so the winners differ from run to run; the channel's two ends go first */
+         std::set<int> used;
+         std::vector<participant_t> participants(count);
+         if (mode == "channel") {
+            used.insert(CHANNEL_SENDER_ID);
+            used.insert(CHANNEL_RECEIVER_ID);
+         }
+         for (int i = 0; i < count; i++) {
+            participant_t& p = participants[i];
+            p.count = count;
+            p.trial = trial;
+            p.index = i;
+            p.cpu = cpus[i % cpus.size()];
+            if (mode == "channel" && i < 2)
+               p.id = i == 0 ? CHANNEL_SENDER_ID : CHANNEL_RECEIVER_ID;
+            else
+               do { p.id = 1 + rand() % (MAX_ID - 1); } while (!used.insert(p.id).second);
+         }
+         std::vector<int> expected(used.rbegin(), used.rend());
+         expected.resize(std::min((int) expected.size(), PROTOCOL_PHASES));
+
+         if (!run(participants, binary, mode, lead_ms * 1000000LL))
+            return 1;
+
+         int correct = 0, skew_max = 0, senders = 0, receivers = 0;
+         for (int i = 0; i < count; i++) {
+            participant_t& p = participants[i];
+            bool right = learned_right_ids(p, expected);
+            correct += right;
+            skew_max = std::max(skew_max, atoi(field(p, "skew_ns").c_str()));
+            senders += field(p, "role") == "sender";
+            receivers += field(p, "role") == "receiver";
+            csv << count << "," << trial << "," << i << "," << p.cpu.cpu << "," << p.cpu.core << "," << p.cpu.socket << ","
+               << p.id << "," << p.pid << "," << p.exit_status << "," << field(p, "skew_ns") << "," << field(p, "time") << ","
+               << field(p, "phases") << "," << field(p, "ids") << "," << right << "," << field(p, "role") << "," << field(p, "erasures") << "\n";
+
+            json << (first_json ? "" : ",") << "\n  {\"count\": " << count << ", \"trial\": " << trial << ", \"index\": " << i
+               << ", \"cpu\": " << p.cpu.cpu << ", \"core\": " << p.cpu.core << ", \"socket\": " << p.cpu.socket
+               << ", \"id\": " << p.id << ", \"exit\": " << p.exit_status << ", \"correct\": " << (right ? "true" : "false");
+            for (std::map<std::string, std::string>::iterator it = p.result.begin(); it != p.result.end(); ++it)
+               if (it->first != "id")    json << ", \"" << it->first << "\": \"" << it->second << "\"";
+            json << "}";
+            first_json = false;
+         }
+         if (mode == "protocol")
+            printf("%3d participants, trial %d: %d learned the right ids, start skew up to %d ns\n", count, trial, correct, skew_max);
+         else if (senders == 1 && receivers == 1)
+            printf("%3d participants, trial %d: sender %s erasures, receiver %s erasures, start skew up to %d ns\n", count, trial,
+               field(participants[0], "erasures").c_str(), field(participants[1], "erasures").c_str(), skew_max);
+         else
+            printf("%3d participants, trial %d: ERROR! %d senders and %d receivers reported (expected one of each)\n",
+               count, trial, senders, receivers);
+         fflush(stdout);
+      }
+   }
+   json << "\n]\n";
+   printf("Results in %s.csv and %s.json\n", out.c_str(), out.c_str());
+   return 0;
+}
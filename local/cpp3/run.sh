@@ -1,5 +1,6 @@
 #!/bin/bash
 # type "finish" to exit
+# (For sweeps over many participants with a synchronized start, use ./launcher instead)
 
 PIDS=()
 